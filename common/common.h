@@ -5,6 +5,7 @@
  */
 
 #include <errno.h>
+#include <stdbool.h>
 #include <sysexits.h>
 #include <netgraph.h>
 
@@ -32,6 +33,59 @@ typedef int ngctx;
 void	ng_create_context(ngctx *, ngctx *);
 void	ng_shutdown_node(ngctx, ng_ID_t);
 
+/*
+ * Where ng_recv_msg() reads replies, reused from one to the next instead of
+ * NgAllocRecvMsg(3) allocating each. Start it with NG_REPLY_INIT(), either on
+ * a buffer of the caller's sized with NG_REPLYSIZ() for the replies it asks
+ * for, or on (NULL, 0) to have it sized to SO_RCVBUF, the largest reply the
+ * socket can queue. `msg' is the last reply, good until the next one.
+ */
+struct ng_reply {
+	union {
+		struct ng_mesg	*msg;
+		void		*buf;
+	};
+	size_t		size;
+	bool		owned;	/* ours to free, not the caller's */
+};
+#define	NG_REPLY_INIT(b, sz)	{ .buf = (b), .size = (sz) }
+#define	NG_REPLYSIZ(n)		(sizeof(struct ng_mesg) + (n))
+
+int	ng_recv_msg(ngctx, struct ng_reply *, char *);
+void	ng_reply_fini(struct ng_reply *);
+
+/*
+ * Node names, IDs and types from one NGM_LISTNODES: ngcache.c. Start it
+ * zeroed. A lookup that misses reloads once, so nodes made since are found.
+ * `path' is the node's IDFMT path, ready for NgSendMsg(3).
+ */
+struct ng_cache_node {
+	ng_ID_t		id;
+	uint32_t	hooks;
+	char		name[NG_NODESIZ];
+	char		type[NG_TYPESIZ];
+	char		path[NG_NODESIZ];
+};
+
+struct ng_cache {
+	struct ng_cache_node	*nodes;		/* sorted by ID */
+	struct ng_cache_node	**byname;	/* the named ones, by name */
+	size_t			n;
+	size_t			nnamed;
+	size_t			nalloc;
+	bool			valid;
+	struct ng_reply		reply;		/* kept for reloads */
+};
+
+void	ng_cache_load(ngctx, struct ng_cache *);
+const struct ng_cache_node *ng_cache_id(ngctx, struct ng_cache *, ng_ID_t);
+const struct ng_cache_node *ng_cache_name(ngctx, struct ng_cache *,
+	    const char *);
+void	ng_cache_invalidate(struct ng_cache *);
+const struct ng_cache_node *ng_cache_send(ngctx, struct ng_cache *,
+	    const char *, int, int, const void *, size_t);
+void	ng_cache_fini(struct ng_cache *);
+
 /*
  * module loading: kld.c
  */
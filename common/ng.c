@@ -10,6 +10,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/socket.h>
+
+#include <netgraph/ng_socket.h>
 
 #include "common.h"
 
@@ -51,3 +54,99 @@ ng_shutdown_node(ngctx ctrl, ng_ID_t nd)
 		"Failed to shutdown node.\ntry:\n\tngctl shutdown %s\n", pth
 	);
 }
+
+
+static int
+ng_reply_grow(ngctx ctrl, struct ng_reply *r)
+{
+	int rcvbuf;
+	socklen_t len = sizeof(rcvbuf);
+	void *buf;
+
+	if (getsockopt(ctrl, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len) == -1)
+		return (-1);
+	if ((size_t)rcvbuf <= r->size) {
+		errno = EMSGSIZE; /* and it never will fit */
+		return (-1);
+	}
+	if ((buf = malloc(rcvbuf)) == NULL)
+		return (-1);
+
+	ng_reply_fini(r);
+	r->buf = buf;
+	r->size = rcvbuf;
+	r->owned = true;
+	return (0);
+}
+
+/*
+ * NgRecvMsg(3) into `r', so a thousand replies cost no malloc(3) at all and a
+ * reply is parsed right where it landed. It is one recvmsg(2) per reply, the
+ * buffer is never peeked at first. A reply too big for a buffer of the
+ * caller's is lost: that one fails with EMSGSIZE, but `r' grows to SO_RCVBUF
+ * and still has the header of the lost reply, so whoever asked for it can tell
+ * by the token and ask again. `path', if not NULL, is NG_PATHSIZ like
+ * NgRecvMsg(3).
+ */
+int
+ng_recv_msg(ngctx ctrl, struct ng_reply *r, char *path)
+{
+	ssize_t rc;
+	struct ng_mesg hdr;
+	union {
+		struct sockaddr_ng	sg;
+		char			buf[sizeof(struct sockaddr_ng) +
+					    NG_PATHSIZ];
+	} from;
+	struct iovec iov;
+	struct msghdr msg = {
+		.msg_name = &from,
+		.msg_namelen = sizeof(from),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+	};
+
+	assert(ctrl >= 0);
+	assert(r != NULL);
+
+	if (r->size == 0 && ng_reply_grow(ctrl, r) == -1)
+		return (-1);
+	assert(r->size >= sizeof(hdr));
+
+	iov.iov_base = r->buf;
+	iov.iov_len = r->size;
+	do {
+		rc = recvmsg(ctrl, &msg, 0);
+	} while (rc == -1 && errno == EINTR);
+	if (rc == -1)
+		return (-1);
+
+	if ((msg.msg_flags & MSG_TRUNC) != 0) {
+		memcpy(&hdr, r->buf, sizeof(hdr));
+		if (ng_reply_grow(ctrl, r) == 0) {
+			memcpy(r->buf, &hdr, sizeof(hdr));
+			errno = EMSGSIZE;
+		}
+		return (-1);
+	}
+	if ((size_t)rc < sizeof(struct ng_mesg)) {
+		errno = EBADMSG;
+		return (-1);
+	}
+
+	if (path != NULL) {
+		from.buf[sizeof(from.buf) - 1] = '\0';
+		strlcpy(path, from.sg.sg_data, NG_PATHSIZ);
+	}
+	return (int)(rc);
+}
+
+void
+ng_reply_fini(struct ng_reply *r)
+{
+	if (r->owned)
+		free(r->buf);
+	r->buf = NULL;
+	r->size = 0;
+	r->owned = false;
+}
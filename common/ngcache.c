@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <assert.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+
+/*
+ * Every node of the graph from one NGM_LISTNODES, so resolving a name, an ID
+ * or a type doesn't cost a round trip each, and every node's `[%08x]:' path
+ * is made once rather than around each message.
+ *
+ * The graph changes underneath us. A name or ID that isn't there makes for
+ * one reload, anything a message to a cached path gets ENOENT for should be
+ * passed to ng_cache_invalidate() so the next lookup reloads as well, which
+ * ng_cache_send() does by itself.
+ */
+
+static int
+cmp_id(const void *a, const void *b)
+{
+	const struct ng_cache_node *l = a, *r = b;
+
+	return (l->id > r->id) - (l->id < r->id);
+}
+
+static int
+cmp_name(const void *a, const void *b)
+{
+	const struct ng_cache_node *l = *(struct ng_cache_node * const *)a;
+	const struct ng_cache_node *r = *(struct ng_cache_node * const *)b;
+
+	return strcmp(l->name, r->name);
+}
+
+/* one NGM_LISTNODES, replacing whatever was cached */
+void
+ng_cache_load(ngctx ctrl, struct ng_cache *c)
+{
+	int rc;
+	uint32_t ix;
+	struct namelist *nlist;
+	struct ng_cache_node *cn;
+
+	assert(ctrl >= 0);
+	assert(c != NULL);
+
+	rc = NgSendMsg(ctrl, ".", NGM_GENERIC_COOKIE, NGM_LISTNODES, NULL, 0);
+	if (rc == -1) err(
+		ERREXIT, "unable to request node list"
+	);
+	rc = ng_recv_msg(ctrl, &c->reply, NULL);
+	if (rc == -1) err(
+		ERREXIT, "unable to retrieve node list"
+	);
+	nlist = (struct namelist *) c->reply.msg->data;
+
+	if (nlist->numnames > c->nalloc) {
+		c->nalloc = nlist->numnames;
+		c->nodes = reallocf(c->nodes, c->nalloc * sizeof(*c->nodes));
+		c->byname = reallocf(c->byname, c->nalloc * sizeof(*c->byname));
+		if (c->nodes == NULL || c->byname == NULL) err(
+			EX_OSERR, "%s: unable to allocate %zu nodes",
+			__func__, c->nalloc
+		);
+	}
+
+	c->n = c->nnamed = 0;
+	for (ix = 0; ix < nlist->numnames; ix++) {
+		const struct nodeinfo *ni = &nlist->nodeinfo[ix];
+
+		cn = &c->nodes[c->n++];
+		cn->id = ni->id;
+		cn->hooks = ni->hooks;
+		strlcpy(cn->name, ni->name, sizeof(cn->name));
+		strlcpy(cn->type, ni->type, sizeof(cn->type));
+		snprintf(cn->path, sizeof(cn->path), IDFMT, ni->id);
+	}
+	qsort(c->nodes, c->n, sizeof(*c->nodes), cmp_id);
+
+	/* after the sort, `byname' points into `nodes' */
+	for (ix = 0; ix < c->n; ix++)
+		if (c->nodes[ix].name[0] != '\0')
+			c->byname[c->nnamed++] = &c->nodes[ix];
+	qsort(c->byname, c->nnamed, sizeof(*c->byname), cmp_name);
+
+	c->valid = true;
+}
+
+static const struct ng_cache_node *
+find_id(const struct ng_cache *c, ng_ID_t id)
+{
+	struct ng_cache_node key = { .id = id };
+
+	return bsearch(&key, c->nodes, c->n, sizeof(*c->nodes), cmp_id);
+}
+
+static const struct ng_cache_node *
+find_name(const struct ng_cache *c, const char *name)
+{
+	struct ng_cache_node key, *pkey = &key, **found;
+
+	strlcpy(key.name, name, sizeof(key.name));
+	found = bsearch(&pkey, c->byname, c->nnamed, sizeof(*c->byname),
+	    cmp_name);
+
+	return (found != NULL) ? *found : NULL;
+}
+
+const struct ng_cache_node *
+ng_cache_id(ngctx ctrl, struct ng_cache *c, ng_ID_t id)
+{
+	const struct ng_cache_node *cn = NULL;
+
+	if (c->valid)
+		cn = find_id(c, id);
+	if (cn == NULL) {
+		ng_cache_load(ctrl, c);
+		cn = find_id(c, id);
+	}
+	return (cn);
+}
+
+/* `name' can also be `[id]', the way netgraph(4) addresses by ID */
+const struct ng_cache_node *
+ng_cache_name(ngctx ctrl, struct ng_cache *c, const char *name)
+{
+	const struct ng_cache_node *cn = NULL;
+	char *ep;
+	unsigned long id;
+
+	assert(name != NULL);
+
+	if (name[0] == '[') {
+		id = strtoul(name + 1, &ep, 16);
+		if (ep == name + 1 || ep[0] != ']' || ep[1] != '\0')
+			return (NULL);
+		return ng_cache_id(ctrl, c, (ng_ID_t)id);
+	}
+
+	if (c->valid)
+		cn = find_name(c, name);
+	if (cn == NULL) {
+		ng_cache_load(ctrl, c);
+		cn = find_name(c, name);
+	}
+	return (cn);
+}
+
+void
+ng_cache_invalidate(struct ng_cache *c)
+{
+	c->valid = false;
+}
+
+/*
+ * NgSendMsg(3) to the node `name' by its cached path. When the kernel has no
+ * node there anymore the cache is stale, so it is reloaded and `name' looked
+ * up once more. Returns the node it went to, or NULL with errno set; ENOENT
+ * when there is no such node at all.
+ */
+const struct ng_cache_node *
+ng_cache_send(ngctx ctrl, struct ng_cache *c, const char *name, int cookie,
+    int cmd, const void *args, size_t arglen)
+{
+	int tries;
+	const struct ng_cache_node *cn;
+
+	for (tries = 0; tries < 2; tries++) {
+		if ((cn = ng_cache_name(ctrl, c, name)) == NULL) {
+			errno = ENOENT;
+			return (NULL);
+		}
+		if (NgSendMsg(ctrl, cn->path, cookie, cmd, args, arglen) != -1)
+			return (cn);
+		if (errno != ENOENT)
+			return (NULL);
+		ng_cache_invalidate(c);
+	}
+	return (NULL);
+}
+
+void
+ng_cache_fini(struct ng_cache *c)
+{
+	free(c->nodes);
+	free(c->byname);
+	ng_reply_fini(&c->reply);
+	memset(c, 0, sizeof(*c));
+}
@@ -0,0 +1,447 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <assert.h>
+#include <ctype.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ngapply.h"
+
+/*
+ * Splitting an ngctl(8) file into pieces that can run at the same time.
+ *
+ * Every name or ID that shows up as a node in a command is a key. Keys that
+ * appear on the same line are merged (union-find), a mkpeer or connect puts
+ * both ends in one component and `name' merges the old and new name. What is
+ * left are sets of lines that never touch each other's nodes.
+ *
+ * The socket (`.') is the awkward one. It is per ngctl(8) process, so it does
+ * not join anything. Instead `.:hook' (or plain `hook') stands for whatever
+ * was last put on that hook of the socket, which is how every example here
+ * creates its ng_eiface(4).
+ */
+
+#define	NOKEY	(-1)
+
+struct part {
+	char	**name;
+	int	*parent;
+	size_t	n;
+	size_t	nalloc;
+	struct {
+		char	hook[NG_HOOKSIZ];
+		int	key;
+	}	*sock;		/* hooks on `.' and what they lead to */
+	size_t	nsock;
+	int	npseudo;
+	bool	serial;		/* saw something we don't understand */
+};
+
+static int
+key_new(struct part *p, const char *name)
+{
+	if (p->n == p->nalloc) {
+		p->nalloc = (p->nalloc == 0) ? 64 : p->nalloc * 2;
+		p->name = realloc(p->name, p->nalloc * sizeof(*p->name));
+		p->parent = realloc(p->parent, p->nalloc * sizeof(*p->parent));
+		if (p->name == NULL || p->parent == NULL) err(
+			EX_OSERR, "%s: unable to grow to %zu keys",
+			__func__, p->nalloc
+		);
+	}
+	if ((p->name[p->n] = strdup(name)) == NULL) err(
+		EX_OSERR, "%s: strdup", __func__
+	);
+	p->parent[p->n] = (int)p->n;
+
+	return (int)p->n++;
+}
+
+/* configs are hundreds of lines, not millions, a linear search is fine */
+static int
+key_intern(struct part *p, const char *name)
+{
+	size_t ix;
+
+	for (ix = 0; ix < p->n; ix++)
+		if (strcmp(p->name[ix], name) == 0)
+			return (int)ix;
+
+	return key_new(p, name);
+}
+
+static int
+key_find(struct part *p, int key)
+{
+	while (p->parent[key] != key) {
+		p->parent[key] = p->parent[p->parent[key]]; /* halving */
+		key = p->parent[key];
+	}
+	return (key);
+}
+
+static int
+key_union(struct part *p, int a, int b)
+{
+	if (a == NOKEY)
+		return (b);
+	if (b == NOKEY)
+		return (a);
+
+	a = key_find(p, a);
+	b = key_find(p, b);
+	if (a != b)
+		p->parent[b] = a;
+
+	return (a);
+}
+
+static int *
+sock_slot(struct part *p, const char *hook, bool create)
+{
+	size_t ix;
+
+	for (ix = 0; ix < p->nsock; ix++)
+		if (strcmp(p->sock[ix].hook, hook) == 0)
+			return &p->sock[ix].key;
+	if (!create)
+		return (NULL);
+
+	p->sock = realloc(p->sock, (p->nsock + 1) * sizeof(*p->sock));
+	if (p->sock == NULL) err(
+		EX_OSERR, "%s: unable to grow socket hooks", __func__
+	);
+	snprintf(p->sock[p->nsock].hook, NG_HOOKSIZ, "%s", hook);
+	p->sock[p->nsock].key = NOKEY;
+
+	return &p->sock[p->nsock++].key;
+}
+
+/* a node nobody has named yet, hanging off a hook of our socket */
+static int
+sock_bind(struct part *p, const char *hook, int key)
+{
+	char name[NG_NODESIZ + NG_HOOKSIZ];
+
+	if (key == NOKEY) {
+		snprintf(name, sizeof(name), ".:%s#%d", hook, p->npseudo++);
+		key = key_new(p, name);
+	}
+	*sock_slot(p, hook, true) = key;
+
+	return (key);
+}
+
+static void
+sock_unbind(struct part *p, const char *hook)
+{
+	int *slot = sock_slot(p, hook, false);
+
+	if (slot != NULL)
+		*slot = NOKEY;
+}
+
+/*
+ * Split `path' into node and hook parts, `hook' is NULL for the node itself.
+ * A path without ':' is relative to the socket.
+ */
+static bool
+is_socket(const char *path, char *node, size_t size, const char **hook)
+{
+	const char *colon = strchr(path, ':');
+
+	if (colon == NULL) {
+		snprintf(node, size, ".");
+		*hook = (*path == '\0') ? NULL : path;
+	} else {
+		snprintf(node, size, "%.*s", (int)(colon - path), path);
+		*hook = (colon[1] == '\0') ? NULL : colon + 1;
+	}
+
+	return (node[0] == '\0' || strcmp(node, ".") == 0);
+}
+
+/*
+ * Anything past `node:' is connected to `node' so it is in the same component,
+ * no need to follow it. Only the first hop off the socket matters.
+ */
+static int
+path_key(struct part *p, const char *path)
+{
+	char node[NG_NODESIZ + 8], first[NG_HOOKSIZ];
+	const char *hook;
+	int *slot;
+
+	if (!is_socket(path, node, sizeof(node), &hook))
+		return key_intern(p, node);
+	if (hook == NULL)
+		return (NOKEY);	/* the socket itself joins nothing */
+
+	snprintf(first, sizeof(first), "%.*s", (int)strcspn(hook, "."), hook);
+	slot = sock_slot(p, first, false);
+	if (slot != NULL && *slot != NOKEY)
+		return (*slot);
+
+	return sock_bind(p, first, NOKEY); /* connected before we started */
+}
+
+/*
+ * Work out the key for one line, merging everything it touches. Returns NOKEY
+ * for lines that don't reference a node.
+ */
+static int
+line_key(struct part *p, struct conf_line *ln)
+{
+	int a, b, argc = ln->argc;
+	char **argv = ln->argv;
+	const char *cmd = argv[0], *hook;
+	char node[NG_NODESIZ + 8];
+
+	if (strcmp(cmd, "mkpeer") == 0) {
+		/* mkpeer [path] type hook peerhook */
+		const char *path = (argc == 5) ? argv[1] : ".";
+		const char *ourhook = argv[argc - 2];
+
+		if (argc != 4 && argc != 5)
+			return (NOKEY);
+		a = path_key(p, path);
+		if (a == NOKEY)
+			a = sock_bind(p, ourhook, NOKEY);
+		return (a);
+	}
+
+	if (strcmp(cmd, "connect") == 0) {
+		/* connect [path] relpath hook peerhook */
+		const char *path = (argc == 5) ? argv[1] : ".";
+		const char *rel = argv[argc - 3];
+
+		if (argc != 4 && argc != 5)
+			return (NOKEY);
+		a = path_key(p, path);
+		/* a relative `relpath' hangs off `path', same component */
+		b = (strchr(rel, ':') != NULL) ? path_key(p, rel) : a;
+
+		if (a == NOKEY && b != NOKEY)
+			sock_bind(p, argv[argc - 2], b);
+		return key_union(p, a, b);
+	}
+
+	if (strcmp(cmd, "name") == 0) {
+		if (argc != 3)
+			return (NOKEY);
+		a = path_key(p, argv[1]);
+		if (a == NOKEY)
+			return (NOKEY); /* renaming our own socket */
+		b = key_intern(p, argv[2]);
+		return key_union(p, a, b);
+	}
+
+	if (strcmp(cmd, "rmhook") == 0 || strcmp(cmd, "disconnect") == 0) {
+		/* rmhook [path] hook */
+		const char *path = (argc == 3) ? argv[1] : ".";
+
+		if (argc != 2 && argc != 3)
+			return (NOKEY);
+		if (!is_socket(path, node, sizeof(node), &hook) || hook != NULL)
+			return path_key(p, path);
+
+		/* the node on that socket hook is on its own from now on */
+		a = path_key(p, argv[argc - 1]);
+		sock_unbind(p, argv[argc - 1]);
+		return (a);
+	}
+
+	/* everything else that takes a path takes it first */
+	if (strcmp(cmd, "msg") == 0 ||
+	    strcmp(cmd, "shutdown") == 0 || strcmp(cmd, "kill") == 0 ||
+	    strcmp(cmd, "show") == 0 || strcmp(cmd, "info") == 0 ||
+	    strcmp(cmd, "status") == 0 || strcmp(cmd, "config") == 0 ||
+	    strcmp(cmd, "write") == 0) {
+		if (argc < 2)
+			return (NOKEY);
+		return path_key(p, argv[1]);
+	}
+
+	/* harmless on their own */
+	if (strcmp(cmd, "ls") == 0 || strcmp(cmd, "list") == 0 ||
+	    strcmp(cmd, "types") == 0 || strcmp(cmd, "debug") == 0 ||
+	    strcmp(cmd, "help") == 0 || strcmp(cmd, "?") == 0)
+		return (NOKEY);
+
+	warnx("%s: line %d: `%s' not understood, applying serially",
+	    "partition", ln->lineno, cmd);
+	p->serial = true;
+
+	return (NOKEY);
+}
+
+/*
+ * Fill in `comp' for every line. Components are numbered in the order they
+ * first appear so output is stable. Comments, blank lines and lines that
+ * reference no node get -1; they go with every component.
+ */
+void
+conf_partition(struct conf *cf)
+{
+	struct part p = { 0 };
+	int *keys, *number, key, prev = NOKEY;
+	size_t ix;
+
+	assert(cf != NULL);
+
+	keys = calloc(cf->nlines + 1, sizeof(*keys));
+	if (keys == NULL) err(
+		EX_OSERR, "%s: unable to allocate", __func__
+	);
+
+	for (ix = 0; ix < cf->nlines; ix++) {
+		struct conf_line *ln = &cf->lines[ix];
+
+		keys[ix] = NOKEY;
+		if (ln->argc == 0)
+			continue;
+		key = line_key(&p, ln);
+		/* something like `msg .: ...' goes with what came before */
+		keys[ix] = (key == NOKEY) ? prev : key;
+		if (key != NOKEY)
+			prev = key;
+	}
+
+	number = malloc((p.n + 1) * sizeof(*number));
+	if (number == NULL) err(
+		EX_OSERR, "%s: unable to allocate", __func__
+	);
+	for (ix = 0; ix < p.n; ix++)
+		number[ix] = -1;
+
+	cf->ncomp = 0;
+	for (ix = 0; ix < cf->nlines; ix++) {
+		if (keys[ix] == NOKEY) {
+			cf->lines[ix].comp = -1;
+			continue;
+		}
+		key = p.serial ? 0 : key_find(&p, keys[ix]);
+		if (number[key] == -1)
+			number[key] = cf->ncomp++;
+		cf->lines[ix].comp = number[key];
+	}
+
+	for (ix = 0; ix < p.n; ix++)
+		free(p.name[ix]);
+	free(p.name);
+	free(p.parent);
+	free(p.sock);
+	free(number);
+	free(keys);
+}
+
+/*
+ * ngctl(8) splits on white space, we also keep "quoted strings" together so a
+ * `msg' argument like hook="a b" stays one word.
+ */
+static int
+split(char *s, char ***argvp)
+{
+	char **argv = NULL, *word;
+	int argc = 0;
+	bool quoted;
+
+	for (;;) {
+		while (isspace((unsigned char)*s))
+			s++;
+		if (*s == '\0')
+			break;
+
+		word = s;
+		for (quoted = false; *s != '\0'; s++) {
+			if (*s == '"')
+				quoted = !quoted;
+			else if (!quoted && isspace((unsigned char)*s))
+				break;
+		}
+		if (*s != '\0')
+			*s++ = '\0';
+
+		argv = realloc(argv, (argc + 2) * sizeof(*argv));
+		if (argv == NULL) err(
+			EX_OSERR, "%s: unable to allocate", __func__
+		);
+		argv[argc++] = word;
+	}
+	if (argv != NULL)
+		argv[argc] = NULL;
+	*argvp = argv;
+
+	return (argc);
+}
+
+/*
+ * Read the whole file. Every line is kept, comments included, so a component
+ * can be replayed with its original line numbers.
+ */
+int
+conf_load(struct conf *cf, const char *file)
+{
+	FILE *fp;
+	char *line = NULL, *words;
+	size_t cap = 0, nalloc = 0;
+	ssize_t len;
+	struct conf_line *ln;
+
+	assert(cf != NULL);
+	assert(file != NULL);
+
+	if (strcmp(file, "-") == 0)
+		fp = stdin;
+	else if ((fp = fopen(file, "r")) == NULL)
+		return (-1);
+
+	cf->file = file;
+	cf->nlines = 0;
+	while ((len = getline(&line, &cap, fp)) != -1) {
+		if (cf->nlines == nalloc) {
+			nalloc = (nalloc == 0) ? 128 : nalloc * 2;
+			cf->lines = realloc(
+				cf->lines, nalloc * sizeof(*cf->lines)
+			);
+			if (cf->lines == NULL) err(
+				EX_OSERR, "%s: unable to grow to %zu lines",
+				__func__, nalloc
+			);
+		}
+		ln = &cf->lines[cf->nlines++];
+		memset(ln, 0, sizeof(*ln));
+		ln->lineno = (int)cf->nlines;
+		ln->comp = -1;
+		if ((ln->text = strdup(line)) == NULL) err(
+			EX_OSERR, "%s: strdup", __func__
+		);
+
+		/* same rule as ngctl(8): only a leading '#' is a comment */
+		if (line[0] == '#')
+			continue;
+		if ((words = strdup(line)) == NULL) err(
+			EX_OSERR, "%s: strdup", __func__
+		);
+		ln->argc = split(words, &ln->argv);
+		if (ln->argc == 0)
+			free(words);
+	}
+	free(line);
+
+	if (ferror(fp)) {
+		if (fp != stdin)
+			fclose(fp);
+		return (-1);
+	}
+	if (fp != stdin)
+		fclose(fp);
+
+	return (0);
+}
@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <assert.h>
+#include <err.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef __FreeBSD__
+#include <sys/param.h>
+#include <sys/linker.h>
+#include <sys/module.h>
+#endif
+
+#include "ngapply.h"
+
+/* name of our utility */
+#define	ME	"ngapply"
+
+#define	NGCTL	"/usr/sbin/ngctl"
+
+/*
+ * The single purpose of this utility is to do what `ngctl -f' does, only with
+ * every independent part of the file running at the same time.
+ */
+
+static void
+Usage(const char *format, ...)
+{
+	if (format != NULL) {
+		va_list ap;
+		va_start(ap, format);
+		(void) vfprintf(stderr, format, ap);
+		va_end(ap);
+	}
+
+	(void) fprintf(
+	    stderr,
+	    "USAGE: " ME " [-l] [-j jail] [-P jobs] file\n"
+	    "       " ME " -c [-e ifname ...] [-t msec] file\n"
+	    "-c\t\tCheck `file' against a model of netgraph(4), apply nothing.\n"
+	    "-e ifname\tWith -c, an interface (ng_ether(4)) that exists.\n"
+	    "-l\t\tList the independent parts of `file' and exit.\n"
+	    "-j jail\t\tApply inside jail (passed on to ngctl(8)).\n"
+	    "-P jobs\t\tRun at most `jobs' ngctl(8) at once (default: number\n"
+	    "\t\tof CPUs).\n"
+	    "-t msec\t\tWith -c, fail if predicted setup takes longer.\n\n"
+	    "`file' is an ngctl(8) command file, `-' reads stdin. The environment\n"
+	    "variable NGCTL overrides the path to ngctl(8).\n"
+	);
+
+	exit(EX_USAGE);
+}
+
+/*
+ * Dry run. Nothing here needs netgraph(4) so this is what CI runs, on any OS,
+ * to catch a broken config before it takes the network down at boot.
+ */
+static int
+check(struct conf *cf, char **ethers, int nethers, long budget)
+{
+	int errors;
+	unsigned long nmsgs, serial, parallel;
+
+	errors = sim_run(cf, ethers, nethers, &nmsgs, &serial, &parallel);
+
+	(void) printf(
+		"%s: %lu messages in %d part%s\n"
+		"%s: predicted setup %.1f ms serial, %.1f ms with " ME "\n",
+		cf->file, nmsgs, cf->ncomp, cf->ncomp == 1 ? "" : "s",
+		cf->file, serial / 1000.0, parallel / 1000.0
+	);
+
+	if (errors != 0)
+		return (EX_DATAERR);
+	if (budget >= 0 && parallel > (unsigned long)budget * 1000) {
+		warnx("%s: predicted %.1f ms exceeds %ld ms",
+		    cf->file, parallel / 1000.0, budget);
+		return (EX_DATAERR);
+	}
+	return (0);
+}
+
+static void
+list(struct conf *cf)
+{
+	int comp;
+	size_t ix;
+
+	for (comp = 0; comp < cf->ncomp; comp++) {
+		(void) printf("# part %d\n", comp);
+		for (ix = 0; ix < cf->nlines; ix++)
+			if (cf->lines[ix].comp == comp)
+				(void) printf("%5d: %s", cf->lines[ix].lineno,
+				    cf->lines[ix].text);
+	}
+}
+
+#ifdef __FreeBSD__
+/*
+ * Two ngctl(8) doing `mkpeer' of a type that isn't loaded yet both try to
+ * load the module. Get that out of the way first, one at a time. Failing here
+ * is not fatal, ngctl(8) will report it properly.
+ */
+static void
+preload(struct conf *cf)
+{
+	size_t ix;
+	char mod[NG_TYPESIZ + 3];
+
+	for (ix = 0; ix < cf->nlines; ix++) {
+		struct conf_line *ln = &cf->lines[ix];
+
+		if (ln->argc < 4 || strcmp(ln->argv[0], "mkpeer") != 0)
+			continue;
+		snprintf(mod, sizeof(mod), "ng_%s", ln->argv[ln->argc - 3]);
+		if (modfind(mod) == -1 && kldload(mod) == -1 && errno != EEXIST)
+			warn("unable to load kernel module \"%s\"", mod);
+	}
+}
+#endif
+
+/*
+ * ngctl(8) numbers lines as it reads them. Lines that belong to other parts
+ * are fed as an empty comment, so any error it reports has the line number
+ * from the original file.
+ */
+static void
+feed(FILE *fp, struct conf *cf, int comp)
+{
+	size_t ix;
+
+	for (ix = 0; ix < cf->nlines; ix++) {
+		struct conf_line *ln = &cf->lines[ix];
+
+		if (ln->comp == comp || ln->argc == 0 ||
+		    (ln->comp == -1 && comp == 0))
+			(void) fputs(ln->text, fp);
+		else
+			(void) fputs("#\n", fp);
+	}
+}
+
+/*
+ * A child per part feeds its own ngctl(8) so a slow part (creating interfaces
+ * is not cheap) never holds up starting the others. The child exits with the
+ * status of its ngctl(8).
+ */
+static pid_t
+spawn(struct conf *cf, int comp, const char *ngctl, const char *jail)
+{
+	int fds[2], status, rc;
+	pid_t pid, kid;
+	FILE *fp;
+
+	pid = fork();
+	if (pid == -1) err(
+		EX_OSERR, "%s: fork()", __func__
+	);
+	if (pid != 0)
+		return (pid);
+
+	if (pipe(fds) == -1) err(
+		EX_OSERR, "part %d: pipe()", comp
+	);
+	kid = fork();
+	if (kid == -1) err(
+		EX_OSERR, "part %d: fork()", comp
+	);
+	if (kid == 0) {
+		(void) close(fds[1]);
+		if (dup2(fds[0], STDIN_FILENO) == -1) err(
+			EX_OSERR, "part %d: dup2()", comp
+		);
+		(void) close(fds[0]);
+		if (jail != NULL)
+			execl(ngctl, "ngctl", "-j", jail, "-f", "-", (char *)NULL);
+		else
+			execl(ngctl, "ngctl", "-f", "-", (char *)NULL);
+		err(EX_OSFILE, "part %d: unable to run %s", comp, ngctl);
+	}
+
+	(void) close(fds[0]);
+	if ((fp = fdopen(fds[1], "w")) == NULL) err(
+		EX_OSERR, "part %d: fdopen()", comp
+	);
+	feed(fp, cf, comp);
+	(void) fclose(fp); /* EOF, ngctl(8) is done when it gets here */
+
+	do {
+		rc = waitpid(kid, &status, 0);
+	} while (rc == -1 && errno == EINTR);
+	if (rc == -1) err(
+		EX_OSERR, "part %d: waitpid()", comp
+	);
+
+	_exit(WIFEXITED(status) ? WEXITSTATUS(status) : EX_SOFTWARE);
+}
+
+static int
+reap(struct conf *cf, pid_t *pids, int *running)
+{
+	int ix, status, first = 0;
+	pid_t pid;
+	size_t ln;
+
+	do {
+		pid = wait(&status);
+	} while (pid == -1 && errno == EINTR);
+	if (pid == -1) err(
+		EX_OSERR, "wait()"
+	);
+	(*running)--;
+
+	for (ix = 0; ix < cf->ncomp; ix++)
+		if (pids[ix] == pid)
+			break;
+	if (ix == cf->ncomp)
+		return (0); /* not ours */
+
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+		return (0);
+
+	for (ln = 0; ln < cf->nlines; ln++)
+		if (cf->lines[ln].comp == ix) {
+			first = cf->lines[ln].lineno;
+			break;
+		}
+	warnx("%s: part %d (starting line %d) failed", cf->file, ix, first);
+
+	return (1);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ch, comp, running = 0, failed = 0, nethers = 0;
+	long jobs = sysconf(_SC_NPROCESSORS_ONLN), budget = -1;
+	bool listonly = false, dryrun = false;
+	char **ethers = NULL;
+	const char *jail = NULL, *ngctl;
+	pid_t *pids;
+	struct conf cf = { 0 };
+
+	while ((ch = getopt(argc, argv, ":ce:lj:P:t:")) != -1) {
+		switch (ch) {
+		case 'c':
+			dryrun = true;
+			break;
+		case 'e':
+		    {
+			char *ifname;
+
+			/* repeat it or give a comma separated list */
+			while ((ifname = strsep(&optarg, ",")) != NULL) {
+				if (*ifname == '\0')
+					continue;
+				ethers = realloc(ethers,
+				    (nethers + 1) * sizeof(*ethers));
+				if (ethers == NULL) err(
+					EX_OSERR, "unable to allocate"
+				);
+				ethers[nethers++] = ifname;
+			}
+			break;
+		    }
+		case 't':
+		    {
+			char *ep;
+
+			budget = strtol(optarg, &ep, 10);
+			if (*optarg == '\0' || *ep != '\0' || budget < 0) Usage(
+				ME ": msec must be a positive integer: \"%s\"\n\n",
+				optarg
+			);
+			break;
+		    }
+		case 'l':
+			listonly = true;
+			break;
+		case 'j':
+			jail = optarg;
+			break;
+		case 'P':
+		    {
+			char *ep;
+
+			jobs = strtol(optarg, &ep, 10);
+			if (*optarg == '\0' || *ep != '\0' || jobs < 1) Usage(
+				ME ": jobs must be a positive integer: \"%s\"\n\n",
+				optarg
+			);
+			break;
+		    }
+		default:
+			Usage(
+				ME ": unrecognized option `%s'\n\n",
+				argv[optind - 1]
+			);
+		}
+	}
+	argv += optind;
+	argc -= optind;
+
+	if (argc != 1) Usage(
+		ME ": exactly one file must be given\n\n"
+	);
+	if (!dryrun && (nethers != 0 || budget != -1)) Usage(
+		ME ": -e and -t only make sense with -c\n\n"
+	);
+	if (jobs < 1)
+		jobs = 1;
+	if ((ngctl = getenv("NGCTL")) == NULL)
+		ngctl = NGCTL;
+
+	if (conf_load(&cf, argv[0]) == -1) err(
+		EX_NOINPUT, "%s", argv[0]
+	);
+	conf_partition(&cf);
+
+	if (listonly) {
+		list(&cf);
+		return (0);
+	}
+	if (dryrun)
+		return check(&cf, ethers, nethers, budget);
+	if (cf.ncomp == 0)
+		return (0);
+
+#ifdef __FreeBSD__
+	if (cf.ncomp > 1)
+		preload(&cf);
+#endif
+
+	pids = calloc(cf.ncomp, sizeof(*pids));
+	if (pids == NULL) err(
+		EX_OSERR, "unable to allocate %d parts", cf.ncomp
+	);
+
+	for (comp = 0; comp < cf.ncomp; comp++) {
+		if (running == jobs)
+			failed += reap(&cf, pids, &running);
+		pids[comp] = spawn(&cf, comp, ngctl, jail);
+		running++;
+	}
+	while (running > 0)
+		failed += reap(&cf, pids, &running);
+
+	return (failed == 0) ? 0 : EX_DATAERR;
+}
@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sysexits.h>
+
+/*
+ * Nothing here talks to netgraph(4) directly, ngctl(8) does that for us. So
+ * unlike the other utilities this does not need <netgraph.h> and builds
+ * anywhere, which is the point for checking configs off the box.
+ */
+#ifndef nitems
+#define	nitems(x)	(sizeof((x)) / sizeof((x)[0]))
+#endif
+
+/* same limits as <netgraph/ng_message.h> */
+#define	NG_TYPESIZ	32
+#define	NG_HOOKSIZ	32
+#define	NG_NODESIZ	32
+
+struct conf_line {
+	int	lineno;		/* in the original file */
+	int	comp;		/* connected component, from conf_partition */
+	int	argc;
+	char	**argv;		/* words of `text' split like ngctl(8) */
+	char	*text;		/* exactly as read, fed to ngctl(8) */
+};
+
+struct conf {
+	const char		*file;
+	struct conf_line	*lines;
+	size_t			nlines;
+	int			ncomp;
+};
+
+/* conf.c */
+int	conf_load(struct conf *, const char *);
+void	conf_partition(struct conf *);
+
+/* sim.c */
+int	sim_run(struct conf *, char **, int,
+	    unsigned long *, unsigned long *, unsigned long *);
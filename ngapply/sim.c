@@ -0,0 +1,718 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <assert.h>
+#include <ctype.h>
+#include <err.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ngapply.h"
+
+/*
+ * A pretend netgraph(4) good enough to catch the mistakes that bite at boot:
+ * typos in names and hooks, hooks used twice, filters for hooks that don't
+ * exist and nodes that vanish because their last hook went away before they
+ * were made persistent.
+ *
+ * Only the node types used in examples/ are modelled. Anything else in a
+ * `mkpeer' is reported as an unknown type, which is also what a typo there
+ * looks like.
+ */
+
+struct sim_hook {
+	char		name[NG_HOOKSIZ];
+	struct sim_node	*peer;
+	char		peerhook[NG_HOOKSIZ];
+};
+
+struct sim_filter {
+	unsigned	vid;
+	char		hook[NG_HOOKSIZ];
+};
+
+struct sim_node {
+	const struct sim_type	*type;
+	char			name[NG_NODESIZ];
+	char			ifname[NG_NODESIZ];	/* ng_ether(4) only */
+	unsigned		id;
+	bool			persistent;
+	bool			dead;
+	struct sim_hook		*hooks;
+	size_t			nhooks;
+	struct sim_filter	*filters;		/* ng_vlan(4) only */
+	size_t			nfilters;
+};
+
+struct sim_type {
+	const char	*name;
+	bool		persist;	/* survives losing its last hook */
+	unsigned	cost;		/* extra usec to create one */
+	const char	*hooks[5];	/* exact names, NULL ends */
+	const char	*prefix[3];	/* name + number, NULL ends */
+	bool		anyhook;	/* anything else goes too */
+	const char	*cmds[12];	/* `msg' commands, NULL ends */
+};
+
+/*
+ * The costs are ballpark figures. They are good for noticing that a config
+ * got slower than its previous version, not for promising a boot time.
+ */
+#define	COST_MSG	10	/* any message through ng_socket(4) */
+#define	COST_NGCTL	2000	/* starting ngctl(8) and its socket */
+#define	COST_PROMISC	100	/* ifpromisc(9) on a real interface */
+
+static const struct sim_type types[] = {
+    {
+	.name = "socket", .persist = true, .anyhook = true,
+    },
+    {
+	.name = "ether", .persist = true,
+	.hooks = { "lower", "upper", "orphans" },
+	.cmds = { "getifname", "getifindex", "getenaddr", "setenaddr",
+	    "getpromisc", "setpromisc", "getautosrc", "setautosrc",
+	    "addmulti", "delmulti", "detach" },
+    },
+    {
+	.name = "eiface", .persist = true, .cost = 500,
+	.hooks = { "ether" },
+	.cmds = { "set", "getifname", "getifaddrs" },
+    },
+    {
+	.name = "bridge", .cost = 20,
+	.prefix = { "link", "uplink" },
+	.cmds = { "setconfig", "getconfig", "reset", "getstats", "clrstats",
+	    "getclrstats", "gettable", "setpersistent", "movehost" },
+    },
+    {
+	.name = "vlan", .cost = 20, .anyhook = true,
+	.hooks = { "downstream", "nomatch" },
+	.cmds = { "addfilter", "delfilter", "gettable", "delvidflt",
+	    "getdecap", "setdecap", "getencap", "setencap",
+	    "getencap_proto", "setencap_proto" },
+    },
+    {
+	.name = "ula4tag", .cost = 20,
+	.hooks = { "tag", "untag" },
+	.cmds = { "setconfig", "getconfig" },
+    },
+    {
+	.name = "tee", .cost = 20,
+	.hooks = { "left", "right", "left2right", "right2left" },
+	.cmds = { "getstats", "clrstats", "getclrstats" },
+    },
+};
+
+struct sim {
+	struct conf	*cf;
+	struct sim_node	**nodes;
+	size_t		nnodes;
+	struct sim_node	**socks;	/* one per part, like ngctl(8) */
+	unsigned	nextid;
+	const char	*err;		/* why the current command failed */
+	char		errbuf[128];
+	unsigned long	nmsgs;
+	unsigned long	*usec;		/* per part */
+};
+
+static bool
+fail(struct sim *s, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(s->errbuf, sizeof(s->errbuf), fmt, ap);
+	va_end(ap);
+	s->err = s->errbuf;
+
+	return (false);
+}
+
+static const struct sim_type *
+type_find(const char *name)
+{
+	size_t ix;
+
+	for (ix = 0; ix < nitems(types); ix++)
+		if (strcmp(types[ix].name, name) == 0)
+			return &types[ix];
+	return (NULL);
+}
+
+/* same rules the kernel applies, no `.', `:', `[' or `]' */
+static bool
+valid_name(const char *name, size_t size)
+{
+	return (*name != '\0' && strlen(name) < size &&
+	    strpbrk(name, ".:[]") == NULL);
+}
+
+static bool
+hook_allowed(const struct sim_type *t, const char *hook)
+{
+	size_t ix, len;
+	const char *cp;
+
+	for (ix = 0; ix < nitems(t->hooks) && t->hooks[ix] != NULL; ix++)
+		if (strcmp(t->hooks[ix], hook) == 0)
+			return (true);
+
+	/* a bare prefix gets the next free number, ng_bridge(4) does that */
+	for (ix = 0; ix < nitems(t->prefix) && t->prefix[ix] != NULL; ix++) {
+		len = strlen(t->prefix[ix]);
+		if (strncmp(t->prefix[ix], hook, len) != 0)
+			continue;
+		for (cp = hook + len; isdigit((unsigned char)*cp); cp++)
+			;
+		if (*cp == '\0')
+			return (true);
+	}
+
+	return (t->anyhook);
+}
+
+static struct sim_node *
+node_new(struct sim *s, const struct sim_type *t)
+{
+	struct sim_node *nd;
+
+	s->nodes = realloc(s->nodes, (s->nnodes + 1) * sizeof(*s->nodes));
+	nd = calloc(1, sizeof(*nd));
+	if (s->nodes == NULL || nd == NULL) err(
+		EX_OSERR, "%s: unable to allocate", __func__
+	);
+	nd->type = t;
+	nd->id = s->nextid++;
+	nd->persistent = t->persist;
+	s->nodes[s->nnodes++] = nd;
+
+	return (nd);
+}
+
+static struct sim_node *
+node_by_name(struct sim *s, const char *name)
+{
+	size_t ix;
+	unsigned id;
+	char *ep;
+
+	if (name[0] == '[') {
+		id = (unsigned)strtoul(name + 1, &ep, 16);
+		if (ep[0] != ']' || ep[1] != '\0')
+			return (NULL);
+		for (ix = 0; ix < s->nnodes; ix++)
+			if (!s->nodes[ix]->dead && s->nodes[ix]->id == id)
+				return s->nodes[ix];
+		return (NULL);
+	}
+
+	for (ix = 0; ix < s->nnodes; ix++)
+		if (!s->nodes[ix]->dead && strcmp(s->nodes[ix]->name, name) == 0)
+			return s->nodes[ix];
+	return (NULL);
+}
+
+static struct sim_hook *
+hook_find(struct sim_node *nd, const char *name)
+{
+	size_t ix;
+
+	for (ix = 0; ix < nd->nhooks; ix++)
+		if (strcmp(nd->hooks[ix].name, name) == 0)
+			return &nd->hooks[ix];
+	return (NULL);
+}
+
+static void
+hook_add(struct sim_node *nd, const char *name, struct sim_node *peer,
+    const char *peerhook)
+{
+	struct sim_hook *hk;
+
+	nd->hooks = realloc(nd->hooks, (nd->nhooks + 1) * sizeof(*nd->hooks));
+	if (nd->hooks == NULL) err(
+		EX_OSERR, "%s: unable to allocate", __func__
+	);
+	hk = &nd->hooks[nd->nhooks++];
+	snprintf(hk->name, sizeof(hk->name), "%s", name);
+	snprintf(hk->peerhook, sizeof(hk->peerhook), "%s", peerhook);
+	hk->peer = peer;
+}
+
+static void node_kill(struct sim *, struct sim_node *);
+
+/* take one end away; a node without hooks that doesn't persist goes away */
+static void
+hook_del(struct sim *s, struct sim_node *nd, const char *name)
+{
+	size_t ix;
+
+	for (ix = 0; ix < nd->nhooks; ix++)
+		if (strcmp(nd->hooks[ix].name, name) == 0)
+			break;
+	if (ix == nd->nhooks)
+		return;
+	nd->hooks[ix] = nd->hooks[--nd->nhooks];
+
+	/* ng_vlan(4) forgets filters for hooks that go away */
+	for (ix = 0; ix < nd->nfilters;) {
+		if (strcmp(nd->filters[ix].hook, name) == 0)
+			nd->filters[ix] = nd->filters[--nd->nfilters];
+		else
+			ix++;
+	}
+
+	if (nd->nhooks == 0 && !nd->persistent)
+		node_kill(s, nd);
+}
+
+static void
+link_del(struct sim *s, struct sim_node *nd, struct sim_hook *hk)
+{
+	struct sim_node *peer = hk->peer;
+	char ours[NG_HOOKSIZ], theirs[NG_HOOKSIZ];
+
+	snprintf(ours, sizeof(ours), "%s", hk->name);
+	snprintf(theirs, sizeof(theirs), "%s", hk->peerhook);
+	hook_del(s, nd, ours);
+	hook_del(s, peer, theirs);
+}
+
+/* ng_ether(4) can't be removed, a shutdown only resets it */
+static void
+node_kill(struct sim *s, struct sim_node *nd)
+{
+	if (nd->dead)
+		return;
+
+	if (strcmp(nd->type->name, "ether") == 0) {
+		snprintf(nd->name, sizeof(nd->name), "%s", nd->ifname);
+		while (nd->nhooks > 0)
+			link_del(s, nd, &nd->hooks[0]);
+		return;
+	}
+
+	nd->dead = true;
+	nd->persistent = true; /* so hook_del won't recurse back here */
+	while (nd->nhooks > 0)
+		link_del(s, nd, &nd->hooks[0]);
+	nd->name[0] = '\0';
+}
+
+/*
+ * Same as the kernel: `node:' or `[id]:' or `.', followed by hooks to walk
+ * separated by `.'. A path without ':' starts at our socket.
+ */
+static struct sim_node *
+resolve_from(struct sim *s, struct sim_node *nd, const char *hooks)
+{
+	char buf[256], *walk, *hook;
+	struct sim_hook *hk;
+
+	snprintf(buf, sizeof(buf), "%s", hooks);
+	for (walk = buf; (hook = strsep(&walk, ".")) != NULL;) {
+		if (*hook == '\0')
+			continue;
+		if ((hk = hook_find(nd, hook)) == NULL) {
+			fail(s, "no hook `%s' on %s", hook,
+			    nd->name[0] ? nd->name : nd->type->name);
+			return (NULL);
+		}
+		nd = hk->peer;
+	}
+	return (nd);
+}
+
+static struct sim_node *
+resolve(struct sim *s, struct sim_node *sock, const char *path)
+{
+	char node[NG_NODESIZ + 8];
+	const char *colon = strchr(path, ':');
+	struct sim_node *nd;
+
+	if (colon == NULL)
+		return resolve_from(s, sock, path);
+
+	snprintf(node, sizeof(node), "%.*s", (int)(colon - path), path);
+	if (node[0] == '\0' || strcmp(node, ".") == 0) {
+		nd = sock;
+	} else if ((nd = node_by_name(s, node)) == NULL) {
+		fail(s, "node `%s' not found", node);
+		return (NULL);
+	}
+
+	return resolve_from(s, nd, colon + 1);
+}
+
+/* `link' on ng_bridge(4) really means the lowest free `linkN' */
+static const char *
+hook_number(struct sim_node *nd, const char *hook, char *buf, size_t size)
+{
+	size_t ix;
+	unsigned num;
+	const struct sim_type *t = nd->type;
+
+	for (ix = 0; ix < nitems(t->prefix) && t->prefix[ix] != NULL; ix++) {
+		if (strcmp(t->prefix[ix], hook) != 0)
+			continue;
+		/* uplinks start at 1, links at 0 */
+		num = (strcmp(hook, "uplink") == 0) ? 1 : 0;
+		do {
+			snprintf(buf, size, "%s%u", hook, num++);
+		} while (hook_find(nd, buf) != NULL);
+		return (buf);
+	}
+	return (hook);
+}
+
+static bool
+can_hook(struct sim *s, struct sim_node *nd, const char *hook)
+{
+	if (!valid_name(hook, NG_HOOKSIZ))
+		return fail(s, "invalid hook name `%s'", hook);
+	if (!hook_allowed(nd->type, hook))
+		return fail(s, "ng_%s has no hook `%s'", nd->type->name, hook);
+	if (hook_find(nd, hook) != NULL)
+		return fail(s, "hook `%s' on %s already connected", hook,
+		    nd->name[0] ? nd->name : nd->type->name);
+	return (true);
+}
+
+static bool
+do_mkpeer(struct sim *s, struct sim_node *sock, int argc, char **argv,
+    unsigned long *usec)
+{
+	const char *path = (argc == 5) ? argv[1] : ".";
+	const char *type = argv[argc - 3], *hook = argv[argc - 2],
+	    *peerhook = argv[argc - 1];
+	const struct sim_type *t;
+	struct sim_node *nd, *peer;
+	char num[2][NG_HOOKSIZ];
+
+	if (argc != 4 && argc != 5)
+		return fail(s, "usage: mkpeer [path] type hook peerhook");
+	if ((nd = resolve(s, sock, path)) == NULL)
+		return (false);
+	hook = hook_number(nd, hook, num[0], sizeof(num[0]));
+	if ((t = type_find(type)) == NULL || strcmp(type, "socket") == 0 ||
+	    strcmp(type, "ether") == 0)
+		return fail(s, "unknown (or uncreatable) node type `%s'", type);
+	if (!can_hook(s, nd, hook))
+		return (false);
+	if (!valid_name(peerhook, NG_HOOKSIZ) || !hook_allowed(t, peerhook))
+		return fail(s, "ng_%s has no hook `%s'", type, peerhook);
+
+	peer = node_new(s, t);
+	peerhook = hook_number(peer, peerhook, num[1], sizeof(num[1]));
+	hook_add(nd, hook, peer, peerhook);
+	hook_add(peer, peerhook, nd, hook);
+	*usec += t->cost;
+
+	return (true);
+}
+
+static bool
+do_connect(struct sim *s, struct sim_node *sock, int argc, char **argv)
+{
+	const char *path = (argc == 5) ? argv[1] : ".";
+	const char *rel = argv[argc - 3], *hook = argv[argc - 2],
+	    *peerhook = argv[argc - 1];
+	struct sim_node *nd, *peer;
+	char num[2][NG_HOOKSIZ];
+
+	if (argc != 4 && argc != 5)
+		return fail(s, "usage: connect [path] relpath hook peerhook");
+	if ((nd = resolve(s, sock, path)) == NULL)
+		return (false);
+	peer = (strchr(rel, ':') != NULL) ?
+	    resolve(s, sock, rel) : resolve_from(s, nd, rel);
+	if (peer == NULL)
+		return (false);
+	hook = hook_number(nd, hook, num[0], sizeof(num[0]));
+	peerhook = hook_number(peer, peerhook, num[1], sizeof(num[1]));
+	if (!can_hook(s, nd, hook) || !can_hook(s, peer, peerhook))
+		return (false);
+
+	hook_add(nd, hook, peer, peerhook);
+	hook_add(peer, peerhook, nd, hook);
+
+	return (true);
+}
+
+static bool
+do_name(struct sim *s, struct sim_node *sock, int argc, char **argv)
+{
+	struct sim_node *nd;
+
+	if (argc != 3)
+		return fail(s, "usage: name path name");
+	if ((nd = resolve(s, sock, argv[1])) == NULL)
+		return (false);
+	if (!valid_name(argv[2], NG_NODESIZ))
+		return fail(s, "invalid node name `%s'", argv[2]);
+	if (node_by_name(s, argv[2]) != NULL)
+		return fail(s, "name `%s' already in use", argv[2]);
+
+	snprintf(nd->name, sizeof(nd->name), "%s", argv[2]);
+
+	return (true);
+}
+
+static bool
+do_rmhook(struct sim *s, struct sim_node *sock, int argc, char **argv)
+{
+	const char *path = (argc == 3) ? argv[1] : ".";
+	struct sim_node *nd;
+	struct sim_hook *hk;
+
+	if (argc != 2 && argc != 3)
+		return fail(s, "usage: rmhook [path] hook");
+	if ((nd = resolve(s, sock, path)) == NULL)
+		return (false);
+	if ((hk = hook_find(nd, argv[argc - 1])) == NULL)
+		return fail(s, "no hook `%s' on %s", argv[argc - 1],
+		    nd->name[0] ? nd->name : nd->type->name);
+
+	link_del(s, nd, hk);
+
+	return (true);
+}
+
+/* pull `key=value' out of a `msg' argument like { vlan=10 hook="vl10" } */
+static bool
+msg_arg(int argc, char **argv, const char *key, char *val, size_t size)
+{
+	int ix;
+	size_t len = strlen(key);
+	const char *cp;
+
+	for (ix = 3; ix < argc; ix++) {
+		cp = argv[ix];
+		while (*cp == '{')
+			cp++;
+		if (strncmp(cp, key, len) != 0 || cp[len] != '=')
+			continue;
+		cp += len + 1;
+		if (*cp == '"')
+			cp++;
+		snprintf(val, size, "%.*s", (int)strcspn(cp, "\",}"), cp);
+		return (true);
+	}
+	return (false);
+}
+
+static bool
+do_msg(struct sim *s, struct sim_node *sock, int argc, char **argv,
+    unsigned long *usec)
+{
+	const struct sim_type *t;
+	struct sim_node *nd;
+	struct sim_hook *hk;
+	char vid[16], hook[NG_HOOKSIZ];
+	size_t ix;
+	unsigned long v;
+	char *ep;
+
+	if (argc < 3)
+		return fail(s, "usage: msg path command [args ...]");
+	if ((nd = resolve(s, sock, argv[1])) == NULL)
+		return (false);
+
+	t = nd->type;
+	for (ix = 0; ix < nitems(t->cmds) && t->cmds[ix] != NULL; ix++)
+		if (strcmp(t->cmds[ix], argv[2]) == 0)
+			break;
+	if (ix == nitems(t->cmds) || t->cmds[ix] == NULL)
+		return fail(s, "ng_%s has no command `%s'", t->name, argv[2]);
+
+	/* ngctl(8) converts from ASCII first, that is a round trip too */
+	s->nmsgs++;
+	*usec += COST_MSG;
+
+	if (strcmp(argv[2], "setpersistent") == 0) {
+		nd->persistent = true;
+	} else if (strcmp(argv[2], "setpromisc") == 0) {
+		*usec += COST_PROMISC;
+	} else if (strcmp(argv[2], "addfilter") == 0) {
+		if (!msg_arg(argc, argv, "vlan", vid, sizeof(vid)) &&
+		    !msg_arg(argc, argv, "vid", vid, sizeof(vid)))
+			return fail(s, "addfilter: missing vlan");
+		if (!msg_arg(argc, argv, "hook", hook, sizeof(hook)))
+			return fail(s, "addfilter: missing hook");
+		v = strtoul(vid, &ep, 10);
+		if (*vid == '\0' || *ep != '\0' || v > 4095)
+			return fail(s, "addfilter: bad vlan `%s'", vid);
+		if ((hk = hook_find(nd, hook)) == NULL)
+			return fail(s, "addfilter: no hook `%s' on %s",
+			    hook, nd->name[0] ? nd->name : t->name);
+		if (strcmp(hook, "downstream") == 0 ||
+		    strcmp(hook, "nomatch") == 0)
+			return fail(s, "addfilter: `%s' can't be filtered",
+			    hook);
+		for (ix = 0; ix < nd->nfilters; ix++) {
+			if (nd->filters[ix].vid == v)
+				return fail(s, "addfilter: vlan %lu already "
+				    "goes to `%s'", v, nd->filters[ix].hook);
+			if (strcmp(nd->filters[ix].hook, hook) == 0)
+				return fail(s, "addfilter: `%s' already has "
+				    "vlan %u", hook, nd->filters[ix].vid);
+		}
+		nd->filters = realloc(nd->filters,
+		    (nd->nfilters + 1) * sizeof(*nd->filters));
+		if (nd->filters == NULL) err(
+			EX_OSERR, "%s: unable to allocate", __func__
+		);
+		nd->filters[nd->nfilters].vid = (unsigned)v;
+		snprintf(nd->filters[nd->nfilters++].hook, NG_HOOKSIZ, "%s",
+		    hook);
+	}
+
+	return (true);
+}
+
+static bool
+run(struct sim *s, struct sim_node *sock, struct conf_line *ln,
+    unsigned long *usec)
+{
+	int argc = ln->argc;
+	char **argv = ln->argv;
+	const char *cmd = argv[0];
+	struct sim_node *nd;
+
+	s->nmsgs++;
+	*usec += COST_MSG;
+
+	if (strcmp(cmd, "mkpeer") == 0)
+		return do_mkpeer(s, sock, argc, argv, usec);
+	if (strcmp(cmd, "connect") == 0)
+		return do_connect(s, sock, argc, argv);
+	if (strcmp(cmd, "name") == 0)
+		return do_name(s, sock, argc, argv);
+	if (strcmp(cmd, "rmhook") == 0 || strcmp(cmd, "disconnect") == 0)
+		return do_rmhook(s, sock, argc, argv);
+	if (strcmp(cmd, "msg") == 0)
+		return do_msg(s, sock, argc, argv, usec);
+	if (strcmp(cmd, "shutdown") == 0 || strcmp(cmd, "kill") == 0) {
+		if (argc != 2)
+			return fail(s, "usage: shutdown path");
+		if ((nd = resolve(s, sock, argv[1])) == NULL)
+			return (false);
+		if (nd == sock)
+			return fail(s, "not shutting down our own socket");
+		node_kill(s, nd);
+		return (true);
+	}
+	if (strcmp(cmd, "show") == 0 || strcmp(cmd, "info") == 0 ||
+	    strcmp(cmd, "status") == 0) {
+		if (argc != 2)
+			return fail(s, "usage: %s path", cmd);
+		return resolve(s, sock, argv[1]) != NULL;
+	}
+	if (strcmp(cmd, "ls") == 0 || strcmp(cmd, "list") == 0 ||
+	    strcmp(cmd, "types") == 0 || strcmp(cmd, "help") == 0) {
+		s->nmsgs--;	/* we don't count what doesn't build */
+		*usec -= COST_MSG;
+		return (true);
+	}
+
+	return fail(s, "unknown command `%s'", cmd);
+}
+
+/*
+ * Run `cf' against the model. Interfaces in `ethers' exist before we start,
+ * as ng_ether(4) nodes named after them. Returns the number of errors and
+ * fills in the predicted cost; `serial' as with ngctl -f and `parallel' as
+ * ngapply(8) would do it (slowest part, assuming enough CPUs).
+ */
+int
+sim_run(struct conf *cf, char **ethers, int nethers,
+    unsigned long *nmsgs, unsigned long *serial, unsigned long *parallel)
+{
+	struct sim s = { .cf = cf, .nextid = 1 };
+	bool *failed;
+	int ix, errors = 0;
+	size_t ln, kx;
+	struct sim_node *nd, *sock;
+
+	assert(cf != NULL);
+
+	for (ix = 0; ix < nethers; ix++) {
+		nd = node_new(&s, type_find("ether"));
+		snprintf(nd->name, sizeof(nd->name), "%s", ethers[ix]);
+		snprintf(nd->ifname, sizeof(nd->ifname), "%s", ethers[ix]);
+	}
+
+	s.socks = calloc(cf->ncomp + 1, sizeof(*s.socks));
+	s.usec = calloc(cf->ncomp + 1, sizeof(*s.usec));
+	failed = calloc(cf->ncomp + 1, sizeof(*failed));
+	if (s.socks == NULL || s.usec == NULL || failed == NULL) err(
+		EX_OSERR, "%s: unable to allocate", __func__
+	);
+	for (ix = 0; ix < cf->ncomp; ix++) {
+		s.socks[ix] = node_new(&s, type_find("socket"));
+		s.usec[ix] = COST_NGCTL;
+	}
+
+	for (ln = 0; ln < cf->nlines; ln++) {
+		struct conf_line *line = &cf->lines[ln];
+		int part = (line->comp == -1) ? 0 : line->comp;
+
+		if (line->argc == 0 || part >= cf->ncomp)
+			continue;
+		/* ngctl(8) gives up on a part at its first error */
+		if (failed[part])
+			continue;
+
+		sock = s.socks[part];
+		if (!run(&s, sock, line, &s.usec[part])) {
+			warnx("%s: line %d: %s", cf->file, line->lineno, s.err);
+			failed[part] = true;
+			errors++;
+		}
+	}
+
+	/*
+	 * When ngctl(8) exits its socket goes and so does anything that was
+	 * only being held open by it.
+	 */
+	for (ix = 0; ix < cf->ncomp; ix++) {
+		sock = s.socks[ix];
+		while (sock->nhooks > 0) {
+			nd = sock->hooks[0].peer;
+			if (nd->nhooks == 1 && !nd->persistent)
+				warnx("%s: part %d: ng_%s on socket hook `%s' "
+				    "goes away when ngctl(8) exits",
+				    cf->file, ix, nd->type->name,
+				    sock->hooks[0].name);
+			link_del(&s, sock, &sock->hooks[0]);
+		}
+	}
+
+	*nmsgs = s.nmsgs;
+	*serial = *parallel = 0;
+	for (ix = 0; ix < cf->ncomp; ix++) {
+		*serial += s.usec[ix];
+		if (s.usec[ix] > *parallel)
+			*parallel = s.usec[ix];
+	}
+	/* a single ngctl(8) only starts once */
+	if (cf->ncomp > 1)
+		*serial -= (unsigned long)(cf->ncomp - 1) * COST_NGCTL;
+
+	for (kx = 0; kx < s.nnodes; kx++) {
+		free(s.nodes[kx]->hooks);
+		free(s.nodes[kx]->filters);
+		free(s.nodes[kx]);
+	}
+	free(s.nodes);
+	free(s.socks);
+	free(s.usec);
+	free(failed);
+
+	return (errors);
+}
@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <err.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/jail.h>
+#include <jail.h>
+
+#include "ngbrtable.h"
+
+/* name of our utility */
+#define	ME	"ngbrtable"
+
+/*
+ * The single purpose of this utility is to show what an ng_bridge(4) learned
+ * and what changed since the last time anybody looked.
+ */
+
+static void
+Usage(const char *format, ...)
+{
+	if (format != NULL) {
+		va_list ap;
+		va_start(ap, format);
+		(void) vfprintf(stderr, format, ap);
+		va_end(ap);
+	}
+
+	(void) fprintf(
+	    stderr,
+	    "USAGE: " ME " [-Jn] [-j jail] [-d snapshot] [-w snapshot] bridge\n"
+	    "       " ME " [-J] [-d snapshot] [-w snapshot] -r snapshot\n"
+	    "-d snapshot\tShow hosts that are new, moved or aged out since "
+	    "snapshot\n\t\tinstead of the table.\n"
+	    "-J\t\tWrite JSON instead of text.\n"
+	    "-j jail\t\tSwitch to jail for all references.\n"
+	    "-n\t\tDisable automatic loading of netgraph(4) kernel modules.\n"
+	    "-r snapshot\tUse the table in snapshot instead of asking a "
+	    "bridge.\n"
+	    "-w snapshot\tSave the table to snapshot, it is not shown unless "
+	    "-d is given.\n\n"
+	    "bridge is the name or `[id]' of an ng_bridge(4).\n"
+	);
+
+	exit(EX_USAGE);
+}
+
+static bool json = false;
+
+static const char *
+ether(char *buf, const uint8_t *addr)
+{
+	static const char hex[] = "0123456789abcdef";
+	int ix;
+
+	for (ix = 0; ix < 6; ix++) {
+		buf[ix * 3] = hex[addr[ix] >> 4];
+		buf[ix * 3 + 1] = hex[addr[ix] & 0xf];
+		buf[ix * 3 + 2] = ':';
+	}
+	buf[17] = '\0';
+	return (buf);
+}
+
+/* hook and node names can have anything but `.', `:' and NUL in them */
+static void
+json_str(const char *s)
+{
+	putchar('"');
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", *s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+static void
+show_table(const struct ngb_table *t)
+{
+	uint32_t ix;
+	char addr[18];
+	const struct ngb_host *h;
+
+	if (json) {
+		printf("{\"bridge\":");
+		json_str(t->hdr.bridge);
+		printf(",\"time\":%jd,\"hosts\":[", (intmax_t)t->hdr.when);
+	} else {
+		printf("%-17s  %-15s %6s %6s\n", "ADDRESS", "HOOK", "AGE",
+		    "STALE");
+	}
+
+	for (ix = 0; ix < t->hdr.nhosts; ix++) {
+		h = &t->hosts[ix];
+		if (!json) {
+			printf("%s  %-15s %6u %6u\n", ether(addr, h->addr),
+			    t->hooks[h->hook], h->age, h->stale);
+			continue;
+		}
+		printf("%s{\"addr\":\"%s\",\"hook\":", (ix == 0) ? "" : ",",
+		    ether(addr, h->addr));
+		json_str(t->hooks[h->hook]);
+		printf(",\"age\":%u,\"stale\":%u}", h->age, h->stale);
+	}
+
+	if (json)
+		printf("]}\n");
+}
+
+static void
+show_change(const char *what, const uint8_t *addr, const char *hook,
+    const char *was, bool first)
+{
+	char buf[18];
+
+	if (!json) {
+		printf("%-5s %s  %s%s%s\n", what, ether(buf, addr),
+		    (was != NULL) ? was : "", (was != NULL) ? " -> " : "", hook);
+		return;
+	}
+	printf("%s{\"change\":\"%s\",\"addr\":\"%s\",\"hook\":",
+	    first ? "" : ",", what, ether(buf, addr));
+	json_str(hook);
+	if (was != NULL) {
+		printf(",\"was\":");
+		json_str(was);
+	}
+	putchar('}');
+}
+
+/*
+ * Both tables are in address order, so one pass over them finds every host
+ * that is only in the new one, moved to another link, or aged out.
+ */
+static void
+show_diff(const struct ngb_table *old, const struct ngb_table *cur)
+{
+	uint32_t o = 0, c = 0;
+	int cmp;
+	bool first = true;
+	const struct ngb_host *oh, *ch;
+	const char *ohook, *chook;
+
+	if (old->hdr.bridge[0] != '\0' && cur->hdr.bridge[0] != '\0' &&
+	    strcmp(old->hdr.bridge, cur->hdr.bridge) != 0)
+		warnx("comparing `%s' with `%s'", old->hdr.bridge,
+		    cur->hdr.bridge);
+
+	if (json) {
+		printf("{\"bridge\":");
+		json_str(cur->hdr.bridge);
+		printf(",\"from\":%jd,\"to\":%jd,\"changes\":[",
+		    (intmax_t)old->hdr.when, (intmax_t)cur->hdr.when);
+	}
+
+	while (o < old->hdr.nhosts || c < cur->hdr.nhosts) {
+		oh = &old->hosts[o];
+		ch = &cur->hosts[c];
+		if (o == old->hdr.nhosts)
+			cmp = 1;
+		else if (c == cur->hdr.nhosts)
+			cmp = -1;
+		else
+			cmp = memcmp(oh->addr, ch->addr, sizeof(oh->addr));
+
+		if (cmp < 0) {
+			show_change("aged", oh->addr, old->hooks[oh->hook],
+			    NULL, first);
+			o++;
+		} else if (cmp > 0) {
+			show_change("new", ch->addr, cur->hooks[ch->hook],
+			    NULL, first);
+			c++;
+		} else {
+			ohook = old->hooks[oh->hook];
+			chook = cur->hooks[ch->hook];
+			o++, c++;
+			if (strcmp(ohook, chook) == 0)
+				continue;
+			show_change("moved", ch->addr, chook, ohook, first);
+		}
+		first = false;
+	}
+
+	if (json)
+		printf("]}\n");
+}
+
+int
+main(int argc, char **argv)
+{
+	int ch, load_kmod = 1;
+	const char *since = NULL, *save = NULL, *from = NULL;
+	ngctx ctrl;
+	struct ngb_table cur, old;
+
+	while ((ch = getopt_long(argc, argv, ":d:Jj:nr:w:", NULL, NULL)) != -1) {
+		switch (ch) {
+		case 'd':
+			since = optarg;
+			break;
+		case 'J':
+			json = true;
+			break;
+		case 'j':
+		    {
+			int jid;
+
+			if (strlen(optarg) > MAXHOSTNAMELEN) Usage(
+				ME ": `%s' exceeds %d characters\n\n",
+				optarg, MAXHOSTNAMELEN
+			);
+			jid = jail_getid(optarg);
+			if (jid == -1) errx(
+				ERRALT(EX_NOHOST), "%s", jail_errmsg
+			);
+			if (jail_attach(jid) != 0) errx(
+				ERRALT(EX_OSERR), "cannot attach to jail"
+			);
+			load_kmod = 0; /* can't from a jail anyway */
+			break;
+		    }
+		case 'n':
+			load_kmod = 0; /* user asked not to */
+			break;
+		case 'r':
+			from = optarg;
+			break;
+		case 'w':
+			save = optarg;
+			break;
+		default:
+			Usage(
+				ME ": unrecognized option `%s'\n\n",
+				argv[optind - 1]
+			);
+		}
+	}
+	argv += optind;
+	argc -= optind;
+
+	if ((from == NULL) != (argc == 1)) Usage(
+		ME ": need exactly one of a bridge or -r\n\n"
+	);
+	if (from == NULL && strlen(argv[0]) > NG_NODELEN) Usage(
+		ME ": `%s' exceeds %d characters\n\n", argv[0], NG_NODELEN
+	);
+
+	if (from != NULL) {
+		ngb_read(from, &cur);
+	} else {
+		if (load_kmod != 0)
+			kld_ensure_load("ng_socket");
+		ng_create_context(&ctrl, NULL);
+		ngb_fetch(ctrl, argv[0], &cur);
+		(void) close(ctrl);
+	}
+
+	/* read before writing, -d and -w are often the same file */
+	if (since != NULL)
+		ngb_read(since, &old);
+	if (save != NULL)
+		ngb_write(save, &cur);
+
+	if (since != NULL) {
+		show_diff(&old, &cur);
+		ngb_free(&old);
+	} else if (save == NULL) {
+		show_table(&cur);
+	}
+	ngb_free(&cur);
+
+	if (fflush(stdout) == EOF) err(
+		ERRALT(EX_IOERR), "unable to write to stdout"
+	);
+	return (EX_OK);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <sys/param.h>
+#include <netgraph.h>
+
+#include "common.h"
+
+/*
+ * One host an ng_bridge(4) learned, as a snapshot keeps it. The hook is an
+ * index into the snapshot's hook names, every host of a link shares one.
+ */
+struct ngb_host {
+	uint8_t		addr[6];
+	uint16_t	hook;
+	uint16_t	age;		/* seconds since it was learned */
+	uint16_t	stale;		/* seconds since it was last heard */
+};
+
+/*
+ * A snapshot file starts with this, followed by `nhooks' names of
+ * NG_HOOKSIZ and `nhosts' hosts in address order. It is only read back on
+ * the machine that wrote it.
+ */
+#define	NGB_MAGIC	0x6e676274	/* "ngbt", change with layout */
+
+struct ngb_file {
+	uint32_t	magic;
+	uint32_t	nhooks;
+	uint32_t	nhosts;
+	uint32_t	_pad;
+	int64_t		when;		/* time(3) it was taken */
+	char		bridge[NG_NODESIZ];
+};
+
+struct ngb_table {
+	struct ngb_file	hdr;
+	char		(*hooks)[NG_HOOKSIZ];
+	struct ngb_host	*hosts;
+	void		*mem;		/* everything above points into it */
+};
+
+/* table.c */
+void	ngb_fetch(ngctx, const char *, struct ngb_table *);
+void	ngb_read(const char *, struct ngb_table *);
+void	ngb_write(const char *, const struct ngb_table *);
+void	ngb_free(struct ngb_table *);
@@ -0,0 +1,307 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <netgraph/ng_bridge.h>
+
+#include "ngbrtable.h"
+
+/*
+ * The whole host table comes in one NGM_BRIDGE_GET_TABLE reply, the binary
+ * form of `ngctl msg br0: gettable' without the kernel formatting it as text
+ * and us parsing that. A table of 100K hosts is a 4 MB reply, the socket
+ * buffer is raised as far as the kernel lets us to fit it.
+ *
+ * Hook names are kept once per link rather than per host, and the hosts are
+ * put in address order with a radix sort so two snapshots diff in one pass.
+ */
+
+#define	NGB_RCVBUF_MAX	(64 * 1024 * 1024)
+#define	NGB_RCVBUF_MIN	(256 * 1024)
+#define	NGB_WAIT	5		/* seconds for the reply */
+
+/* the largest receive buffer the kernel allows, or what it has */
+static void
+prepare_socket(ngctx ctrl)
+{
+	int sz;
+	struct timeval tv = { .tv_sec = NGB_WAIT };
+
+	for (sz = NGB_RCVBUF_MAX; sz >= NGB_RCVBUF_MIN; sz /= 2)
+		if (setsockopt(ctrl, SOL_SOCKET, SO_RCVBUF, &sz,
+		    sizeof(sz)) == 0)
+			break;
+	if (setsockopt(ctrl, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1)
+		err(ERRALT(EX_OSERR), "can't set receive timeout");
+}
+
+/* hook names to their index, open addressing over `index + 1' */
+struct interner {
+	struct ngb_table	*t;
+	uint16_t		*slots;
+	size_t			mask;
+	size_t			nalloc;
+};
+
+static uint32_t
+hash(const char *s)
+{
+	uint32_t h = 2166136261u;
+
+	while (*s != '\0')
+		h = (h ^ (uint8_t)*s++) * 16777619u;
+	return (h);
+}
+
+static void
+rehash(struct interner *in)
+{
+	size_t ix, at, size = (in->mask + 1) * 2;
+
+	free(in->slots);
+	if ((in->slots = calloc(size, sizeof(*in->slots))) == NULL) err(
+		EX_OSERR, "unable to allocate %zu hooks", size
+	);
+	in->mask = size - 1;
+	for (ix = 0; ix < in->t->hdr.nhooks; ix++) {
+		at = hash(in->t->hooks[ix]) & in->mask;
+		while (in->slots[at] != 0)
+			at = (at + 1) & in->mask;
+		in->slots[at] = ix + 1;
+	}
+}
+
+static uint16_t
+intern(struct interner *in, const char *name)
+{
+	struct ngb_table *t = in->t;
+	size_t at;
+
+	at = hash(name) & in->mask;
+	for (; in->slots[at] != 0; at = (at + 1) & in->mask)
+		if (strcmp(t->hooks[in->slots[at] - 1], name) == 0)
+			return (in->slots[at] - 1);
+
+	if (t->hdr.nhooks == UINT16_MAX) errx(
+		EX_SOFTWARE, "more than %u links", UINT16_MAX
+	);
+	if (t->hdr.nhooks == in->nalloc) {
+		in->nalloc = MAX(in->nalloc * 2, 64);
+		t->hooks = reallocf(t->hooks, in->nalloc * sizeof(*t->hooks));
+		if (t->hooks == NULL) err(
+			EX_OSERR, "unable to allocate %zu hooks", in->nalloc
+		);
+	}
+	strlcpy(t->hooks[t->hdr.nhooks], name, sizeof(*t->hooks));
+	in->slots[at] = ++t->hdr.nhooks;
+	if (t->hdr.nhooks * 2 > in->mask)
+		rehash(in);
+	return (t->hdr.nhooks - 1);
+}
+
+/*
+ * LSD radix sort on the address, a byte per pass. Passes where every host
+ * has the same byte (a bridge full of one vendor's OUI) are skipped.
+ */
+static void
+sort_hosts(struct ngb_host *hosts, size_t n)
+{
+	int byte;
+	size_t ix, count[256], sum, moved;
+	struct ngb_host *tmp, *from = hosts, *to, *swap;
+
+	if (n < 2)
+		return;
+	if ((tmp = malloc(n * sizeof(*tmp))) == NULL) err(
+		EX_OSERR, "unable to allocate %zu hosts", n
+	);
+	to = tmp;
+
+	for (byte = sizeof(hosts->addr) - 1; byte >= 0; byte--) {
+		memset(count, 0, sizeof(count));
+		for (ix = 0; ix < n; ix++)
+			count[from[ix].addr[byte]]++;
+		if (count[from[0].addr[byte]] == n)
+			continue;
+		for (sum = ix = 0; ix < nitems(count); ix++) {
+			moved = count[ix];
+			count[ix] = sum;
+			sum += moved;
+		}
+		for (ix = 0; ix < n; ix++)
+			to[count[from[ix].addr[byte]]++] = from[ix];
+		swap = from;
+		from = to;
+		to = swap;
+	}
+	if (from != hosts)
+		memcpy(hosts, from, n * sizeof(*hosts));
+	free(tmp);
+}
+
+/* the table of `bridge' right now */
+void
+ngb_fetch(ngctx ctrl, const char *bridge, struct ngb_table *t)
+{
+	int rc;
+	uint32_t ix;
+	char path[NG_PATHSIZE];
+	struct ng_reply r = NG_REPLY_INIT(NULL, 0);
+	struct ng_bridge_host_ary *ary;
+	struct interner in = { .t = t, .mask = 31 };
+
+	memset(t, 0, sizeof(*t));
+	prepare_socket(ctrl);
+	snprintf(path, sizeof(path), "%s:", bridge);
+
+	rc = NgSendMsg(ctrl, path, NGM_BRIDGE_COOKIE, NGM_BRIDGE_GET_TABLE,
+	    NULL, 0);
+	if (rc == -1) err(
+		ERRALT(EX_UNAVAILABLE), "unable to ask `%s' for its table",
+		bridge
+	);
+	/*
+	 * `r' starts out as large as the socket buffer. A reply that doesn't
+	 * fit in that is dropped by the kernel, we only notice the wait.
+	 */
+	rc = ng_recv_msg(ctrl, &r, NULL);
+	if (rc == -1 && (errno == EAGAIN || errno == EMSGSIZE)) errx(
+		EX_UNAVAILABLE, "the table of `%s' doesn't fit in a socket "
+		"buffer of %zu bytes, raise kern.ipc.maxsockbuf", bridge, r.size
+	);
+	if (rc == -1) err(
+		ERRALT(EX_IOERR), "unable to retrieve the table of `%s'", bridge
+	);
+
+	ary = (struct ng_bridge_host_ary *) r.msg->data;
+	if (r.msg->header.typecookie != NGM_BRIDGE_COOKIE ||
+	    r.msg->header.cmd != NGM_BRIDGE_GET_TABLE ||
+	    r.msg->header.arglen < sizeof(*ary) ||
+	    (r.msg->header.arglen - sizeof(*ary)) / sizeof(*ary->hosts) <
+	    ary->numHosts) errx(
+		EX_PROTOCOL, "`%s' answered with something else", bridge
+	);
+
+	t->hdr.magic = NGB_MAGIC;
+	t->hdr.when = time(NULL);
+	strlcpy(t->hdr.bridge, bridge, sizeof(t->hdr.bridge));
+	t->hdr.nhosts = ary->numHosts;
+	t->hosts = calloc(MAX(t->hdr.nhosts, 1), sizeof(*t->hosts));
+	if ((in.slots = calloc(in.mask + 1, sizeof(*in.slots))) == NULL ||
+	    t->hosts == NULL) err(
+		EX_OSERR, "unable to allocate %u hosts", t->hdr.nhosts
+	);
+
+	for (ix = 0; ix < ary->numHosts; ix++) {
+		const struct ng_bridge_hostent *he = &ary->hosts[ix];
+		struct ngb_host *h = &t->hosts[ix];
+		char hook[NG_HOOKSIZ];
+
+		strlcpy(hook, he->hook, sizeof(hook));
+		memcpy(h->addr, he->addr, sizeof(h->addr));
+		h->hook = intern(&in, hook);
+		h->age = he->age;
+		h->stale = he->staleness;
+	}
+	sort_hosts(t->hosts, t->hdr.nhosts);
+
+	free(in.slots);
+	ng_reply_fini(&r);
+}
+
+/* a snapshot ngb_write() made */
+void
+ngb_read(const char *path, struct ngb_table *t)
+{
+	int fd;
+	struct stat sb;
+	ssize_t rc;
+	size_t need;
+
+	memset(t, 0, sizeof(*t));
+	if ((fd = open(path, O_RDONLY)) == -1) err(
+		ERRALT(EX_NOINPUT), "unable to open `%s'", path
+	);
+	if (fstat(fd, &sb) == -1) err(
+		ERRALT(EX_IOERR), "unable to stat `%s'", path
+	);
+	if ((t->mem = malloc(MAX(sb.st_size, 1))) == NULL) err(
+		EX_OSERR, "unable to allocate %jd bytes", (intmax_t)sb.st_size
+	);
+	if ((rc = read(fd, t->mem, sb.st_size)) == -1) err(
+		ERRALT(EX_IOERR), "unable to read `%s'", path
+	);
+	(void) close(fd);
+
+	if ((size_t)rc >= sizeof(t->hdr))
+		memcpy(&t->hdr, t->mem, sizeof(t->hdr));
+	need = sizeof(t->hdr) + (size_t)t->hdr.nhooks * sizeof(*t->hooks) +
+	    (size_t)t->hdr.nhosts * sizeof(*t->hosts);
+	if ((size_t)rc < sizeof(t->hdr) || t->hdr.magic != NGB_MAGIC ||
+	    rc != sb.st_size || (size_t)rc != need) errx(
+		EX_DATAERR, "`%s' isn't a snapshot", path
+	);
+
+	t->hooks = (void *)((char *)t->mem + sizeof(t->hdr));
+	t->hosts = (void *)(t->hooks + t->hdr.nhooks);
+	t->hdr.bridge[sizeof(t->hdr.bridge) - 1] = '\0';
+	for (need = 0; need < t->hdr.nhooks; need++)
+		t->hooks[need][NG_HOOKLEN] = '\0';
+	for (need = 0; need < t->hdr.nhosts; need++)
+		if (t->hosts[need].hook >= t->hdr.nhooks) errx(
+			EX_DATAERR, "`%s' isn't a snapshot", path
+		);
+}
+
+/* `t' to `path', replacing what was there only once all of it is written */
+void
+ngb_write(const char *path, const struct ngb_table *t)
+{
+	int fd;
+	char tmp[PATH_MAX];
+	struct iovec iov[3] = {
+		{ (void *)(uintptr_t)&t->hdr, sizeof(t->hdr) },
+		{ t->hooks, t->hdr.nhooks * sizeof(*t->hooks) },
+		{ t->hosts, t->hdr.nhosts * sizeof(*t->hosts) },
+	};
+	ssize_t want = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.new", path) >= (int)sizeof(tmp))
+		errx(EX_USAGE, "`%s' is too long", path);
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) err(
+		ERRALT(EX_CANTCREAT), "unable to create `%s'", tmp
+	);
+	if (writev(fd, iov, nitems(iov)) != want || close(fd) == -1) {
+		(void) unlink(tmp);
+		err(ERRALT(EX_IOERR), "unable to write `%s'", tmp);
+	}
+	if (rename(tmp, path) == -1) {
+		(void) unlink(tmp);
+		err(ERRALT(EX_CANTCREAT), "unable to replace `%s'", path);
+	}
+}
+
+void
+ngb_free(struct ngb_table *t)
+{
+	if (t->mem != NULL) {
+		free(t->mem);
+	} else {
+		free(t->hooks);
+		free(t->hosts);
+	}
+	memset(t, 0, sizeof(*t));
+}
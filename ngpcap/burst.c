@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/param.h>
+
+#include "ngpcap.h"
+
+/*
+ * Microbursts. Interface counters average a burst over a second or more, by
+ * then the queue already overflowed and the drops look like they came out of
+ * nowhere.
+ *
+ * Wire bytes of each source are added up in bins of `bin' usec, using the
+ * time ng_pcap(4) stamped on the record. The last `window' bins are kept in
+ * a ring of counters per source, so a bin over `rate' is reported next to
+ * what the link averaged around it. Nothing is allocated per packet and the
+ * work per record is a division and two additions.
+ */
+
+struct bin {
+	uint64_t	bytes;
+	uint64_t	pkts;
+};
+
+struct burst_src {
+	struct bin	*bins;		/* `window' of them */
+	uint64_t	cur;		/* bin number (time / width) filling */
+	uint64_t	sum;		/* bytes in the ring, except `cur' */
+	uint64_t	peak;		/* bytes in the busiest bin */
+	uint64_t	flagged;
+};
+
+static struct {
+	uint64_t			width;		/* of a bin in nsec */
+	uint64_t			limit;		/* bytes per bin */
+	uint64_t			mask;		/* window - 1 */
+	const char			*dump;		/* path prefix */
+	unsigned			ndump;
+	uint64_t			lastdump;	/* bin number */
+	const struct ngp_source		*srcs;
+	int				nsrc;
+	struct burst_src		*st;
+} B;
+
+static ssize_t
+burst_init(char *subopts, const struct ngp_source *srcs, int nsrc)
+{
+	int rc;
+	unsigned long bin = 1000, rate = 0, window = 1000, keep = 4096, lg;
+	const struct ngp_mode_opt opts[] = {
+		{ "bin", 100, 1000, &bin },
+		{ "rate", 1, 1000000, &rate },
+		{ "window", 2, 1 << 20, &window },
+		{ "dump", .string = &B.dump },
+		{ "keep", 64, 1 << 20, &keep },
+	};
+
+	rc = ngp_mode_opts("burst", subopts, opts, nitems(opts));
+	if (rate == 0)
+		warnx("burst: `rate' is required"), rc--;
+	if (rc != 0)
+		return (-1);
+
+	/* round the window up to a power of 2 so it can be masked */
+	for (lg = 1; lg < window; lg <<= 1)
+		;
+	B.mask = lg - 1;
+	B.width = bin * NSEC_PER_USEC;
+	/* Mbit/s over `bin' usec in bytes, 1 Mbit/s is 1 bit per usec */
+	B.limit = rate * bin / 8;
+	B.srcs = srcs;
+	B.nsrc = nsrc;
+
+	B.st = calloc(nsrc, sizeof(*B.st));
+	if (B.st == NULL) err(
+		EX_OSERR, "burst: unable to allocate %d sources", nsrc
+	);
+	for (rc = 0; rc < nsrc; rc++) {
+		B.st[rc].bins = calloc(lg, sizeof(struct bin));
+		if (B.st[rc].bins == NULL) err(
+			EX_OSERR, "burst: unable to allocate %lu bins", lg
+		);
+	}
+
+	return (B.dump != NULL) ? (ssize_t)keep * 1024 : 0;
+}
+
+static double
+mbits(uint64_t bytes, uint64_t nsec)
+{
+	return (nsec == 0) ? 0 : (bytes * 8.0 * 1000.0) / nsec;
+}
+
+static void
+dump(const struct ngp_source *src, uint64_t binno)
+{
+	FILE *fp;
+	char path[PATH_MAX];
+
+	/* a burst lasting a second could otherwise write thousands */
+	if (B.ndump != 0 && (binno - B.lastdump) * B.width < NSEC_PER_SEC)
+		return;
+	B.lastdump = binno;
+
+	snprintf(path, sizeof(path), "%s.%u.pcap", B.dump, B.ndump++);
+	if ((fp = fopen(path, "w")) == NULL) {
+		warn("burst: unable to dump to %s", path);
+		return;
+	}
+	if (ngp_history(fp) == -1 || fclose(fp) == EOF)
+		warn("burst: unable to write %s", path);
+	else
+		(void) printf("%s: packets around it in %s\n", src->label, path);
+}
+
+static void
+report(int ix, const struct bin *b)
+{
+	struct burst_src *st = &B.st[ix];
+	uint64_t start = st->cur * B.width;
+	time_t sec = start / NSEC_PER_SEC;
+	struct tm tm;
+	char when[16];
+
+	(void) localtime_r(&sec, &tm);
+	(void) strftime(when, sizeof(when), "%H:%M:%S", &tm);
+
+	(void) printf(
+		"%s.%06" PRIu64 " %s: %" PRIu64 " bytes %" PRIu64 " packets "
+		"in %" PRIu64 " us, %.1f Mbit/s (%.1f Mbit/s over %.1f ms)\n",
+		when, (start % NSEC_PER_SEC) / NSEC_PER_USEC, B.srcs[ix].label,
+		b->bytes, b->pkts, B.width / NSEC_PER_USEC,
+		mbits(b->bytes, B.width),
+		mbits(st->sum + b->bytes, (B.mask + 1) * B.width),
+		(B.mask + 1) * B.width / 1e6
+	);
+
+	if (B.dump != NULL)
+		dump(&B.srcs[ix], st->cur);
+}
+
+/* `cur' is done, move on to bin number `next' */
+static void
+advance(int ix, uint64_t next)
+{
+	struct burst_src *st = &B.st[ix];
+	struct bin *b = &st->bins[st->cur & B.mask];
+	uint64_t n;
+
+	st->flagged += (b->bytes > B.limit);
+	st->peak = MAX(st->peak, b->bytes);
+	if (b->bytes > B.limit)
+		report(ix, b);
+	st->sum += b->bytes;
+
+	/* the bins in between were idle, and the oldest fall out of the ring */
+	if (next - st->cur > B.mask) {
+		memset(st->bins, 0, (B.mask + 1) * sizeof(*st->bins));
+		st->sum = 0;
+	} else for (n = st->cur + 1; n <= next; n++) {
+		b = &st->bins[n & B.mask];
+		st->sum -= b->bytes;
+		b->bytes = b->pkts = 0;
+	}
+	st->cur = next;
+}
+
+static void
+burst_packet(const struct ngp_record *rec)
+{
+	struct burst_src *st = &B.st[rec->src];
+	struct bin *b;
+	uint64_t binno = rec->nsec / B.width;
+
+	if (binno > st->cur)
+		advance(rec->src, binno);
+	/* a clock stepping back just lands in the current bin */
+
+	b = &st->bins[st->cur & B.mask];
+	b->bytes += rec->len;
+	b->pkts++;
+}
+
+static void
+burst_fini(void)
+{
+	int ix;
+
+	for (ix = 0; ix < B.nsrc; ix++) {
+		struct burst_src *st = &B.st[ix];
+		struct bin *b = &st->bins[st->cur & B.mask];
+
+		/* the bin being filled counts too */
+		st->flagged += (b->bytes > B.limit);
+		st->peak = MAX(st->peak, b->bytes);
+
+		(void) printf("%s: peak %.1f Mbit/s, %" PRIu64 " bins over "
+		    "%.1f Mbit/s\n", B.srcs[ix].label, mbits(st->peak, B.width),
+		    st->flagged, mbits(B.limit, B.width));
+		free(st->bins);
+	}
+	free(B.st);
+}
+
+const struct ngp_mode ngp_burst = {
+	.name = "burst",
+	.usage = "rate=Mbit/s[,bin=usec][,window=bins][,dump=path[,keep=KiB]]",
+	.init = burst_init,
+	.packet = burst_packet,
+	.fini = burst_fini,
+};
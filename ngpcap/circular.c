@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "ngpcap.h"
+
+/*
+ * Always on capture into one file of a fixed size, used as a ring. Rotating
+ * files means creating and removing them and a gap while that happens; this
+ * opens the file once and from then on only writes records where the last
+ * one ended, CIRCULAR_BUFSIZ at a time, starting over at the front when the
+ * end is reached. `ngpcap -r' makes a pcap(3) file out of it again.
+ *
+ * The header at the front (struct ngp_circular) says where the records are:
+ * from `tail' to `head', or from `tail' to `wrap' and then from `data' to
+ * `head' once the ring went around. It indexes the first record of each of
+ * NGP_CIRCULAR_NSEG segments, that is how `tail' moves ahead of what is
+ * about to be overwritten without reading anything back. It moves two
+ * segments at a time and the header is written every time it does, so what
+ * the header on disk says is valid always is, whenever ngpcap stops. What was
+ * written after the header last was is found again by the next ngpcap using
+ * the file, everything up to its `head' is.
+ *
+ * The header is also written every `sync' msec, records still being
+ * buffered then are written first.
+ */
+
+#define	CIRCULAR_BUFSIZ		((size_t)1 << 20)
+#define	LINKTYPE_ETHERNET	1
+
+static struct {
+	struct ngp_circular	h;
+	const char		*path;
+	int			fd;
+	uint64_t		segsize;
+	int			lastseg;	/* of the record before, -1 none */
+	uint8_t			*buf;
+	size_t			buflen;		/* records from head - buflen */
+	bool			dirty;		/* head moved since the header */
+} C = {
+	.fd = -1,
+};
+
+static int
+seg(uint64_t off)
+{
+	return MIN((off - C.h.data) / C.segsize, NGP_CIRCULAR_NSEG - 1);
+}
+
+static void
+flush(void)
+{
+	if (C.buflen == 0)
+		return;
+	if (pwrite(C.fd, C.buf, C.buflen, C.h.head - C.buflen) !=
+	    (ssize_t)C.buflen) err(
+		ERRALT(EX_IOERR), "circular: unable to write to `%s'", C.path
+	);
+	C.buflen = 0;
+}
+
+static void
+sync_header(void)
+{
+	flush();
+	if (pwrite(C.fd, &C.h, sizeof(C.h), 0) != sizeof(C.h)) err(
+		ERRALT(EX_IOERR), "circular: unable to write to `%s'", C.path
+	);
+	C.dirty = false;
+}
+
+/*
+ * Is `fd' a ring made by us that can be carried on with? It is created when
+ * empty, anything else is left alone.
+ */
+static bool
+resume(int fd, uint64_t size)
+{
+	struct stat sb;
+	ssize_t rc;
+
+	if (fstat(fd, &sb) == -1) err(
+		ERRALT(EX_IOERR), "circular: unable to stat `%s'", C.path
+	);
+	if (sb.st_size == 0)
+		return (false);
+
+	rc = pread(fd, &C.h, sizeof(C.h), 0);
+	if (rc != sizeof(C.h) || ngp_circular_extents(&C.h, sb.st_size,
+	    NULL) == -1) errx(
+		EX_CANTCREAT, "circular: `%s' exists and isn't a ring",
+		C.path
+	);
+	if (C.h.size != size) errx(
+		EX_CANTCREAT, "circular: `%s' was made with size=%ju",
+		C.path, (uintmax_t)(C.h.size >> 20)
+	);
+	return (true);
+}
+
+static ssize_t
+circular_init(char *subopts, const struct ngp_source *srcs, int nsrc)
+{
+	int ix, rc;
+	unsigned long size = 1024, sync = 1000;
+	uint32_t hdr[PCAP_FILEHDR_LEN / sizeof(uint32_t)], snaplen = 0;
+	const struct ngp_mode_opt opts[] = {
+		{ "file", .string = &C.path },
+		{ "size", 16, 1 << 24, &size },
+		{ "sync", 10, 60000, &sync },
+	};
+
+	rc = ngp_mode_opts("circular", subopts, opts, nitems(opts));
+	if (C.path == NULL)
+		warnx("circular: `file' is required"), rc--;
+	if (rc != 0)
+		return (-1);
+
+	for (ix = 0; ix < nsrc; ix++)
+		snaplen = MAX(snaplen, (uint32_t)srcs[ix].snaplen);
+
+	C.fd = open(C.path, O_RDWR | O_CREAT, 0640);
+	if (C.fd == -1) err(
+		ERRALT(EX_CANTCREAT), "circular: unable to open `%s'", C.path
+	);
+	if (resume(C.fd, (uint64_t)size << 20)) {
+		/* a larger -s than before */
+		memcpy(hdr, C.h.filehdr, sizeof(hdr));
+		hdr[4] = MAX(hdr[4], snaplen);
+		memcpy(C.h.filehdr, hdr, sizeof(hdr));
+	} else {
+		C.h.magic = NGP_CIRCULAR_MAGIC;
+		C.h.nseg = NGP_CIRCULAR_NSEG;
+		C.h.size = (uint64_t)size << 20;
+		C.h.data = roundup2(sizeof(C.h), PAGE_SIZE);
+		C.h.head = C.h.tail = C.h.data;
+		hdr[0] = PCAP_MAGIC_NSEC;
+		hdr[1] = 2 | (4 << 16);		/* version 2.4 */
+		hdr[2] = hdr[3] = 0;
+		hdr[4] = snaplen;
+		hdr[5] = LINKTYPE_ETHERNET;
+		memcpy(C.h.filehdr, hdr, sizeof(hdr));
+
+		/* ZFS can't, the file is then only as large as written */
+		rc = posix_fallocate(C.fd, 0, C.h.size);
+		if (rc != 0 && ftruncate(C.fd, C.h.size) == -1) err(
+			ERRALT(EX_CANTCREAT), "circular: unable to size `%s'",
+			C.path
+		);
+	}
+	C.segsize = (C.h.size - C.h.data) / NGP_CIRCULAR_NSEG;
+	C.lastseg = (C.h.head > C.h.data) ? seg(C.h.head - 1) : -1;
+
+	if ((C.buf = malloc(CIRCULAR_BUFSIZ)) == NULL) err(
+		EX_OSERR, "circular: unable to allocate buffer"
+	);
+	sync_header();
+	ngp_tick(sync);
+
+	return (0);
+}
+
+/*
+ * Make room for `len' bytes at `head', moving `tail' ahead of them or going
+ * around to the front.
+ */
+static void
+make_room(uint64_t len)
+{
+	int ix;
+
+	for (;;) {
+		if (C.h.wrap == 0) {
+			/* all there is runs from `data' to `head' */
+			if (C.h.head + len <= C.h.size)
+				return;
+			flush();
+			C.h.wrap = C.h.head;
+			C.h.head = C.h.data;
+			C.lastseg = -1;
+			/* records of earlier rounds aren't there any more */
+			for (ix = 0; ix < NGP_CIRCULAR_NSEG; ix++)
+				if (C.h.index[ix] >= C.h.wrap)
+					C.h.index[ix] = 0;
+			continue;
+		}
+		if (C.h.head + len <= C.h.tail)
+			return;
+
+		/* the first record two segments past what len overwrites */
+		ix = (C.h.head + len <= C.h.size) ?
+		    seg(C.h.head + len - 1) + 2 : NGP_CIRCULAR_NSEG;
+		for (; ix < NGP_CIRCULAR_NSEG && C.h.index[ix] == 0; ix++)
+			;
+		if (ix < NGP_CIRCULAR_NSEG) {
+			C.h.tail = C.h.index[ix];
+		} else {
+			/* nothing of the round before is left */
+			C.h.tail = C.h.data;
+			C.h.wrap = 0;
+		}
+		sync_header();
+	}
+}
+
+static void
+circular_packet(const struct ngp_record *rec)
+{
+	uint32_t hdr[PCAP_RECHDR_LEN / sizeof(uint32_t)];
+	uint64_t len = PCAP_RECHDR_LEN + rec->caplen;
+	int ix;
+
+	make_room(len);
+	if (C.buflen + len > CIRCULAR_BUFSIZ)
+		flush();
+
+	if (seg(C.h.head) != C.lastseg) {
+		C.lastseg = seg(C.h.head);
+		C.h.index[C.lastseg] = C.h.head;
+	}
+	/* no record starts in the rest, whatever of a round before did */
+	for (ix = C.lastseg + 1; ix <= seg(C.h.head + len - 1); ix++)
+		C.h.index[ix] = 0;
+
+	hdr[0] = rec->nsec / 1000000000;
+	hdr[1] = rec->nsec % 1000000000;
+	hdr[2] = rec->caplen;
+	hdr[3] = rec->len;
+	memcpy(C.buf + C.buflen, hdr, sizeof(hdr));
+	memcpy(C.buf + C.buflen + sizeof(hdr), rec->data, rec->caplen);
+	C.buflen += len;
+	C.h.head += len;
+	C.dirty = true;
+}
+
+static void
+circular_tick(void)
+{
+	if (C.dirty)
+		sync_header();
+}
+
+static void
+circular_fini(void)
+{
+	circular_tick();
+	(void) close(C.fd);
+	free(C.buf);
+}
+
+/*
+ * Where the records of the ring `h' are, oldest first, for a file of `size'
+ * bytes. Fills in `ext' (when not NULL) and returns how many of them there
+ * are, -1 if `h' isn't the header of a ring that makes sense.
+ */
+int
+ngp_circular_extents(const struct ngp_circular *h, uint64_t size,
+    uint64_t ext[2][2])
+{
+	int ix, n = 0;
+
+	if (h->magic != NGP_CIRCULAR_MAGIC || h->nseg != NGP_CIRCULAR_NSEG ||
+	    h->data < sizeof(*h) || h->size > size || h->head < h->data ||
+	    h->head > h->size || (h->wrap != 0 && (h->wrap > h->size ||
+	    h->tail <= h->head || h->tail > h->wrap)))
+		return (-1);
+	for (ix = 0; ix < NGP_CIRCULAR_NSEG; ix++)
+		if (h->index[ix] != 0 && (h->index[ix] < h->data ||
+		    h->index[ix] >= h->size))
+			return (-1);
+
+	if (ext == NULL)
+		return (0);
+	if (h->wrap != 0) {
+		ext[n][0] = h->tail;
+		ext[n++][1] = h->wrap;
+	}
+	ext[n][0] = h->data;
+	ext[n++][1] = h->head;
+	return (n);
+}
+
+const struct ngp_mode ngp_circular = {
+	.name = "circular",
+	.usage = "file=path[,size=MiB][,sync=msec]",
+	.init = circular_init,
+	.packet = circular_packet,
+	.tick = circular_tick,
+	.fini = circular_fini,
+};
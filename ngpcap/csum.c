@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ngpcap.h"
+
+/*
+ * Checksums, to tell whether LRO or TSO is still on for an interface
+ * connected with ng_ether(4). Either leaves packets to the driver that the
+ * stack expects the hardware to finish, and outside of the host they turn up
+ * with a checksum of just the pseudo header and a length way past the MTU.
+ *
+ * Every packet gets its IPv4 header, TCP and UDP checksums verified. A wrong
+ * transport checksum that equals the sum of the pseudo header alone is counted
+ * as `unfinished', that is offload and not corruption. Packets that aren't
+ * all there (snaplen, fragments) can't be checked and are only counted.
+ *
+ * The ones-complement sum adds 32 bit words into four independent 64 bit
+ * accumulators, which compilers turn into SIMD adds on any target that has
+ * them, and folds once at the end (RFC 1071). Byte order doesn't matter to a
+ * ones-complement sum, so words are summed as they are in memory and only
+ * swapped for printing.
+ */
+
+struct csum_src {
+	uint64_t	pkts;
+	uint64_t	ip;		/* IPv4 headers checked */
+	uint64_t	ip_bad;
+	uint64_t	l4;		/* TCP and UDP checked */
+	uint64_t	l4_bad;
+	uint64_t	unfinished;	/* of the bad, pseudo header only */
+	uint64_t	oversized;
+	uint64_t	unchecked;	/* cut short or fragments */
+	unsigned	shown;
+};
+
+static struct {
+	uint32_t			mtu;
+	unsigned			samples;
+	const struct ngp_source		*srcs;
+	int				nsrc;
+	struct csum_src			*st;
+} C;
+
+static ssize_t
+csum_init(char *subopts, const struct ngp_source *srcs, int nsrc)
+{
+	unsigned long mtu = 1500, samples = 5;
+	const struct ngp_mode_opt opts[] = {
+		{ "mtu", 576, 65535, &mtu },
+		{ "samples", 0, 1000000, &samples },
+	};
+
+	if (ngp_mode_opts("csum", subopts, opts, nitems(opts)) != 0)
+		return (-1);
+
+	C.mtu = mtu;
+	C.samples = samples;
+	C.srcs = srcs;
+	C.nsrc = nsrc;
+	C.st = calloc(nsrc, sizeof(*C.st));
+	if (C.st == NULL) err(
+		EX_OSERR, "csum: unable to allocate %d sources", nsrc
+	);
+
+	return (0);
+}
+
+/* ones-complement sum of `len' bytes, not folded */
+static uint64_t
+sum(const uint8_t *p, uint32_t len, uint64_t acc)
+{
+	uint64_t a0 = acc, a1 = 0, a2 = 0, a3 = 0;
+	uint32_t w[4];
+	uint16_t h;
+	uint8_t last[2] = { 0, 0 };
+
+	for (; len >= sizeof(w); p += sizeof(w), len -= sizeof(w)) {
+		memcpy(w, p, sizeof(w));
+		a0 += w[0];
+		a1 += w[1];
+		a2 += w[2];
+		a3 += w[3];
+	}
+	for (; len >= sizeof(h); p += sizeof(h), len -= sizeof(h)) {
+		memcpy(&h, p, sizeof(h));
+		a0 += h;
+	}
+	if (len != 0) {
+		/* an odd byte is padded with a zero after it */
+		last[0] = *p;
+		memcpy(&h, last, sizeof(h));
+		a0 += h;
+	}
+
+	/* each can't carry out, 2^32 words is more than any packet */
+	a0 = (a0 & 0xffffffff) + (a0 >> 32) + (a1 & 0xffffffff) + (a1 >> 32);
+	a2 = (a2 & 0xffffffff) + (a2 >> 32) + (a3 & 0xffffffff) + (a3 >> 32);
+	return (a0 + a2);
+}
+
+static uint16_t
+fold(uint64_t acc)
+{
+	while (acc >> 16)
+		acc = (acc & 0xffff) + (acc >> 16);
+	return (uint16_t)acc;
+}
+
+/* the pseudo header TCP and UDP checksums cover, RFC 768 and RFC 8200 */
+static uint64_t
+pseudo(const struct ngp_pkt *pkt)
+{
+	size_t alen = (pkt->af == AF_INET6) ? 16 : 4;
+	uint8_t tail[8] = {
+		pkt->l4len >> 24, pkt->l4len >> 16, pkt->l4len >> 8,
+		pkt->l4len, 0, 0, 0, pkt->proto
+	};
+
+	return (sum(pkt->src, alen, sum(pkt->dst, alen, sum(tail, 8, 0))));
+}
+
+static const char *
+proto_name(uint8_t proto)
+{
+	return (proto == IPPROTO_TCP) ? "tcp" : (proto == IPPROTO_UDP) ? "udp" :
+	    "ip";
+}
+
+static void
+sample(int ix, const struct ngp_pkt *pkt, const char *what, uint16_t got,
+    uint16_t want, uint32_t iplen)
+{
+	struct csum_src *st = &C.st[ix];
+	char src[INET6_ADDRSTRLEN], dst[INET6_ADDRSTRLEN];
+
+	if (st->shown >= C.samples)
+		return;
+	st->shown++;
+
+	(void) inet_ntop(pkt->af, pkt->src, src, sizeof(src));
+	(void) inet_ntop(pkt->af, pkt->dst, dst, sizeof(dst));
+	(void) printf("%s: %s %s > %s length %u", C.srcs[ix].label,
+	    proto_name(pkt->proto), src, dst, iplen);
+	if (what == NULL)
+		(void) printf(" over mtu %u\n", C.mtu);
+	else
+		(void) printf(" bad %s checksum 0x%04x, should be 0x%04x%s\n",
+		    what, ntohs(got), ntohs(want),
+		    (strcmp(what, "ip") != 0 && got == fold(pseudo(pkt))) ?
+		    " (unfinished, offload?)" : "");
+}
+
+/* a checksum field is right when the sum over it comes out all ones */
+static bool
+check(const uint8_t *p, uint32_t len, uint64_t acc, uint32_t field,
+    uint16_t *got, uint16_t *want)
+{
+	uint64_t all = sum(p, len, acc);
+
+	if (fold(all) == 0xffff)
+		return (true);
+	memcpy(got, p + field, sizeof(*got));
+	/* take the field back out, in ones-complement that is adding ~it */
+	*want = ~fold(all + (uint16_t)~*got);
+	return (false);
+}
+
+static void
+csum_packet(const struct ngp_record *rec)
+{
+	struct csum_src *st = &C.st[rec->src];
+	struct ngp_pkt pkt;
+	uint32_t iplen, hlen, field;
+	uint16_t got, want;
+
+	st->pkts++;
+	/* the outermost headers are what offload gets wrong */
+	if (ngp_parse(rec, &pkt, 0) != 0)
+		return;
+
+	if (pkt.af == AF_INET) {
+		iplen = be16(pkt.l3 + 2);
+		hlen = (pkt.l3[0] & 0x0f) * 4;
+		st->ip++;
+		if (!check(pkt.l3, hlen, 0, 10, &got, &want)) {
+			st->ip_bad++;
+			sample(rec->src, &pkt, "ip", got, want, iplen);
+		}
+	} else
+		iplen = be16(pkt.l3 + 4) + 40;
+
+	if (iplen > C.mtu) {
+		st->oversized++;
+		sample(rec->src, &pkt, NULL, 0, 0, iplen);
+	}
+
+	switch (pkt.proto) {
+	case IPPROTO_TCP:
+		field = 16;
+		break;
+	case IPPROTO_UDP:
+		field = 6;
+		break;
+	default:
+		return;
+	}
+	if (pkt.l4 == NULL || pkt.frag || pkt.l4cap < pkt.l4len ||
+	    pkt.l4len < field + 2) {
+		st->unchecked++;
+		return;
+	}
+	/* no checksum at all is allowed for UDP over IPv4 */
+	if (pkt.proto == IPPROTO_UDP && pkt.af == AF_INET &&
+	    pkt.l4[6] == 0 && pkt.l4[7] == 0)
+		return;
+
+	st->l4++;
+	if (!check(pkt.l4, pkt.l4len, pseudo(&pkt), field, &got, &want)) {
+		st->l4_bad++;
+		st->unfinished += (got == fold(pseudo(&pkt)));
+		sample(rec->src, &pkt, proto_name(pkt.proto), got, want, iplen);
+	}
+}
+
+static void
+csum_fini(void)
+{
+	int ix;
+
+	for (ix = 0; ix < C.nsrc; ix++) {
+		struct csum_src *st = &C.st[ix];
+
+		(void) printf("%s: %" PRIu64 " packets, %" PRIu64 "/%" PRIu64
+		    " bad ip, %" PRIu64 "/%" PRIu64 " bad tcp/udp (%" PRIu64
+		    " unfinished), %" PRIu64 " over mtu, %" PRIu64
+		    " not checked\n", C.srcs[ix].label, st->pkts, st->ip_bad,
+		    st->ip, st->l4_bad, st->l4, st->unfinished, st->oversized,
+		    st->unchecked);
+		if (st->unfinished != 0 || st->oversized != 0)
+			(void) printf("%s: looks like LRO or TSO is on, see "
+			    "ifconfig(8) -lro -tso\n", C.srcs[ix].label);
+	}
+	free(C.st);
+}
+
+const struct ngp_mode ngp_csum = {
+	.name = "csum",
+	.usage = "[mtu=bytes][,samples=n]",
+	.init = csum_init,
+	.packet = csum_packet,
+	.fini = csum_fini,
+};
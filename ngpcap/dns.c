@@ -0,0 +1,463 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <ctype.h>
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ngpcap.h"
+
+/*
+ * Who resolved what, one line per DNS transaction instead of a pcap of port
+ * 53:
+ *
+ *	time client server qname qtype rcode msec
+ *
+ * A query waits in an ngp_table, keyed by the client,
+ * server, transport, client port, DNS ID and overlay, for its response. The
+ * response has to repeat the question too, so IDs reused by a busy client
+ * don't get mixed up. A query that goes unanswered for `timeout' seconds, or
+ * is evicted to make room, is logged with `-' for the rcode and time. A
+ * response to a query the tap didn't see (it was before we started) gets `-'
+ * for the time.
+ *
+ * DNS over TCP is only understood when a message starts at the beginning of a
+ * segment, which is how every resolver sends queries and the first part of
+ * the response. Only the first question is looked at, nobody sends more.
+ */
+
+#define	DNS_HDR_LEN	12
+#define	DNS_MAXNAME	255		/* wire format, RFC 1035 */
+#define	DNS_MAXHOPS	32		/* compression pointers to follow */
+
+struct txn {
+	uint32_t	hash;		/* 0 is a free slot */
+	uint8_t		af;
+	uint8_t		proto;
+	uint16_t	id;
+	uint16_t	port;		/* of the client */
+	uint16_t	qtype;
+	uint32_t	vni;
+	uint8_t		client[16];
+	uint8_t		server[16];
+	uint64_t	ts;		/* of the query, nsec */
+	uint8_t		qnamelen;
+	uint8_t		qname[DNS_MAXNAME];
+};
+
+/* what the header and first question of a message say */
+struct msg {
+	uint16_t	id;
+	bool		response;
+	uint8_t		rcode;
+	uint16_t	qtype;
+	uint8_t		qnamelen;
+	uint8_t		qname[DNS_MAXNAME];
+};
+
+/* what a transaction is looked up by */
+struct tkey {
+	const struct ngp_pkt	*pkt;
+	const uint8_t		*client;
+	const uint8_t		*server;
+	uint16_t		port;		/* of the client */
+	const struct msg	*m;
+};
+
+static struct {
+	struct ngp_table table;		/* of struct txn */
+	uint16_t	port;
+	uint64_t	timeout;	/* nsec */
+	uint64_t	now;		/* time of the latest record */
+	uint64_t	queries;
+	uint64_t	answered;
+	uint64_t	unanswered;
+	uint64_t	unmatched;	/* responses without their query */
+} D;
+
+static const struct {
+	uint16_t	type;
+	const char	*name;
+} qtypes[] = {
+	{ 1, "A" },		{ 2, "NS" },		{ 5, "CNAME" },
+	{ 6, "SOA" },		{ 12, "PTR" },		{ 15, "MX" },
+	{ 16, "TXT" },		{ 28, "AAAA" },		{ 33, "SRV" },
+	{ 35, "NAPTR" },	{ 43, "DS" },		{ 46, "RRSIG" },
+	{ 48, "DNSKEY" },	{ 52, "TLSA" },		{ 64, "SVCB" },
+	{ 65, "HTTPS" },	{ 252, "AXFR" },	{ 255, "ANY" },
+	{ 257, "CAA" },
+};
+
+static const char *rcodes[] = {
+	"NOERROR", "FORMERR", "SERVFAIL", "NXDOMAIN", "NOTIMP", "REFUSED",
+};
+
+static ssize_t
+dns_init(char *subopts, const struct ngp_source *srcs, int nsrc)
+{
+	unsigned long port = 53, txns = 4096, timeout = 5;
+	const struct ngp_mode_opt opts[] = {
+		{ "port", 1, UINT16_MAX, &port },
+		{ "txns", NGP_PROBE, 1 << 20, &txns },
+		{ "timeout", 1, 600, &timeout },
+	};
+
+	if (ngp_mode_opts("dns", subopts, opts, nitems(opts)) != 0)
+		return (-1);
+
+	D.port = port;
+	D.timeout = timeout * NSEC_PER_SEC;
+	if (ngp_table_init(&D.table, txns, sizeof(struct txn)) != 0) err(
+		EX_OSERR, "dns: unable to allocate %lu transactions", txns
+	);
+	ngp_tick(1000);
+
+	return (0);
+}
+
+/*
+ * The name starting at `off' of a message `len' long, uncompressed into `out'
+ * in wire format. Returns the offset right after it, or 0 when it is not a
+ * name or doesn't fit in what was captured.
+ */
+static uint32_t
+qname(const uint8_t *dns, uint32_t len, uint32_t off, uint8_t *out,
+    uint8_t *outlen)
+{
+	uint32_t next = 0, n = 0, hops = 0;
+	uint8_t lab;
+
+	for (;;) {
+		if (off >= len)
+			return (0);
+		lab = dns[off];
+		if ((lab & 0xc0) == 0xc0) {
+			if (off + 1 >= len || ++hops > DNS_MAXHOPS)
+				return (0);
+			if (next == 0)
+				next = off + 2;
+			off = (lab & 0x3f) << 8 | dns[off + 1];
+			continue;
+		}
+		if ((lab & 0xc0) != 0 || off + 1 + lab > len ||
+		    n + 1 + lab > DNS_MAXNAME)
+			return (0);
+		memcpy(out + n, dns + off, 1 + lab);
+		n += 1 + lab;
+		off += 1 + lab;
+		if (lab == 0)
+			break;
+	}
+	*outlen = n;
+
+	return (next != 0) ? next : off;
+}
+
+static int
+parse_msg(const uint8_t *dns, uint32_t len, struct msg *m)
+{
+	uint32_t off;
+
+	if (len < DNS_HDR_LEN || be16(dns + 4) == 0)
+		return (-1);
+	m->id = be16(dns);
+	m->response = (dns[2] & 0x80) != 0;
+	m->rcode = dns[3] & 0x0f;
+
+	off = qname(dns, len, DNS_HDR_LEN, m->qname, &m->qnamelen);
+	if (off == 0 || off + 4 > len)
+		return (-1);
+	m->qtype = be16(dns + off);
+
+	return (0);
+}
+
+/* names are compared the way DNS does, ignoring ASCII case */
+static bool
+same_question(const struct txn *t, const struct msg *m)
+{
+	uint8_t ix;
+
+	if (t->qtype != m->qtype || t->qnamelen != m->qnamelen)
+		return (false);
+	for (ix = 0; ix < t->qnamelen; ix++)
+		if (tolower(t->qname[ix]) != tolower(m->qname[ix]))
+			return (false);
+	return (true);
+}
+
+static void
+endpoint(char *buf, size_t size, int af, const uint8_t *addr, uint16_t port)
+{
+	char a[INET6_ADDRSTRLEN];
+
+	(void) inet_ntop(af, addr, a, sizeof(a));
+	if (port == 0)
+		snprintf(buf, size, "%s", a);
+	else
+		snprintf(buf, size, (af == AF_INET6) ? "[%s]:%u" : "%s:%u", a,
+		    port);
+}
+
+/* presentation format, with \DDD for anything that would confuse a reader */
+static void
+name_text(char *buf, size_t size, const uint8_t *name)
+{
+	char *p = buf, *end = buf + size - 5; /* room for \DDD and NUL */
+	uint8_t lab, ix;
+
+	if (*name == 0) {
+		snprintf(buf, size, ".");
+		return;
+	}
+	while (p < end && (lab = *name++) != 0) {
+		for (ix = 0; ix < lab && p < end; ix++, name++) {
+			if (*name > ' ' && *name < 0x7f && *name != '.' &&
+			    *name != '\\')
+				*p++ = *name;
+			else
+				p += sprintf(p, "\\%03u", *name);
+		}
+		*p++ = '.';
+	}
+	*p = '\0';
+}
+
+static void
+log_txn(const struct txn *t, int rcode, uint64_t ts, uint64_t resp_ts)
+{
+	char cl[64], sv[64], name[4 * DNS_MAXNAME + 1], type[16], code[16];
+	char when[16], rtt[16];
+	time_t sec = ts / NSEC_PER_SEC;
+	struct tm tm;
+	size_t ix;
+
+	(void) localtime_r(&sec, &tm);
+	(void) strftime(when, sizeof(when), "%H:%M:%S", &tm);
+	endpoint(cl, sizeof(cl), t->af, t->client, t->port);
+	endpoint(sv, sizeof(sv), t->af, t->server, 0);
+	name_text(name, sizeof(name), t->qname);
+
+	snprintf(type, sizeof(type), "TYPE%u", t->qtype); /* RFC 3597 */
+	for (ix = 0; ix < nitems(qtypes); ix++)
+		if (qtypes[ix].type == t->qtype) {
+			snprintf(type, sizeof(type), "%s", qtypes[ix].name);
+			break;
+		}
+
+	if (rcode == -1)
+		snprintf(code, sizeof(code), "-");
+	else if ((size_t)rcode < nitems(rcodes))
+		snprintf(code, sizeof(code), "%s", rcodes[rcode]);
+	else
+		snprintf(code, sizeof(code), "RCODE%d", rcode);
+
+	if (ts == 0 || resp_ts == 0)
+		snprintf(rtt, sizeof(rtt), "-");
+	else
+		snprintf(rtt, sizeof(rtt), "%.2f",
+		    (resp_ts - ts) / (double)NSEC_PER_USEC / 1000.0);
+
+	(void) printf("%s.%06" PRIu64 " %s %s %s %s %s %s\n", when,
+	    (ts % NSEC_PER_SEC) / NSEC_PER_USEC, cl, sv, name, type, code, rtt);
+}
+
+static uint32_t
+txn_hash(const struct tkey *k)
+{
+	uint64_t h;
+
+	h = ((uint64_t)k->pkt->vni << 40 | (uint64_t)k->pkt->proto << 32 |
+	    (uint64_t)k->port << 16 | k->m->id) ^ k->pkt->af;
+	h = ngp_hash_bytes(h, k->client, 16);
+	return (ngp_slot_hash(ngp_hash_bytes(h, k->server, 16)));
+}
+
+static bool
+txn_match(const void *slot, const void *key)
+{
+	const struct txn *t = slot;
+	const struct tkey *k = key;
+
+	return (t->id == k->m->id && t->port == k->port &&
+	    t->af == k->pkt->af && t->proto == k->pkt->proto &&
+	    t->vni == k->pkt->vni && memcmp(t->client, k->client, 16) == 0 &&
+	    memcmp(t->server, k->server, 16) == 0 && same_question(t, k->m));
+}
+
+static bool
+asked_earlier(const void *a, const void *b)
+{
+	return (((const struct txn *)a)->ts < ((const struct txn *)b)->ts);
+}
+
+static void
+query(const struct ngp_pkt *pkt, uint16_t sport, const struct msg *m,
+    uint64_t now)
+{
+	struct tkey k = { pkt, pkt->src, pkt->dst, sport, m };
+	uint32_t hash = txn_hash(&k);
+	void *slot;
+	struct txn *t;
+
+	switch (ngp_table_find(&D.table, hash, txn_match, &k, asked_earlier,
+	    &slot)) {
+	case NGP_FOUND:
+		/* the client asking again keeps the time of the first try */
+		return;
+	case NGP_FULL:
+		/* the oldest query is the least likely to be answered */
+		t = slot;
+		log_txn(t, -1, t->ts, 0);
+		D.unanswered++;
+		break;
+	case NGP_FREE:
+		break;
+	}
+	t = slot;
+	D.queries++;
+	t->hash = hash;
+	t->af = pkt->af;
+	t->proto = pkt->proto;
+	t->vni = pkt->vni;
+	t->id = m->id;
+	t->port = sport;
+	t->qtype = m->qtype;
+	memcpy(t->client, pkt->src, 16);
+	memcpy(t->server, pkt->dst, 16);
+	t->ts = now;
+	t->qnamelen = m->qnamelen;
+	memcpy(t->qname, m->qname, m->qnamelen);
+}
+
+static void
+response(const struct ngp_pkt *pkt, uint16_t dport, const struct msg *m,
+    uint64_t now)
+{
+	struct tkey k = { pkt, pkt->dst, pkt->src, dport, m };
+	void *slot;
+	struct txn *t, tmp;
+
+	if (ngp_table_find(&D.table, txn_hash(&k), txn_match, &k, NULL,
+	    &slot) == NGP_FOUND) {
+		t = slot;
+		log_txn(t, m->rcode, t->ts, now);
+		t->hash = 0;
+		D.answered++;
+		return;
+	}
+
+	/* its query went by before we started, or was evicted */
+	memset(&tmp, 0, sizeof(tmp));
+	tmp.af = pkt->af;
+	tmp.proto = pkt->proto;
+	tmp.port = dport;
+	tmp.qtype = m->qtype;
+	memcpy(tmp.client, pkt->dst, 16);
+	memcpy(tmp.server, pkt->src, 16);
+	memcpy(tmp.qname, m->qname, m->qnamelen);
+	log_txn(&tmp, m->rcode, now, 0);
+	D.unmatched++;
+}
+
+static void
+dns_packet(const struct ngp_record *rec)
+{
+	struct ngp_pkt pkt;
+	const uint8_t *dns;
+	uint32_t len, off;
+	uint16_t sport, dport;
+	struct msg m;
+
+	if (ngp_parse(rec, &pkt, NGP_PARSE_DEPTH) != 0 || pkt.l4 == NULL)
+		return;
+
+	switch (pkt.proto) {
+	case IPPROTO_UDP:
+		if (pkt.l4cap < 8 || pkt.l4len < 8)
+			return;
+		dns = pkt.l4 + 8;
+		len = MIN(pkt.l4cap, pkt.l4len) - 8;
+		break;
+	case IPPROTO_TCP:
+		if (pkt.l4cap < 20)
+			return;
+		off = (pkt.l4[12] >> 4) * 4;
+		/* the length in front of the message is all that is skipped */
+		if (off < 20 || pkt.l4cap < off + 2 || pkt.l4len < off + 2)
+			return;
+		dns = pkt.l4 + off + 2;
+		len = MIN(pkt.l4cap, pkt.l4len) - off - 2;
+		break;
+	default:
+		return;
+	}
+	sport = be16(pkt.l4);
+	dport = be16(pkt.l4 + 2);
+	D.now = rec->nsec;
+
+	if (dport != D.port && sport != D.port)
+		return;
+	if (parse_msg(dns, len, &m) == -1)
+		return;
+
+	if (!m.response && dport == D.port)
+		query(&pkt, sport, &m, rec->nsec);
+	else if (m.response && sport == D.port)
+		response(&pkt, dport, &m, rec->nsec);
+}
+
+static void
+expire(uint64_t older)
+{
+	uint32_t ix;
+	struct txn *txns = D.table.slots, *t;
+
+	for (ix = 0; ix <= D.table.mask; ix++) {
+		t = &txns[ix];
+		if (t->hash != 0 && t->ts <= older) {
+			log_txn(t, -1, t->ts, 0);
+			t->hash = 0;
+			D.unanswered++;
+		}
+	}
+}
+
+static void
+dns_tick(void)
+{
+	/* nothing captured means no time has passed as far as we know */
+	if (D.now > D.timeout)
+		expire(D.now - D.timeout);
+}
+
+static void
+dns_fini(void)
+{
+	/* whatever is still waiting won't be answered while we look */
+	expire(UINT64_MAX);
+	(void) printf("%" PRIu64 " queries, %" PRIu64 " answered, %" PRIu64
+	    " unanswered, %" PRIu64 " responses without a query\n",
+	    D.queries, D.answered, D.unanswered, D.unmatched);
+	free(D.table.slots);
+}
+
+const struct ngp_mode ngp_dns = {
+	.name = "dns",
+	.usage = "[port=n][,txns=n][,timeout=sec]",
+	.init = dns_init,
+	.packet = dns_packet,
+	.tick = dns_tick,
+	.fini = dns_fini,
+};
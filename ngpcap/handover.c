@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "ngpcap.h"
+
+/*
+ * Hot restart (-H). A running ngpcap listens on a UNIX socket and a new one,
+ * started with just -H, connects to it and takes over: both netgraph(4)
+ * sockets and the ring32 go across with SCM_RIGHTS, the node IDs to clean up
+ * after in the stream behind them. Nothing is shut down or re-created, so
+ * ng_pcap(4) never loses `snoop' and the tees stay spliced in. What the kernel
+ * queues on the data socket meanwhile is simply read by the new one.
+ *
+ * The old one waits for a byte back before it exits without cleaning up. If
+ * that doesn't come the new one failed and the old one carries on.
+ */
+
+#define	HANDOVER_WAIT	5		/* seconds for the successor to ack */
+
+static int
+handover_addr(const char *path, struct sockaddr_un *sun)
+{
+	memset(sun, 0, sizeof(*sun));
+	sun->sun_family = AF_UNIX;
+	if (strlcpy(sun->sun_path, path, sizeof(sun->sun_path)) >=
+	    sizeof(sun->sun_path)) {
+		errno = ENAMETOOLONG;
+		return (-1);
+	}
+	return (0);
+}
+
+static int
+xfer_all(int s, void *buf, size_t count, bool out)
+{
+	ssize_t rc;
+	uint8_t *p = buf;
+
+	while (count > 0) {
+		rc = out ? write(s, p, count) : read(s, p, count);
+		if (rc == -1 && errno == EINTR)
+			continue;
+		if (rc == 0)
+			errno = ECONNRESET;
+		if (rc <= 0)
+			return (-1);
+		p += rc;
+		count -= rc;
+	}
+	return (0);
+}
+
+/* the socket a successor finds us on, for EVFILT_READ */
+int
+ngp_handover_listen(const char *path)
+{
+	int s;
+	struct sockaddr_un sun;
+
+	if (handover_addr(path, &sun) == -1) err(
+		EX_USAGE, "handover socket `%s'", path
+	);
+	if ((s = socket(PF_UNIX, SOCK_STREAM, 0)) == -1) err(
+		ERRALT(EX_OSERR), "unable to create handover socket"
+	);
+	/* whoever had it before us is gone or handed over to us */
+	(void) unlink(path);
+	if (bind(s, (struct sockaddr *)&sun, SUN_LEN(&sun)) == -1) err(
+		ERRALT(EX_CANTCREAT), "unable to bind `%s'", path
+	);
+	if (listen(s, 1) == -1) err(
+		ERRALT(EX_OSERR), "unable to listen on `%s'", path
+	);
+	if (fcntl(s, F_SETFL, O_NONBLOCK) == -1) err(
+		ERRALT(EX_OSERR), "fcntl: can't set flags"
+	);
+
+	return (s);
+}
+
+/*
+ * Hand `fds' (NGP_HANDOVER_NFDS of them) and the rest over to whoever is
+ * connecting to `ls'. Returns 0 once the successor has it all, -1 with
+ * `errno' if it didn't take it and we still own everything.
+ */
+int
+ngp_handover_send(int ls, const struct ngp_handover *h, const int *fds,
+    const ng_ID_t *pcaps, const ng_ID_t *tees)
+{
+	int s, save_err;
+	uint8_t ack;
+	struct timeval tv = { .tv_sec = HANDOVER_WAIT };
+	struct iovec iov = {
+		.iov_base = (void *)(uintptr_t)h,
+		.iov_len = sizeof(*h),
+	};
+	union {
+		struct cmsghdr	hdr;
+		char		buf[CMSG_SPACE(sizeof(int) * NGP_HANDOVER_NFDS)];
+	} cm;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cm.buf,
+		.msg_controllen = sizeof(cm.buf),
+	};
+	struct cmsghdr *cmsg;
+
+	if ((s = accept(ls, NULL, NULL)) == -1)
+		return (-1);
+
+	/* accept(2) gave it our O_NONBLOCK, the wait below wants to block */
+	if (fcntl(s, F_SETFL, 0) == -1 ||
+	    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1 ||
+	    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == -1)
+		goto fail;
+
+	memset(cm.buf, 0, sizeof(cm.buf));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * NGP_HANDOVER_NFDS);
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * NGP_HANDOVER_NFDS);
+
+	if (sendmsg(s, &msg, 0) != sizeof(*h) ||
+	    xfer_all(s, (void *)(uintptr_t)pcaps, h->npcap * sizeof(*pcaps),
+	    true) == -1 ||
+	    xfer_all(s, (void *)(uintptr_t)tees, h->ntees * sizeof(*tees),
+	    true) == -1 ||
+	    xfer_all(s, &ack, sizeof(ack), false) == -1)
+		goto fail;
+
+	(void) close(s);
+	return (0);
+
+fail:
+	save_err = errno;
+	(void) close(s);
+	errno = save_err;
+	return (-1);
+}
+
+/*
+ * Take over from the ngpcap listening on `path'. The returned socket goes to
+ * ngp_handover_done() once all of it is in use, which lets the old one go.
+ */
+int
+ngp_handover_recv(const char *path, struct ngp_handover *h, int *fds,
+    ng_ID_t **pcaps, ng_ID_t **tees)
+{
+	int s;
+	ssize_t rc;
+	struct sockaddr_un sun;
+	struct iovec iov = { .iov_base = h, .iov_len = sizeof(*h) };
+	union {
+		struct cmsghdr	hdr;
+		char		buf[CMSG_SPACE(sizeof(int) * NGP_HANDOVER_NFDS)];
+	} cm;
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cm.buf,
+		.msg_controllen = sizeof(cm.buf),
+	};
+	struct cmsghdr *cmsg;
+
+	if (handover_addr(path, &sun) == -1) err(
+		EX_USAGE, "handover socket `%s'", path
+	);
+	if ((s = socket(PF_UNIX, SOCK_STREAM, 0)) == -1) err(
+		ERRALT(EX_OSERR), "unable to create handover socket"
+	);
+	if (connect(s, (struct sockaddr *)&sun, SUN_LEN(&sun)) == -1) err(
+		ERRALT(EX_UNAVAILABLE), "nothing to take over at `%s'", path
+	);
+
+	do {
+		rc = recvmsg(s, &msg, MSG_WAITALL);
+	} while (rc == -1 && errno == EINTR);
+	if (rc == -1) err(
+		ERRALT(EX_IOERR), "unable to receive handover"
+	);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (rc != sizeof(*h) || h->magic != NGP_HANDOVER_MAGIC ||
+	    (msg.msg_flags & MSG_CTRUNC) != 0 || cmsg == NULL ||
+	    cmsg->cmsg_type != SCM_RIGHTS ||
+	    cmsg->cmsg_len != CMSG_LEN(sizeof(int) * NGP_HANDOVER_NFDS) ||
+	    h->npcap < 0 || h->ntees < 0) errx(
+		EX_PROTOCOL, "`%s' isn't an ngpcap we can take over from", path
+	);
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * NGP_HANDOVER_NFDS);
+
+	*pcaps = calloc(MAX(h->npcap, 1), sizeof(**pcaps));
+	*tees = calloc(MAX(h->ntees, 1), sizeof(**tees));
+	if (*pcaps == NULL || *tees == NULL) err(
+		EX_OSERR, "unable to allocate handover"
+	);
+	if (xfer_all(s, *pcaps, h->npcap * sizeof(**pcaps), false) == -1 ||
+	    xfer_all(s, *tees, h->ntees * sizeof(**tees), false) == -1) err(
+		ERRALT(EX_IOERR), "unable to receive handover"
+	);
+
+	return (s);
+}
+
+/* tell the old one we have it all, it exits without cleaning up */
+void
+ngp_handover_done(int s)
+{
+	uint8_t ack = 1;
+
+	if (xfer_all(s, &ack, sizeof(ack), true) == -1) err(
+		ERRALT(EX_IOERR), "unable to finish handover"
+	);
+	(void) close(s);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <strings.h>
+#include <sys/param.h>
+
+#include "ngpcap.h"
+
+/*
+ * Log-linear histogram of nanoseconds for the modes that report latency,
+ * NGP_HIST_SUB buckets per power of 2, so percentiles are good to 12.5%.
+ */
+
+static unsigned
+bucket(uint64_t v)
+{
+	int e;
+
+	if (v < 2 * NGP_HIST_SUB)
+		return (v);
+	e = flsll(v) - 1;
+	return ((e - 2) * NGP_HIST_SUB + ((v >> (e - 3)) & (NGP_HIST_SUB - 1)));
+}
+
+/* the smallest value of bucket `ix' */
+static uint64_t
+bucket_value(unsigned ix)
+{
+	if (ix < 2 * NGP_HIST_SUB)
+		return (ix);
+	return ((uint64_t)(NGP_HIST_SUB + ix % NGP_HIST_SUB) <<
+	    (ix / NGP_HIST_SUB - 1));
+}
+
+void
+ngp_hist_add(struct ngp_hist *h, uint64_t v)
+{
+	h->n++;
+	h->b[bucket(v)]++;
+	if (v > h->max)
+		h->max = v;
+}
+
+/* `from' added to `to' */
+void
+ngp_hist_merge(struct ngp_hist *to, const struct ngp_hist *from)
+{
+	unsigned ix;
+
+	to->n += from->n;
+	to->max = MAX(to->max, from->max);
+	for (ix = 0; ix < NGP_HIST_LEN; ix++)
+		to->b[ix] += from->b[ix];
+}
+
+/* nsec */
+uint64_t
+ngp_hist_percentile(const struct ngp_hist *h, unsigned pct)
+{
+	uint64_t want = (h->n * pct + 99) / 100, seen = 0;
+	unsigned ix;
+
+	for (ix = 0; ix < NGP_HIST_LEN; ix++) {
+		seen += h->b[ix];
+		if (seen >= want && seen != 0)
+			return MIN(bucket_value(ix), h->max);
+	}
+	return (h->max);
+}
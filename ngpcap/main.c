@@ -8,6 +8,7 @@
 #include <err.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,6 +25,8 @@
 #include "ring32.h"
 
 #include <netgraph/ng_pcap.h>
+#include <netgraph/ng_socket.h>
+#include <netgraph/ng_tee.h>
 
 #include "ngpcap.h"
 
@@ -48,16 +51,40 @@ Usage(const char *format, ...)
 
 	(void) fprintf(
 	    stderr,
-	    "USAGE: " ME " [-n] [-j jail] [-s snaplen] <spec> [spec ...]\n"
+	    "USAGE: " ME " [-n] [-j jail] [-m mode[,opts] | -T threads | "
+	    "-H path]\n\t[-s snaplen] <spec> [spec ...]\n"
+	    "       " ME " -H path\n"
+	    "       " ME " -r file [-m mode[,opts]] [-T threads] [-s snaplen]\n"
 	    "-n\t\tDisable automatic loading of netgraph(4) kernel modules.\n"
 	    "-j jail\t\tSwitch to jail for all references.\n"
+	    "-H path\t\tListen on path for a new " ME " to hand over to. "
+	    "Without specs,\n\t\ttake over from the one listening there.\n"
+	    "-m mode\t\tAnalyze packets as they arrive instead of writing "
+	    "them to stdout.\n\t\tModes and their options:\n"
+	);
+	ngp_mode_usage(stderr);
+	(void) fprintf(
+	    stderr,
 	    "-s snaplen\tSnarf snaplen bytes of data from each packet rather "
-	    "than\n\t\tthe default of " STRFY(NG_PACP_MAX_SNAPLEN) " bytes.\n\n"
-	    "You provide up to " STRFY(NG_PCAP_MAX_LINKS) " pcap specifications "
-	    "to snoop. Specifications have 3\ncomponents separated by colon:\n"
+	    "than\n\t\tthe default of " STRFY(NG_PACP_MAX_SNAPLEN) " bytes.\n"
+	    "-r file\t\tRead a pcap(3) file or a circular ring instead of "
+	    "capturing, for\n\t\tstdout trimmed to snaplen or for a mode.\n"
+	    "-T threads\tRead the sources with this many threads, one per "
+	    "CPU.\n\t\tWith -r, read that many pieces of file at once.\n\n"
+	    "You provide pcap specifications to snoop, every "
+	    STRFY(NG_PCAP_MAX_LINKS) " get their own\nng_pcap(4). "
+	    "Specifications have 3 components separated by colon:\n"
 	    "\tlayer\tone of the strings `ether', `inet4', or `inet6'.\n"
 	    "\tnode\ta valid netgraph(4) node name or ID (not path).\n"
-	    "\thook\ta valid netgraph(4) hook name for the node.\n"
+	    "\thook\ta valid netgraph(4) hook name for the node.\n\n"
+	    "A spec of `link:node:hook[:layer]' captures an already connected "
+	    "hook by splicing\nan ng_tee(4) into it until exit. It uses 2 of "
+	    "the specifications, one per\ndirection, and layer defaults to "
+	    "`ether'.\n\n"
+	    "A spec of `[layer:]node:*' does that for every hook of node. "
+	    "Without layer it is\n`ether' unless the link is an ng_iface(4) "
+	    "hook.\n\n"
+	    "Any spec can end in `@snaplen' to override -s for it.\n"
 	);
 
 	exit(EX_USAGE);
@@ -70,13 +97,32 @@ static struct {
 	struct ring32	buffer;
 	ngctx		ctrl;
 	ngctx		data;
-	ng_ID_t		pcap;
+	struct ng_cache	nodes;		/* resolves the specs' node names */
+	ng_ID_t		*pcaps;		/* NG_PCAP_MAX_LINKS sources each */
+	int		npcap;
+	ng_ID_t		*tees;		/* spliced in */
+	int		ntees;
+	int		nheaders;	/* pcap(3) file headers read */
 	int		kq;
+	const struct ngp_mode *mode;	/* -m, or NULL for stdout */
+	struct ngp_source *srcs;
+	int		nsrcs;
+	uint8_t		filehdr[PCAP_FILEHDR_LEN];
+	bool		nsec;		/* timestamps are nanoseconds */
+	int32_t		snaplen;
+	unsigned	tick;		/* msec between mode ticks, 0 none */
+	int		nthreads;	/* -T, workers.c reads when > 1 */
+	const char	*handover;	/* -H */
+	int		listen;		/* for a successor to connect to */
+	bool		handed;		/* a successor has our nodes now */
+	uint32_t	boundary;	/* the record stdout is in starts here */
+	bool		hdr_out;	/* the file header is before `boundary' */
+	const char	*offline;	/* -r */
 } G = {
 	.ctrl = -1,
 	.data = -1,
-	.pcap = 0,
 	.kq = -1,
+	.listen = -1,
 };
 
 /*
@@ -84,8 +130,8 @@ static struct {
  * to `snoop` making cleanup kind of un-necessary.
  * TODO: verify that and if true remove this code...
  *
- * G.buffer always gets ring32_fini called on it. So don't set up err function
- * until after successfully initializing G.buffer
+ * G.buffer always gets ring32_fini called on it, which is fine before it was
+ * initialized as it checks for that.
  */
 static void
 err_cleanup(int _)
@@ -95,11 +141,29 @@ err_cleanup(int _)
 	if (G.kq != -1)
 		(void)close(G.kq);
 
+	/* once handed over the path is the successor's */
+	if (G.listen != -1) {
+		(void)close(G.listen);
+		if (!G.handed)
+			(void)unlink(G.handover);
+	}
+
 	if (G.ctrl == -1)
 		return; /* can't shutdown without this */
 
-	if (G.pcap != 0)
-		ng_shutdown_node(G.ctrl, G.pcap);
+	/* the successor has our nodes, they stay as they are */
+	if (G.handed)
+		G.ntees = G.npcap = 0;
+
+	/* puts the links we spliced into back together */
+	while (G.ntees > 0)
+		ng_shutdown_node(G.ctrl, G.tees[--G.ntees]);
+
+	/* while connecting `npcap' is every slot, 0 for those not made yet */
+	while (G.npcap > 0)
+		if (G.pcaps[--G.npcap] != 0)
+			ng_shutdown_node(G.ctrl, G.pcaps[G.npcap]);
+	ngp_workers_fini(G.ctrl);
 
 	close(G.ctrl);
 	close(G.data);
@@ -122,12 +186,16 @@ checkcomponent(const char *name, const char *parsed, size_t max, const char **se
 
 struct pcap_spec {
 	enum pkt_type	pkt;
+	bool		splice;	/* `link:' spec, needs an ng_tee(4) */
+	bool		infer;	/* `node:*' without a layer */
 	const char	*node;
 	const char	*hook;
+	int32_t		snaplen; /* `@snaplen', 0 for -s */
 };
 /*
- * This will split a string like "inet:node:hook" into separate parts
- * for a struct pcap_spec.
+ * This will split a string like "inet:node:hook" (or "link:node:hook:inet")
+ * into separate parts for a struct pcap_spec. Any of them can end in
+ * `@snaplen'.
  *
  * So that users don't have to play "fetch a rock" with their input we
  * warn and return -1 after reporting as many issues as we can find.
@@ -137,18 +205,54 @@ static int
 parse_spec(char *arg, struct pcap_spec *ps)
 {
 	int	rc = 0;
-	char **iter, *components[3] = {NULL};
+	char **iter, *components[4] = {NULL}, *snap;
 	const char *layer;
 
 	assert(arg != NULL);
 	assert(ps != NULL);
 
+	if ((snap = strrchr(arg, '@')) != NULL) {
+		char *ep;
+		long maybe;
+
+		*snap++ = '\0';
+		maybe = strtol(snap, &ep, 10);
+		if (*snap == '\0' || *ep != '\0' ||
+		    maybe > NG_PACP_MAX_SNAPLEN || maybe < NG_PACP_MIN_SNAPLEN)
+			warnx("snaplen must be in [%d,%d]: `@%s'",
+			    NG_PACP_MIN_SNAPLEN, NG_PACP_MAX_SNAPLEN, snap), rc++;
+		else
+			ps->snaplen = maybe;
+	}
+
 	for (iter = components; (*iter = strsep(&arg, ":")) != NULL;)
 		if (++iter >= &components[nitems(components)])
 			break;
 
-	if (arg != NULL) warnx(
-		"unrecognized components pcap specification: `%s'", arg
+	/*
+	 * A `link:' spec has the layer last, and optional. Put it first like
+	 * the others.
+	 */
+	ps->splice = (components[0] != NULL &&
+	    strcmp(components[0], "link") == 0);
+	if (ps->splice) {
+		components[0] = (components[3] != NULL) ?
+		    components[3] : (char *) HOOK_PKT_ETHER;
+		components[3] = NULL;
+	}
+
+	/* `node:*', the layer comes from the node types */
+	ps->infer = (components[1] != NULL && strcmp(components[1], "*") == 0 &&
+	    components[2] == NULL);
+	if (ps->infer) {
+		components[2] = components[1];
+		components[1] = components[0];
+		components[0] = NULL;
+	}
+
+	if (arg != NULL || components[3] != NULL) warnx(
+		"unrecognized components pcap specification: `%s'",
+		arg != NULL ? arg : components[3]
 	), rc++;
 
 	rc += checkcomponent(
@@ -164,7 +268,9 @@ parse_spec(char *arg, struct pcap_spec *ps)
 	 */
 #	define ARGFMT	"%s:%s:%s"
 #	define ARGS	components[0], components[1], components[2]
-	if (layer == NULL) {
+	if (layer == NULL && ps->infer) {
+		ps->pkt = PKT_ETHER;
+	} else if (layer == NULL) {
 		warnx("spec `" ARGFMT "': layer is missing", ARGS);
 		rc++;
 	} else {
@@ -275,22 +381,221 @@ set_nonblocking(int fd)
 }
 
 
+/*
+ * Every ng_pcap(4) starts with a pcap(3) file header, as its own datagram,
+ * when `snoop' gets connected. Only the first one may go to stdout.
+ */
+bool
+ngp_file_header(const void *buf, ssize_t len)
+{
+	uint32_t magic;
+
+	if (len != PCAP_FILEHDR_LEN)
+		return (false);
+	memcpy(&magic, buf, sizeof(magic));
+
+	return (magic == PCAP_MAGIC || magic == PCAP_MAGIC_NSEC);
+}
+
+/*
+ * Each ng_pcap(4) puts its own snaplen in its file header, but only the first
+ * header is kept and pcap(3) cuts every record to what that one says. Make it
+ * the largest snaplen of any source before anybody gets to see it.
+ */
+void
+ngp_fix_file_header(void *buf, int32_t snaplen)
+{
+	uint32_t sl = snaplen;
+
+	memcpy((uint8_t *)buf + 16, &sl, sizeof(sl));
+}
+
 static void
 read_event(int fd, struct ring32 *ring)
 {
 	size_t count;
 	ssize_t rc;
+	char *buf;
 
 	do {
-		rc = ring32_read_advance(
-			ring,
-			read(fd, ring32_read_buffer(&G.buffer, &count), count)
-		);
+		buf = ring32_read_buffer(ring, &count);
+		rc = read(fd, buf, count);
+		if (ngp_file_header(buf, rc)) {
+			if (G.nheaders++ > 0) {
+				rc = 0;
+			} else { /* a successor needs one of its own */
+				ngp_fix_file_header(buf, G.snaplen);
+				memcpy(G.filehdr, buf, sizeof(G.filehdr));
+			}
+		}
+		rc = ring32_read_advance(ring, rc);
 	} while(rc == -1 && errno == EAGAIN);
 
 	/* TODO: error check? ran out of data? other side closed? */
 }
 
+/*
+ * Records go to the analysis mode instead of stdout. They are still read into
+ * the ring, oldest dropped to make room, so there is a recent history for
+ * ngp_history(). In this mode every source has its own ng_pcap(4), snooped to
+ * `pcapN', and the hook a datagram came in on says which source it is.
+ */
+static void
+drop_oldest(struct ring32 *ring, size_t want)
+{
+	uint32_t caplen;
+	uint8_t *rec;
+
+	while (ring32_free(ring) < want) {
+		rec = ring32_write_buffer(ring, NULL);
+		memcpy(&caplen, rec + 8, sizeof(caplen));
+		(void) ring32_write_advance(ring, PCAP_RECHDR_LEN + caplen);
+	}
+}
+
+static void
+mode_event(int fd, struct ring32 *ring)
+{
+	size_t count;
+	ssize_t rc;
+	uint8_t *buf;
+	uint32_t hdr[4];
+	union {
+		struct sockaddr_ng	sg;
+		char			buf[sizeof(struct sockaddr_ng) + NG_HOOKSIZ];
+	} from;
+	socklen_t fromlen;
+	struct ngp_record rec;
+
+	for (;;) {
+		drop_oldest(ring, G.snaplen + PCAP_RECHDR_LEN);
+		buf = ring32_read_buffer(ring, &count);
+		fromlen = sizeof(from);
+		rc = recvfrom(fd, buf, count, 0, (struct sockaddr *)&from,
+		    &fromlen);
+		if (rc == -1 && errno == EAGAIN)
+			break;
+		if (rc == -1) err(
+			ERRALT(EX_OSERR), "unable to read from ng_pcap(4)"
+		);
+
+		if (ngp_file_header(buf, rc)) {
+			ngp_fix_file_header(buf, G.snaplen);
+			memcpy(G.filehdr, buf, sizeof(G.filehdr));
+			memcpy(hdr, buf, sizeof(hdr[0]));
+			G.nsec = (hdr[0] == PCAP_MAGIC_NSEC);
+			G.nheaders++;
+			continue;
+		}
+		if (rc < PCAP_RECHDR_LEN)
+			continue; /* can't be anything we know */
+
+		memcpy(hdr, buf, sizeof(hdr));
+		rec.src = atoi(from.sg.sg_data + strlen("pcap"));
+		if (rec.src < 0 || rec.src >= G.nsrcs)
+			continue;
+		rec.nsec = hdr[0] * 1000000000ULL +
+		    (G.nsec ? hdr[1] : hdr[1] * 1000ULL);
+		rec.caplen = MIN(hdr[2], rc - PCAP_RECHDR_LEN);
+		rec.len = hdr[3];
+		rec.data = buf + PCAP_RECHDR_LEN;
+		G.mode->packet(&rec);
+
+		/* the ring has to stay walkable by drop_oldest() */
+		memcpy(buf + 8, &rec.caplen, sizeof(rec.caplen));
+
+		(void) ring32_read_advance(ring, PCAP_RECHDR_LEN + rec.caplen);
+	}
+}
+
+/* the records still in the ring, as a pcap(3) file */
+int
+ngp_history(FILE *fp)
+{
+	size_t count;
+	uint8_t *recs;
+
+	if (G.offline != NULL)
+		return ngp_offline_history(fp);
+	if (G.nheaders == 0)
+		return (0); /* nothing ever arrived */
+	recs = ring32_write_buffer(&G.buffer, &count);
+	if (fwrite(G.filehdr, sizeof(G.filehdr), 1, fp) != 1)
+		return (-1);
+	if (count != 0 && fwrite(recs, count, 1, fp) != 1)
+		return (-1);
+	return (0);
+}
+
+/* for a mode that wants to print something every so often */
+void
+ngp_tick(unsigned msec)
+{
+	G.tick = msec;
+}
+
+static void
+tick_event(int _, struct ring32 *ring)
+{
+	G.mode->tick();
+}
+
+/*
+ * Signals we would die from are ignored and arrive here through kqueue(2)
+ * instead, so links we spliced into get put back before we exit.
+ */
+static const int signals[] = { SIGHUP, SIGINT, SIGPIPE, SIGTERM };
+
+static void
+signal_event(int sig, struct ring32 *ring)
+{
+	if (G.mode != NULL)
+		G.mode->fini();
+	err_cleanup(sig);
+	exit(0);
+}
+
+/* with -T the threads have the records, `ring' isn't used */
+static void
+output_event(int _, struct ring32 *ring)
+{
+	if (ngp_workers_output(STDOUT_FILENO) == -1) {
+		/* tcpdump(1) went away, probably CTRL-C */
+		if (errno == EPIPE)
+			signal_event(SIGPIPE, ring);
+		err(ERRALT(EX_IOERR), "unable to write to stdout");
+	}
+}
+
+/*
+ * write(2) to stdout stops wherever it likes, -H has to know where records
+ * start. The ring begins with the file header, then it is all records.
+ */
+static uint32_t
+record_len(struct ring32 *ring, uint32_t at)
+{
+	uint32_t caplen;
+
+	if (!G.hdr_out)
+		return (PCAP_FILEHDR_LEN);
+	memcpy(&caplen, &ring->maps.data[(at + 8) & ring->mask],
+	    sizeof(caplen));
+	return (PCAP_RECHDR_LEN + caplen);
+}
+
+static void
+track_records(struct ring32 *ring)
+{
+	uint32_t len;
+
+	while (G.boundary != ring->index.end &&
+	    ring->index.start - G.boundary >= (len = record_len(ring,
+	    G.boundary))) {
+		G.boundary += len;
+		G.hdr_out = true;
+	}
+}
+
 static void
 write_event(int fd, struct ring32 *ring)
 {
@@ -303,24 +608,411 @@ write_event(int fd, struct ring32 *ring)
 			write(fd, ring32_write_buffer(&G.buffer, &count), count)
 		);
 	} while(rc == -1 && errno == EAGAIN);
+	track_records(ring);
+
+	/* tcpdump(1) went away, probably CTRL-C */
+	if (rc == -1 && errno == EPIPE)
+		signal_event(SIGPIPE, ring);
+}
+
+/*
+ * A new ngpcap connected to -H. Our stdout gets the rest of the record it is
+ * in the middle of, and the file header if that is still in the ring, so it
+ * ends as a whole file. Everything after that is the successor's.
+ */
+static void
+handover_event(int fd, struct ring32 *ring)
+{
+	int flags, fds[NGP_HANDOVER_NFDS] = { G.ctrl, G.data, ring->shm };
+	uint32_t left;
+	struct ngp_handover h = {
+		.magic = NGP_HANDOVER_MAGIC,
+		.snaplen = G.snaplen,
+		.nheaders = G.nheaders,
+		.npcap = G.npcap,
+		.ntees = G.ntees,
+	};
+
+	if (ring->index.start != G.boundary ||
+	    (!G.hdr_out && !ring32_empty(ring))) {
+		left = G.boundary + record_len(ring, G.boundary) -
+		    ring->index.start;
+		flags = fcntl(STDOUT_FILENO, F_GETFL);
+		if (flags == -1 || fcntl(STDOUT_FILENO, F_SETFL,
+		    flags & ~O_NONBLOCK) == -1 || ngp_write_all(STDOUT_FILENO,
+		    ring32_write_buffer(ring, NULL), left) == -1)
+			warn("handover: unable to finish the last record");
+		(void) ring32_write_advance(ring, left);
+		track_records(ring);
+		set_nonblocking(STDOUT_FILENO);
+	}
+
+	h.start = ring->index.start;
+	h.end = ring->index.end;
+	memcpy(h.filehdr, G.filehdr, sizeof(h.filehdr));
+	if (ngp_handover_send(fd, &h, fds, G.pcaps, G.tees) == -1) {
+		if (errno != EAGAIN && errno != ECONNABORTED)
+			warn("handover to a new " ME " failed, still running");
+		return;
+	}
 
-	/* TODO: must be a pipe condition when tcpdump dies from CTRL-C */
+	G.handed = true;
+	err_cleanup(0);
+	exit(0);
+}
+
+static void
+add_src(const char *node, const char *hook, enum pkt_type pkt,
+    int32_t snaplen, const char *label)
+{
+	struct ngp_source *src;
+
+	G.srcs = reallocf(G.srcs, (G.nsrcs + 1) * sizeof(*G.srcs));
+	if (G.srcs == NULL) err(
+		ERRALT(EX_OSERR), "unable to allocate sources"
+	);
+	src = &G.srcs[G.nsrcs++];
+	src->pkt = pkt;
+	src->snaplen = snaplen;
+	strlcpy(src->node, node, sizeof(src->node));
+	strlcpy(src->hook, hook, sizeof(src->hook));
+	strlcpy(src->label, label, sizeof(src->label));
+}
+
+/*
+ * Both taps of a tee we spliced into `node:hook' are sources. `left' is
+ * on node, so left2right is what node sends and right2left what it gets.
+ */
+static void
+add_tee(ng_ID_t tee, const char *node, const char *hook, enum pkt_type pkt,
+    int32_t snaplen)
+{
+	char teenode[NG_NODESIZ];
+	char label[sizeof(((struct ngp_source *)0)->label)];
+
+	G.tees = reallocf(G.tees, (G.ntees + 1) * sizeof(*G.tees));
+	if (G.tees == NULL) err(
+		ERRALT(EX_OSERR), "unable to allocate tees"
+	);
+	G.tees[G.ntees++] = tee;
+
+	snprintf(teenode, sizeof(teenode), "[%08x]", tee);
+	snprintf(label, sizeof(label), "%s:%s out", node, hook);
+	add_src(teenode, NG_TEE_HOOK_LEFT2RIGHT, pkt, snaplen, label);
+	snprintf(label, sizeof(label), "%s:%s in", node, hook);
+	add_src(teenode, NG_TEE_HOOK_RIGHT2LEFT, pkt, snaplen, label);
+}
+
+/*
+ * ng_iface(4) names its hooks after the protocol they carry, anything else
+ * we run into is assumed to be ethernet.
+ */
+static int
+infer_type(const struct nodeinfo *ninfo, const struct linkinfo *link,
+    enum pkt_type *pkt)
+{
+	const char *hook;
+
+	if (strcmp(ninfo->type, "iface") == 0)
+		hook = link->ourhook;
+	else if (strcmp(link->nodeinfo.type, "iface") == 0)
+		hook = link->peerhook;
+	else {
+		*pkt = PKT_ETHER;
+		return (0);
+	}
+
+#	ifdef INET
+	if (strcmp(hook, HOOK_PKT_INET) == 0) {
+		*pkt = PKT_INET4;
+		return (0);
+	}
+#	endif
+#	ifdef INET6
+	if (strcmp(hook, HOOK_PKT_INET6) == 0) {
+		*pkt = PKT_INET6;
+		return (0);
+	}
+#	endif
+	return (-1);
+}
+
+/* `node:*' splices into every link of node, from one list of its hooks */
+static void
+expand(const struct pcap_spec *ps)
+{
+	uint32_t ix;
+	ng_ID_t tee;
+	enum pkt_type pkt;
+	struct hooklist *hlist;
+	struct ng_reply resp = NG_REPLY_INIT(NULL, 0);
+
+	hlist = ngp_listhooks(G.ctrl, &G.nodes, ps->node, &resp);
+	if (hlist->nodeinfo.hooks == 0)
+		warnx("`%s:' has no hooks to capture", ps->node);
+
+	for (ix = 0; ix < hlist->nodeinfo.hooks; ix++) {
+		const struct linkinfo *link = &hlist->link[ix];
+
+		pkt = ps->pkt;
+		if (ps->infer && infer_type(&hlist->nodeinfo, link, &pkt) != 0) {
+			warnx("`%s:%s': unknown layer, skipped", ps->node,
+			    link->ourhook);
+			continue;
+		}
+		tee = ngp_splice_link(G.ctrl, &hlist->nodeinfo, link);
+		if (tee != 0)
+			add_tee(tee, ps->node, link->ourhook, pkt, ps->snaplen);
+	}
+	ng_reply_fini(&resp);
+}
+
+static void
+register_signals(void)
+{
+	int ix;
+	struct kevent sevt;
+
+	for (ix = 0; ix < nitems(signals); ix++) {
+		EV_SET(&sevt, signals[ix], EVFILT_SIGNAL, EV_ADD, 0, 0,
+		    signal_event);
+		if (kevent(G.kq, &sevt, 1, NULL, 0, NULL) == -1) err(
+			ERRALT(EX_OSERR), ": kevent failed to register signal"
+		);
+	}
+}
+
+/*
+ * With -T the threads in workers.c read the sources, each into a ring of its
+ * own. All that is left here is writing their records to stdout, which stays
+ * blocking, and the signals.
+ */
+static void
+run_threads(int32_t snaplen)
+{
+	int ix, rc;
+	struct kevent evt, ready[1 + nitems(signals)];
+
+	G.kq = kqueue();
+	if (G.kq == -1) err(
+		ERRALT(EX_OSERR), "kqueue: unable to create"
+	);
+
+	/* before the threads, they trigger it */
+	EV_SET(&evt, NGP_WORKER_EVENT, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0,
+	    output_event);
+	if (kevent(G.kq, &evt, 1, NULL, 0, NULL) == -1) err(
+		ERRALT(EX_OSERR), ": kevent failed to register events"
+	);
+	register_signals();
+
+	ngp_workers_init(G.nthreads, G.srcs, G.nsrcs, snaplen,
+	    calc_lgpages(snaplen * 3), G.kq);
+
+	for (;;) {
+		do {
+			rc = kevent(G.kq, NULL, 0, ready, nitems(ready), NULL);
+		} while (rc == -1 && errno == EINTR);
+		if (rc == -1) err(
+			ERRALT(EX_OSERR), ": kevent loop failed"
+		);
+
+		for (ix = 0; ix < rc; ix++) {
+			void (*process)(int, struct ring32 *) = ready[ix].udata;
+			process(ready[ix].ident, NULL);
+		}
+	}
+}
+
+/*
+ * Reading `G.data' into `G.buffer', for stdout or a mode, until a signal.
+ */
+static void
+run(void)
+{
+	int ix, rc;
+	struct kevent evt[2];
+
+	set_nonblocking(G.data);
+	if (G.mode == NULL)
+		set_nonblocking(STDOUT_FILENO);
+	else
+		setvbuf(stdout, NULL, _IOLBF, BUFSIZ);
+
+	G.kq = kqueue();
+	if (G.kq == -1) err(
+		ERRALT(EX_OSERR), "kqueue: unable to create"
+	);
+
+	EV_SET(&evt[0], G.data, EVFILT_READ, EV_ADD, 0, 0,
+	    (G.mode != NULL) ? mode_event : read_event);
+	EV_SET(&evt[1], STDOUT_FILENO, EVFILT_WRITE, EV_ADD, 0, 0, write_event);
+
+	/* register events, leave disabled. stdout is not ours with a mode */
+	do {
+		rc = kevent(G.kq, evt, (G.mode != NULL) ? 1 : 2, NULL, 0, NULL);
+	} while(rc == -1 && errno == EINTR);
+	if (rc == -1) err(
+		ERRALT(EX_OSERR), ": kevent failed to register events"
+	);
+
+	register_signals();
+
+	if (G.tick != 0) {
+		struct kevent tevt;
+
+		EV_SET(&tevt, 0, EVFILT_TIMER, EV_ADD, 0, G.tick, tick_event);
+		if (kevent(G.kq, &tevt, 1, NULL, 0, NULL) == -1) err(
+			ERRALT(EX_OSERR), ": kevent failed to register timer"
+		);
+	}
+
+	if (G.listen != -1) {
+		struct kevent levt;
+
+		EV_SET(&levt, G.listen, EVFILT_READ, EV_ADD, 0, 0,
+		    handover_event);
+		if (kevent(G.kq, &levt, 1, NULL, 0, NULL) == -1) err(
+			ERRALT(EX_OSERR), ": kevent failed to register handover"
+		);
+	}
+
+	evt[0].flags &= ~(EV_ADD); /* won't be adding any more */
+	evt[1].flags &= ~(EV_ADD);
+
+	do {
+		struct kevent ready[4 + nitems(signals)];
+		struct kevent *chg = evt;
+		int nchg = nitems(evt);
+
+		/*
+		 * Order matters as EVREAD is evt[0]. If we can't read we
+		 * advance chgs to point to evt[1]. Only read if there is at
+		 * least `snaplen' bytes free.
+		 */
+		if (G.mode != NULL || ring32_free(&G.buffer) >= G.snaplen) {
+			evt[0].flags |= (EV_ENABLE | EV_DISPATCH);
+		} else {
+			chg++; /* not altering read */
+			nchg--;
+		}
+		if (G.mode == NULL && !ring32_empty(&G.buffer)) {
+			evt[1].flags |= (EV_ENABLE | EV_DISPATCH);
+		} else {
+			nchg--;
+		}
+		assert(nchg != 0); /* can't be full & empty */
+
+		do {
+			rc = kevent(G.kq, chg, nchg, ready, nitems(ready), NULL);
+		} while (rc == -1 && errno == EINTR);
+		if (rc == -1) err(
+			ERRALT(EX_OSERR), ": kevent loop failed"
+		);
+
+		for (ix=0; ix < rc; ix++) {
+			void (*process)(int, struct ring32 *) = ready[ix].udata;
+			process(ready[ix].ident, &G.buffer);
+		}
+	} while (1);
+}
+
+/*
+ * -H without specs. Everything comes from the ngpcap listening there, nothing
+ * is created, and once it lets go of it all we listen there ourselves.
+ */
+static void
+take_over(void)
+{
+	int s, fds[NGP_HANDOVER_NFDS];
+	size_t ix;
+	struct ngp_handover h;
+
+	for (ix = 0; ix < nitems(signals); ix++)
+		(void) signal(signals[ix], SIG_IGN);
+
+	s = ngp_handover_recv(G.handover, &h, fds, &G.pcaps, &G.tees);
+	G.ctrl = fds[0];
+	G.data = fds[1];
+	if (ring32_attach(&G.buffer, fds[2], h.start, h.end) == -1) err(
+		ERRALT(EX_OSERR), "unable to take over buffer"
+	);
+	G.snaplen = h.snaplen;
+	G.nheaders = h.nheaders;
+	memcpy(G.filehdr, h.filehdr, sizeof(G.filehdr));
+	G.boundary = h.start;
+
+	/* our stdout is a new file, the ring has records only */
+	if (G.nheaders > 0) {
+		if (ngp_write_all(STDOUT_FILENO, G.filehdr,
+		    sizeof(G.filehdr)) == -1) err(
+			ERRALT(EX_IOERR), "unable to write to stdout"
+		);
+		G.hdr_out = true;
+	}
+
+	/* up to here a failure leaves the old one running, now it's ours */
+	ngp_handover_done(s);
+	G.npcap = h.npcap;
+	G.ntees = h.ntees;
+	err_set_exit(err_cleanup);
+
+	G.listen = ngp_handover_listen(G.handover);
+	run(); /* doesn't return */
+}
+
+/*
+ * -r, the file goes through the mode or to stdout, with no netgraph(4) at all.
+ * There is one source and it is the file.
+ */
+static void
+read_offline(char *mode, int32_t snaplen, int nthreads, int argc)
+{
+	ssize_t history = 0;
+
+	if (argc > 0 || G.handover != NULL) Usage(
+		ME ": -r takes no specifications and can't be used with -H\n\n"
+	);
+
+	add_src("", "", PKT_ETHER, snaplen, G.offline);
+	if (G.mode != NULL &&
+	    (history = G.mode->init(mode, G.srcs, G.nsrcs)) == -1) Usage(
+		"\n" /* already used warn(3) parsing */
+	);
+
+	ngp_offline(G.offline, snaplen, nthreads, G.mode, G.tick,
+	    MAX(snaplen * 3, history));
+	if (G.mode != NULL)
+		G.mode->fini();
+	exit(EX_OK);
 }
 
 int
 main(int argc, char **argv)
 {
-	int ch, ix, rc = 0, jid = 0, load_kmod = 1;
+	int ch, ix, rc = 0, jid = 0, load_kmod = 1, per, nthreads = 1;
+	ng_ID_t tee;
+	ssize_t history = 0;
 	int32_t snaplen = NG_PACP_MAX_SNAPLEN; /* same default as tcpdump */
 	const char *jail = NULL;
-	struct kevent evt[2];
-	struct pcap_spec intercepts[NG_PCAP_MAX_LINKS];
+	char *mode = NULL;
+	struct pcap_spec *intercepts;
 
 	setvbuf(stdout, NULL, _IONBF, BUFSIZ);
 
 	/* use getopt_long so they can place options anywhere */
-	while ((ch = getopt_long(argc, argv, ":nj:s:", NULL, NULL)) != -1) {
+	while ((ch = getopt_long(argc, argv, ":nH:j:m:r:s:T:", NULL, NULL)) != -1) {
 		switch (ch) {
+		case 'm':
+			mode = optarg;
+			G.mode = ngp_mode_find(strsep(&mode, ","));
+			if (G.mode == NULL) Usage(
+				ME ": unknown mode `%s'\n\n", optarg
+			);
+			break;
+		case 'H':
+			G.handover = optarg;
+			break;
 		case 'j':
 			jail = optarg;
 			if (strlen(jail) > MAXHOSTNAMELEN) Usage(
@@ -331,6 +1023,9 @@ main(int argc, char **argv)
 		case 'n':
 			load_kmod = 0; /* user asked not to */
 			break;
+		case 'r':
+			G.offline = optarg;
+			break;
 		case 's':
 		    {
 			char *ep;
@@ -353,6 +1048,18 @@ main(int argc, char **argv)
 			}
 			break;
 		    }
+		case 'T':
+		    {
+			char *ep;
+
+			nthreads = strtol(optarg, &ep, 10);
+			if (*ep != '\0' || nthreads < 1 ||
+			    nthreads > NGP_MAX_THREADS) Usage(
+				ME ": threads must be in [1,%d]: \"%s\"\n\n",
+				NGP_MAX_THREADS, optarg
+			);
+			break;
+		    }
 		default:
 			Usage(
 				ME ": unrecognized option `%s'\n\n",
@@ -363,12 +1070,23 @@ main(int argc, char **argv)
 	argv += optind;
 	argc -= optind;
 
-	if ( argc < 1) Usage(
+	if (G.offline != NULL)
+		read_offline(mode, snaplen, nthreads, argc); /* doesn't return */
+	if ( argc < 1 && G.handover == NULL) Usage(
 		ME ": must minimally provide one pcap specification\n\n"
 	);
-	if (argc > NG_PCAP_PKT_TYPE_LENGTH) Usage(
-		ME ": can have at most " STRFY(NG_PCAP_PKT_TYPE_LENGTH)
-		" pcap specifications\n\n"
+	/* modes keep their state for one thread */
+	if (G.mode != NULL && nthreads > 1) Usage(
+		ME ": -m and -T can't be used together\n\n"
+	);
+	/* only a ring and stdout can be handed over */
+	if (G.handover != NULL && (G.mode != NULL || nthreads > 1)) Usage(
+		ME ": -H can't be used with -m or -T\n\n"
+	);
+	if (argc < 1)
+		take_over(); /* doesn't return */
+	if ((intercepts = calloc(argc, sizeof(*intercepts))) == NULL) err(
+		ERRALT(EX_OSERR), "unable to allocate specifications"
 	);
 
 	for (ix = 0; ix < argc; ix++) {
@@ -399,81 +1117,81 @@ main(int argc, char **argv)
 		);
 	}
 
-	if (ring32_init(&G.buffer, calc_lgpages(snaplen * 3)) == -1) err(
-		ERRALT(EX_OSERR), "unable to initialize buffer"
-	); else
-		err_set_exit(err_cleanup);
+	err_set_exit(err_cleanup);
+
+	for (ix = 0; ix < nitems(signals); ix++)
+		(void) signal(signals[ix], SIG_IGN);
 
 	ng_create_context(&G.ctrl, &G.data);
 
 	for (ix = 0; ix < argc; ix++) {
-		G.pcap = ngp_connect_src(
-			G.ctrl, G.pcap, (uint8_t)ix,
-			intercepts[ix].node,
-			intercepts[ix].hook
-		);
-		ngp_set_type(G.ctrl, G.pcap, (uint8_t)ix, intercepts[ix].pkt);
+		struct pcap_spec *ps = &intercepts[ix];
+		char label[sizeof(G.srcs->label)];
+
+		if (ps->snaplen == 0)
+			ps->snaplen = snaplen;
+		if (strcmp(ps->hook, "*") == 0) {
+			expand(ps);
+		} else if (ps->splice) {
+			tee = ngp_splice(G.ctrl, &G.nodes, ps->node, ps->hook);
+			add_tee(tee, ps->node, ps->hook, ps->pkt, ps->snaplen);
+		} else {
+			snprintf(label, sizeof(label), "%s:%s", ps->node,
+			    ps->hook);
+			add_src(ps->node, ps->hook, ps->pkt, ps->snaplen, label);
+		}
 	}
-	ngp_set_snaplen(G.ctrl, G.pcap, snaplen); /* must be before snoop */
-	ngp_connect_snp(G.ctrl, G.pcap, ".", "pcap");
-
-	set_nonblocking(G.data);
-	set_nonblocking(STDOUT_FILENO);
-
-	G.kq = kqueue();
-	if (G.kq == -1) err(
-		ERRALT(EX_OSERR), "kqueue: unable to create"
+	free(intercepts);
+	ng_cache_fini(&G.nodes);
+	if (G.nsrcs == 0) errx(
+		EX_DATAERR, "nothing to capture"
 	);
 
-	EV_SET(&evt[0], G.data, EVFILT_READ, EV_ADD, 0, 0, read_event);
-	EV_SET(&evt[1], STDOUT_FILENO, EVFILT_WRITE, EV_ADD, 0, 0, write_event);
-
-	/* register events, leave disabled */
-	do {
-		rc = kevent(G.kq, evt, nitems(evt), NULL, 0, NULL);
-	} while(rc == -1 && errno == EINTR);
-	if (rc == -1) err(
-		ERRALT(EX_OSERR), ": kevent failed to register events"
+	/* from here on `snaplen' is the largest record there can be */
+	for (snaplen = ix = 0; ix < G.nsrcs; ix++)
+		snaplen = MAX(snaplen, G.srcs[ix].snaplen);
+	G.snaplen = snaplen;
+	G.nthreads = MIN(nthreads, G.nsrcs);
+	if (G.nthreads > 1)
+		run_threads(snaplen); /* doesn't return */
+
+	if (G.mode != NULL &&
+	    (history = G.mode->init(mode, G.srcs, G.nsrcs)) == -1) Usage(
+		"\n" /* already used warn(3) parsing */
 	);
 
-	evt[0].flags &= ~(EV_ADD); /* won't be adding any more */
-	evt[1].flags &= ~(EV_ADD);
+	if (ring32_init(&G.buffer,
+	    calc_lgpages(MAX(snaplen * 3, history))) == -1) err(
+		ERRALT(EX_OSERR), "unable to initialize buffer"
+	);
 
-	do {
-		struct kevent ready[2];
-		struct kevent *chg = evt;
-		int nchg = nitems(evt);
+	/*
+	 * As many ng_pcap(4) as it takes, all snooped to our data socket. A
+	 * mode needs to know where a record came from, so each source gets
+	 * its own.
+	 */
+	per = (G.mode != NULL) ? 1 : NG_PCAP_MAX_LINKS;
+	if ((G.pcaps = calloc(G.nsrcs, sizeof(*G.pcaps))) == NULL) err(
+		ERRALT(EX_OSERR), "unable to allocate %d ng_pcap", G.nsrcs
+	);
+	/*
+	 * Not a dead store: when ngp_connect_srcs() fails it exits, and
+	 * err_cleanup reads `npcap' from inside it. Until it returns every
+	 * slot is one to shut down, those it didn't get to are still 0.
+	 */
+	G.npcap = G.nsrcs;
+	G.npcap = ngp_connect_srcs(G.ctrl, G.srcs, G.nsrcs, 1, per, G.pcaps);
 
-		/*
-		 * Order matters as EVREAD is evt[0]. If we can't read we
-		 * advance chgs to point to evt[1]. Only read if there is at
-		 * least `snaplen' bytes free.
-		 */
-		if (ring32_free(&G.buffer) >= snaplen) {
-			evt[0].flags |= (EV_ENABLE | EV_DISPATCH);
-		} else {
-			chg++; /* not altering read */
-			nchg--;
-		}
-		if (!ring32_empty(&G.buffer)) {
-			evt[1].flags |= (EV_ENABLE | EV_DISPATCH);
-		} else {
-			nchg--;
-		}
-		assert(ix != 0); /* can't be full & empty */
+	for (ix = 0; ix < G.npcap; ix++) {
+		char hook[NG_HOOKSIZ];
 
-		do {
-			rc = kevent(G.kq, chg, nchg, ready, 2, NULL);
-		} while (rc == -1 && errno == EINTR);
-		if (rc == -1) err(
-			ERRALT(EX_OSERR), ": kevent loop failed"
-		);
+		snprintf(hook, sizeof(hook), "pcap%d", ix);
+		ngp_connect_snp(G.ctrl, G.pcaps[ix], ".", hook);
+	}
 
-		for (ix=0; ix < rc; ix++) {
-			void (*process)(int, struct ring32 *) = ready[ix].udata;
-			process(ready[ix].ident, &G.buffer);
-		}
-	} while (1);
+	if (G.handover != NULL)
+		G.listen = ngp_handover_listen(G.handover);
+	run(); /* doesn't return */
 
 	return (0);
 }
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <assert.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#include "ngpcap.h"
+
+
+static const struct ngp_mode *modes[] = {
+	&ngp_burst,
+	&ngp_tcp,
+	&ngp_dns,
+	&ngp_csum,
+	&ngp_transit,
+	&ngp_circular,
+	&ngp_trace,
+};
+
+const struct ngp_mode *
+ngp_mode_find(const char *name)
+{
+	size_t ix;
+
+	for (ix = 0; ix < nitems(modes); ix++)
+		if (strcmp(modes[ix]->name, name) == 0)
+			return (modes[ix]);
+	return (NULL);
+}
+
+void
+ngp_mode_usage(FILE *fp)
+{
+	size_t ix;
+
+	for (ix = 0; ix < nitems(modes); ix++)
+		(void) fprintf(fp, "\t%s\t%s\n", modes[ix]->name,
+		    modes[ix]->usage);
+}
+
+/* a numeric sub-option, warns and returns -1 when it isn't in [min,max] */
+int
+ngp_mode_number(const char *mode, const char *name, const char *value,
+    unsigned long min, unsigned long max, unsigned long *result)
+{
+	char *ep;
+
+	if (value == NULL || *value == '\0') {
+		warnx("%s: `%s' needs a value", mode, name);
+		return (-1);
+	}
+	*result = strtoul(value, &ep, 10);
+	if (*ep != '\0' || *result < min || *result > max) {
+		warnx("%s: `%s' must be in [%lu,%lu]: \"%s\"", mode, name, min,
+		    max, value);
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Every sub-option in `subopts', by `opts'. Warns about each one that is
+ * wrong, not just the first, and returns -1 if any was.
+ */
+int
+ngp_mode_opts(const char *mode, char *subopts, const struct ngp_mode_opt *opts,
+    size_t nopts)
+{
+	int opt, rc = 0;
+	size_t ix;
+	char *names[NGP_MODE_MAXOPTS + 1], *name, *value;
+
+	assert(nopts <= NGP_MODE_MAXOPTS);
+	for (ix = 0; ix < nopts; ix++)
+		names[ix] = __DECONST(char *, opts[ix].name);
+	names[nopts] = NULL;
+
+	while (subopts != NULL && *subopts != '\0') {
+		/* `value' is NULL for an unknown one without `=' */
+		name = subopts;
+		opt = getsubopt(&subopts, names, &value);
+		if (opt == -1) {
+			warnx("%s: unknown sub-option `%s'", mode, name);
+			rc = -1;
+		} else if (opts[opt].string == NULL) {
+			if (ngp_mode_number(mode, opts[opt].name, value,
+			    opts[opt].min, opts[opt].max, opts[opt].number) != 0)
+				rc = -1;
+		} else if (value == NULL || *value == '\0') {
+			warnx("%s: `%s' needs a value", mode, opts[opt].name);
+			rc = -1;
+		} else
+			*opts[opt].string = value;
+	}
+	return (rc);
+}
+
+/* slots for `want' keys, a power of 2 so a hash can be masked */
+uint32_t
+ngp_table_size(unsigned long want)
+{
+	uint32_t n;
+
+	for (n = NGP_PROBE; n < want; n <<= 1)
+		;
+	return (n);
+}
+
+int
+ngp_table_init(struct ngp_table *t, unsigned long want, size_t size)
+{
+	uint32_t n = ngp_table_size(want);
+
+	t->slots = calloc(n, size);
+	if (t->slots == NULL)
+		return (-1);
+	t->size = size;
+	t->mask = n - 1;
+	return (0);
+}
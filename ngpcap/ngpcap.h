@@ -7,8 +7,11 @@
 #include <errno.h>
 #include <netgraph.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
 
 #include "common.h"
+#include "parse.h"
 
 
 enum pkt_type {
@@ -25,3 +28,265 @@ void	ngp_set_snaplen(ngctx, ng_ID_t, int32_t);
 ng_ID_t	ngp_connect_src(ngctx, ng_ID_t, uint8_t, const char *, const char *);
 ng_ID_t	ngp_connect_snp(ngctx, ng_ID_t, const char *, const char *);
 void	ngp_set_type(ngctx, ng_ID_t, uint8_t, enum pkt_type);
+
+/* splice.c */
+struct hooklist	*ngp_listhooks(ngctx, struct ng_cache *, const char *,
+		    struct ng_reply *);
+ng_ID_t	ngp_splice_link(ngctx, const struct nodeinfo *, const struct linkinfo *);
+ng_ID_t	ngp_splice(ngctx, struct ng_cache *, const char *, const char *);
+
+/*
+ * Where ng_pcap(4) connects `sourceN', plus a name for people. Sources that are
+ * a tee we spliced in say which way the packets go.
+ */
+struct ngp_source {
+	enum pkt_type	pkt;
+	int32_t		snaplen;
+	char		node[NG_NODESIZ];
+	char		hook[NG_HOOKSIZ];
+	char		label[NG_NODESIZ + NG_HOOKSIZ + 4];
+};
+
+/* pcap.c */
+int	ngp_connect_srcs(ngctx, const struct ngp_source *, int, int, int,
+	    ng_ID_t *);
+
+/*
+ * Analysis modes (-m) get every record instead of stdout getting it. Each
+ * source has an ng_pcap(4) of its own so records can be told apart.
+ *
+ * `init' gets the sub-options (NULL if none) and returns -1 after warning
+ * about bad ones. Otherwise it returns how many bytes of the most recent
+ * records it wants kept around for ngp_history(), 0 for no preference. A
+ * mode with a `tick' asks for it to be called with ngp_tick().
+ */
+struct ngp_mode {
+	const char	*name;
+	const char	*usage;		/* its sub-options, for Usage() */
+	ssize_t		(*init)(char *, const struct ngp_source *, int);
+	void		(*packet)(const struct ngp_record *);
+	void		(*tick)(void);
+	void		(*fini)(void);
+};
+
+/* record times are nanoseconds */
+#define	NSEC_PER_USEC	((uint64_t)1000)
+#define	NSEC_PER_MSEC	((uint64_t)1000000)
+#define	NSEC_PER_SEC	((uint64_t)1000000000)
+
+/* a pcap(3) file header and the header of each record */
+#define	PCAP_FILEHDR_LEN	24
+#define	PCAP_RECHDR_LEN		16
+#define	PCAP_MAGIC		0xa1b2c3d4
+#define	PCAP_MAGIC_NSEC		0xa1b23c4d
+
+/* main.c */
+int	ngp_history(FILE *);
+void	ngp_tick(unsigned);
+bool	ngp_file_header(const void *, ssize_t);
+void	ngp_fix_file_header(void *, int32_t);
+
+/* workers.c, -T */
+#define	NGP_WORKER_EVENT	1	/* EVFILT_USER ident */
+#define	NGP_MAX_THREADS		64
+
+void	ngp_workers_init(int, const struct ngp_source *, int, int32_t, uint8_t,
+	    int);
+int	ngp_workers_output(int);
+int	ngp_write_all(int, const uint8_t *, size_t);
+void	ngp_workers_fini(ngctx);
+
+/*
+ * handover.c, -H. What a running ngpcap tells the one taking over, besides
+ * NGP_HANDOVER_NFDS descriptors: ctrl, data and its ring. `npcap' and `ntees'
+ * node IDs follow it on the socket.
+ */
+#define	NGP_HANDOVER_MAGIC	0x6e677031	/* "ngp1", change with layout */
+#define	NGP_HANDOVER_NFDS	3
+
+struct ngp_handover {
+	uint32_t	magic;
+	uint32_t	start;		/* ring indices, on a record */
+	uint32_t	end;
+	int32_t		snaplen;
+	int32_t		nheaders;
+	int32_t		npcap;
+	int32_t		ntees;
+	uint8_t		filehdr[PCAP_FILEHDR_LEN];
+};
+
+int	ngp_handover_listen(const char *);
+int	ngp_handover_send(int, const struct ngp_handover *, const int *,
+	    const ng_ID_t *, const ng_ID_t *);
+int	ngp_handover_recv(const char *, struct ngp_handover *, int *,
+	    ng_ID_t **, ng_ID_t **);
+void	ngp_handover_done(int);
+
+/*
+ * circular.c, a file used as a ring. This header is at its front, records
+ * are from `tail' to `head' or, once it went around, from `tail' to `wrap'
+ * and then from `data' to `head'. `index' has the offset of the first record
+ * in each segment of what is after `data', 0 if none.
+ */
+#define	NGP_CIRCULAR_MAGIC	0x6e677063	/* "ngpc", change with layout */
+#define	NGP_CIRCULAR_NSEG	256
+
+struct ngp_circular {
+	uint32_t	magic;
+	uint32_t	nseg;
+	uint64_t	size;		/* of the file */
+	uint64_t	data;
+	uint64_t	head;
+	uint64_t	tail;
+	uint64_t	wrap;		/* 0 until it went around */
+	uint8_t		filehdr[PCAP_FILEHDR_LEN];
+	uint64_t	index[NGP_CIRCULAR_NSEG];
+};
+
+int	ngp_circular_extents(const struct ngp_circular *, uint64_t,
+	    uint64_t [2][2]);
+
+/* offline.c, -r */
+void	ngp_offline(const char *, uint32_t, int, const struct ngp_mode *,
+	    unsigned, size_t);
+int	ngp_offline_history(FILE *);
+
+/* hist.c, nanoseconds in log-linear buckets for latency percentiles */
+#define	NGP_HIST_SUB	8
+#define	NGP_HIST_LEN	(62 * NGP_HIST_SUB)	/* up to 2^64 nsec */
+
+struct ngp_hist {
+	uint64_t	n;
+	uint64_t	max;
+	uint64_t	b[NGP_HIST_LEN];
+};
+
+void	ngp_hist_add(struct ngp_hist *, uint64_t);
+void	ngp_hist_merge(struct ngp_hist *, const struct ngp_hist *);
+uint64_t	ngp_hist_percentile(const struct ngp_hist *, unsigned);
+
+/*
+ * mode.c, and what the modes share. A sub-option is a number in [min,max]
+ * that goes to `*number', or with `string' any value but an empty one.
+ */
+struct ngp_mode_opt {
+	const char	*name;
+	unsigned long	min;
+	unsigned long	max;
+	unsigned long	*number;
+	const char	**string;
+};
+
+#define	NGP_MODE_MAXOPTS	8
+
+const struct ngp_mode	*ngp_mode_find(const char *);
+void	ngp_mode_usage(FILE *);
+int	ngp_mode_number(const char *, const char *, const char *,
+	    unsigned long, unsigned long, unsigned long *);
+int	ngp_mode_opts(const char *, char *, const struct ngp_mode_opt *,
+	    size_t);
+
+/*
+ * Flow tables, open addressing. A key is in one of the NGP_PROBE slots from
+ * where its hash says, so a lookup touches a cache line or two and a full
+ * table evicts rather than grows. A slot starts with that hash, never 0 as
+ * that is a free slot.
+ */
+#define	NGP_PROBE	8
+
+struct ngp_table {
+	void		*slots;
+	size_t		size;		/* of a slot */
+	uint32_t	mask;		/* slots - 1 */
+};
+
+enum ngp_found { NGP_FOUND = 0, NGP_FREE, NGP_FULL };
+
+uint32_t	ngp_table_size(unsigned long);
+int	ngp_table_init(struct ngp_table *, unsigned long, size_t);
+
+static __inline uint64_t
+ngp_mix(uint64_t h, uint64_t w)
+{
+	h ^= w;
+	h *= 0x9e3779b97f4a7c15ULL;
+	return (h ^ (h >> 29));
+}
+
+static __inline uint64_t
+ngp_hash_bytes(uint64_t h, const void *buf, size_t len)
+{
+	const uint8_t *p = buf;
+	uint64_t w;
+
+	for (; len >= sizeof(w); p += sizeof(w), len -= sizeof(w)) {
+		memcpy(&w, p, sizeof(w));
+		h = ngp_mix(h, w);
+	}
+	if (len != 0) {
+		w = (uint64_t)len << 56;
+		memcpy(&w, p, len);
+		h = ngp_mix(h, w);
+	}
+	return (h);
+}
+
+/* what goes in a slot, from all of a key that ngp_hash_bytes() was given */
+static __inline uint32_t
+ngp_slot_hash(uint64_t h)
+{
+	return ((uint32_t)(h >> 32) | 1);
+}
+
+/*
+ * The slot with `hash' that `match' says is `key' (NGP_FOUND), or else a
+ * free one for it (NGP_FREE), or else the oldest there is by `older' to be
+ * evicted for it (NGP_FULL). Without `older' a full table leaves `*slot'
+ * NULL. Inline so `match' and `older' are as well.
+ */
+static __inline enum ngp_found
+ngp_table_find(const struct ngp_table *t, uint32_t hash,
+    bool (*match)(const void *, const void *), const void *key,
+    bool (*older)(const void *, const void *), void **slot)
+{
+	uint32_t ix;
+	void *s, *empty = NULL, *oldest = NULL;
+
+	for (ix = 0; ix < NGP_PROBE; ix++) {
+		s = (uint8_t *)t->slots + ((hash + ix) & t->mask) * t->size;
+		if (*(uint32_t *)s == 0) {
+			if (empty == NULL)
+				empty = s;
+			continue;
+		}
+		if (*(uint32_t *)s == hash && match(s, key)) {
+			*slot = s;
+			return (NGP_FOUND);
+		}
+		if (older != NULL && (oldest == NULL || older(s, oldest)))
+			oldest = s;
+	}
+	*slot = (empty != NULL) ? empty : oldest;
+	return ((empty != NULL) ? NGP_FREE : NGP_FULL);
+}
+
+/* burst.c */
+extern const struct ngp_mode	ngp_burst;
+
+/* tcp.c */
+extern const struct ngp_mode	ngp_tcp;
+
+/* dns.c */
+extern const struct ngp_mode	ngp_dns;
+
+/* csum.c */
+extern const struct ngp_mode	ngp_csum;
+
+/* transit.c */
+extern const struct ngp_mode	ngp_transit;
+
+/* circular.c */
+extern const struct ngp_mode	ngp_circular;
+
+/* trace.c */
+extern const struct ngp_mode	ngp_trace;
@@ -0,0 +1,456 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <err.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/endian.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+
+#include "ngpcap.h"
+
+/*
+ * Offline (-r). A pcap(3) file goes through what ngpcap does live, -s and
+ * -m, at the speed of the disk rather than of a link.
+ *
+ * The file is mapped and cut into CHUNK_SIZE pieces, which threads (-T) take
+ * in turn. Each finds the first record starting in its piece and walks every
+ * record that starts there, which is what faults the piece in, so the reads
+ * happen on as many threads as there are. Trimmed to -s the records are
+ * copied out, otherwise what goes to stdout is the file as mapped. The main
+ * thread takes the pieces back in order, writes them or gives their records
+ * to the mode, and lets threads get at most WINDOW pieces ahead of it.
+ *
+ * Nothing in the middle of a file says where a record starts. A thread takes
+ * the first offset that reads as SYNC_RECORDS plausible records in a row, and
+ * the main thread checks that against where the walk of the piece before it
+ * ended. When they differ, which takes packet data that happens to look like
+ * a chain of record headers, the piece is walked again on the main thread from
+ * where it really starts. Only that walk, from the file header on, can say a
+ * file is damaged.
+ *
+ * Modes keep their state for one thread, they get every record from the main
+ * thread in file order. Their ticks come from capture time, not the clock.
+ *
+ * A ring written by the `circular' mode is read the same way, its records
+ * are in one or two extents of the file that the header at its front says.
+ */
+
+#define	CHUNK_SIZE	((size_t)32 << 20)
+#define	WINDOW(nw)	(2 * (nw))	/* pieces done ahead of the writer */
+#define	SYNC_RECORDS	4
+#define	LINKTYPE_ETHERNET 1
+
+struct chunk {
+	size_t		begin;		/* the piece of the file */
+	size_t		end;
+	size_t		limit;		/* the end of its extent */
+	bool		first;		/* `begin' is where the extent starts */
+	size_t		start;		/* its first record, `end' if none */
+	size_t		next;		/* the first record after it */
+	uint8_t		*out;		/* trimmed records, NULL when not */
+	size_t		outlen;
+	bool		bad;		/* a record didn't make sense */
+	bool		done;
+};
+
+static struct {
+	const uint8_t	*map;
+	size_t		size;
+	const uint8_t	*filehdr;
+	const char	*path;
+	bool		swapped;	/* not our byte order */
+	bool		nsec;
+	uint32_t	fsnaplen;	/* as the file header says */
+	uint32_t	snaplen;	/* -s */
+	bool		trim;
+	const struct ngp_mode *mode;
+	uint64_t	tick;		/* nsec of capture time, 0 none */
+	uint64_t	next_tick;
+	size_t		history;	/* bytes of records for ngp_history() */
+	size_t		hist;		/* the oldest of those */
+	size_t		hist_end;
+
+	struct chunk	*chunks;
+	size_t		nchunks;
+	size_t		take;		/* the next piece for a thread */
+	size_t		emit;		/* the next piece for the writer */
+	int		nw;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cv;
+} O = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.cv = PTHREAD_COND_INITIALIZER,
+};
+
+static __inline uint32_t
+field(const uint8_t *p, int ix)
+{
+	uint32_t v;
+
+	memcpy(&v, p + ix * sizeof(v), sizeof(v));
+	return (O.swapped ? bswap32(v) : v);
+}
+
+/* a header at `off' that could be a record, whole before `limit' */
+static bool
+plausible(size_t off, size_t limit)
+{
+	const uint8_t *p = O.map + off;
+	uint32_t caplen;
+
+	if (limit - off < PCAP_RECHDR_LEN)
+		return (false);
+	caplen = field(p, 2);
+	return (caplen <= O.fsnaplen && caplen <= field(p, 3) &&
+	    field(p, 1) < (O.nsec ? NSEC_PER_SEC : 1000000) &&
+	    limit - off - PCAP_RECHDR_LEN >= caplen);
+}
+
+/* what doesn't make sense at `off' only because the extent ends there */
+static bool
+cut_short(size_t off, size_t limit)
+{
+	uint32_t caplen;
+
+	if (limit - off < PCAP_RECHDR_LEN)
+		return (true);
+	caplen = field(O.map + off, 2);
+	return (caplen <= O.fsnaplen && caplen <= field(O.map + off, 3) &&
+	    limit - off - PCAP_RECHDR_LEN < caplen);
+}
+
+static size_t
+reclen(size_t off)
+{
+	return (PCAP_RECHDR_LEN + field(O.map + off, 2));
+}
+
+/* the first offset in the piece that a chain of records starts at */
+static size_t
+resync(const struct chunk *c)
+{
+	size_t off, at;
+	int n;
+
+	for (off = c->begin; off < c->end; off++) {
+		for (at = off, n = 0; n < SYNC_RECORDS && at < c->limit; n++) {
+			if (!plausible(at, c->limit))
+				break;
+			at += reclen(at);
+		}
+		/* a chain can end at the end of the extent too */
+		if (n == SYNC_RECORDS || at == c->limit)
+			return (off);
+	}
+	return (c->end);
+}
+
+static void
+walk(struct chunk *c, size_t from)
+{
+	size_t off, len, room = 0;
+	uint8_t *o;
+
+	c->start = from;
+	c->bad = false;
+	free(c->out);
+	c->out = NULL;
+	c->outlen = 0;
+	if (O.trim) {
+		room = c->end - c->begin + 2 * (O.snaplen + PCAP_RECHDR_LEN);
+		if ((c->out = malloc(room)) == NULL) {
+			c->bad = true;
+			return;
+		}
+	}
+
+	for (off = from; off < c->end && off < c->limit; off += len) {
+		if (!plausible(off, c->limit)) {
+			c->bad = !cut_short(off, c->limit);
+			break;
+		}
+		len = reclen(off);
+		if (!O.trim)
+			continue;
+
+		/* the header stays in the file's byte order */
+		o = c->out + c->outlen;
+		if (c->outlen + PCAP_RECHDR_LEN + O.snaplen > room) {
+			room *= 2;
+			if ((o = realloc(c->out, room)) == NULL) {
+				c->bad = true;
+				break;
+			}
+			c->out = o;
+			o = c->out + c->outlen;
+		}
+		memcpy(o, O.map + off, PCAP_RECHDR_LEN);
+		if (len - PCAP_RECHDR_LEN > O.snaplen) {
+			uint32_t caplen = O.swapped ? bswap32(O.snaplen) :
+			    O.snaplen;
+
+			memcpy(o + 8, &caplen, sizeof(caplen));
+			memcpy(o + PCAP_RECHDR_LEN, O.map + off +
+			    PCAP_RECHDR_LEN, O.snaplen);
+			c->outlen += PCAP_RECHDR_LEN + O.snaplen;
+		} else {
+			memcpy(o + PCAP_RECHDR_LEN, O.map + off +
+			    PCAP_RECHDR_LEN, len - PCAP_RECHDR_LEN);
+			c->outlen += len;
+		}
+	}
+	c->next = off;
+}
+
+static void *
+worker_main(void *arg)
+{
+	struct chunk *c;
+
+	for (;;) {
+		pthread_mutex_lock(&O.lock);
+		while (O.take < O.nchunks && O.take >= O.emit + WINDOW(O.nw))
+			pthread_cond_wait(&O.cv, &O.lock);
+		if (O.take == O.nchunks) {
+			pthread_mutex_unlock(&O.lock);
+			return (NULL);
+		}
+		c = &O.chunks[O.take++];
+		pthread_mutex_unlock(&O.lock);
+
+		walk(c, resync(c));
+
+		pthread_mutex_lock(&O.lock);
+		c->done = true;
+		pthread_cond_broadcast(&O.cv);
+		pthread_mutex_unlock(&O.lock);
+	}
+}
+
+/* the records of `c' to the mode, in order */
+static void
+feed(const struct chunk *c)
+{
+	struct ngp_record rec = { .src = 0 };
+	const uint8_t *p;
+	size_t off;
+
+	for (off = c->start; off < c->next; off += reclen(off)) {
+		p = O.map + off;
+		rec.nsec = field(p, 0) * NSEC_PER_SEC +
+		    (O.nsec ? field(p, 1) : field(p, 1) * 1000ULL);
+		rec.caplen = MIN(field(p, 2), O.snaplen);
+		rec.len = field(p, 3);
+		rec.data = p + PCAP_RECHDR_LEN;
+
+		if (O.tick != 0 && O.next_tick == 0)
+			O.next_tick = rec.nsec + O.tick;
+		for (; O.tick != 0 && rec.nsec >= O.next_tick;
+		    O.next_tick += O.tick)
+			O.mode->tick();
+
+		/* the last `history' bytes, whole records */
+		O.hist_end = off + reclen(off);
+		if (O.hist == 0)
+			O.hist = off;
+		while (O.hist_end - O.hist > O.history && O.hist < off)
+			O.hist += reclen(O.hist);
+
+		O.mode->packet(&rec);
+	}
+}
+
+/* the piece the main thread is at, whatever a thread made of it */
+static void
+finish(struct chunk *c, size_t expect)
+{
+	if (expect >= c->end) {
+		/* one record covers all of it */
+		free(c->out);
+		c->out = NULL;
+		c->start = c->next = expect;
+		c->outlen = 0;
+		return;
+	}
+	if (c->start != expect || c->bad)
+		walk(c, expect);
+	if (c->bad && c->out == NULL && O.trim) err(
+		ERRALT(EX_OSERR), "unable to allocate output"
+	);
+	if (c->bad) errx(
+		EX_DATAERR, "%s: damaged record at offset %zu", O.path,
+		c->next
+	);
+
+	if (O.mode != NULL)
+		feed(c);
+	else if (ngp_write_all(STDOUT_FILENO,
+	    O.trim ? c->out : O.map + c->start,
+	    O.trim ? c->outlen : c->next - c->start) == -1) err(
+		ERRALT(EX_IOERR), "unable to write to stdout"
+	);
+	free(c->out);
+	c->out = NULL;
+}
+
+/*
+ * The whole of `path' through `mode' (NULL for stdout) with `nw' threads.
+ * `tick' is in msec as ngp_tick() had it, `history' bytes are kept for
+ * ngp_history().
+ */
+void
+ngp_offline(const char *path, uint32_t snaplen, int nw,
+    const struct ngp_mode *mode, unsigned tick, size_t history)
+{
+	int fd, ix, rc, next;
+	size_t cx, expect;
+	struct stat sb;
+	uint32_t magic;
+	uint64_t ext[2][2];
+	uint8_t hdr[PCAP_FILEHDR_LEN];
+	pthread_t *threads;
+
+	O.path = path;
+	O.mode = mode;
+	O.tick = tick * NSEC_PER_MSEC;
+	O.history = history;
+
+	if ((fd = open(path, O_RDONLY)) == -1) err(
+		ERRALT(EX_NOINPUT), "unable to open `%s'", path
+	);
+	if (fstat(fd, &sb) == -1) err(
+		ERRALT(EX_IOERR), "unable to stat `%s'", path
+	);
+	O.size = sb.st_size;
+	if (O.size < PCAP_FILEHDR_LEN) errx(
+		EX_DATAERR, "%s: not a pcap file", path
+	);
+	O.map = mmap(NULL, O.size, PROT_READ, MAP_SHARED, fd, 0);
+	if (O.map == MAP_FAILED) err(
+		ERRALT(EX_IOERR), "unable to map `%s'", path
+	);
+	(void) close(fd);
+	(void) madvise((void *)(uintptr_t)O.map, O.size, MADV_SEQUENTIAL);
+
+	/* a ring of the `circular' mode, or all of the file */
+	O.filehdr = O.map;
+	ext[0][0] = PCAP_FILEHDR_LEN;
+	ext[0][1] = O.size;
+	next = 1;
+	memcpy(&magic, O.map, sizeof(magic));
+	if (magic == NGP_CIRCULAR_MAGIC) {
+		const struct ngp_circular *ring = (const void *)O.map;
+
+		if (O.size < sizeof(*ring) ||
+		    (next = ngp_circular_extents(ring, O.size, ext)) == -1)
+			errx(EX_DATAERR, "%s: damaged ring", path);
+		O.filehdr = ring->filehdr;
+		memcpy(&magic, O.filehdr, sizeof(magic));
+	}
+	O.swapped = (magic == bswap32(PCAP_MAGIC) ||
+	    magic == bswap32(PCAP_MAGIC_NSEC));
+	O.nsec = (magic == PCAP_MAGIC_NSEC ||
+	    magic == bswap32(PCAP_MAGIC_NSEC));
+	if (!O.swapped && magic != PCAP_MAGIC && magic != PCAP_MAGIC_NSEC)
+		errx(EX_DATAERR, "%s: not a pcap file", path);
+	if (field(O.filehdr, 5) != LINKTYPE_ETHERNET) errx(
+		EX_DATAERR, "%s: link type %u, only ethernet is understood",
+		path, field(O.filehdr, 5)
+	);
+	O.fsnaplen = field(O.filehdr, 4);
+	O.snaplen = MIN(snaplen, O.fsnaplen);
+	O.trim = (mode == NULL && O.snaplen < O.fsnaplen);
+
+	if (mode == NULL) {
+		uint32_t sl = O.swapped ? bswap32(O.snaplen) : O.snaplen;
+
+		memcpy(hdr, O.filehdr, sizeof(hdr));
+		memcpy(hdr + 16, &sl, sizeof(sl));
+		if (ngp_write_all(STDOUT_FILENO, hdr, sizeof(hdr)) == -1) err(
+			ERRALT(EX_IOERR), "unable to write to stdout"
+		);
+	}
+
+	for (ix = 0; ix < next; ix++)
+		O.nchunks += howmany(ext[ix][1] - ext[ix][0], CHUNK_SIZE);
+	O.chunks = calloc(MAX(O.nchunks, 1), sizeof(*O.chunks));
+	if (O.chunks == NULL) err(
+		ERRALT(EX_OSERR), "unable to allocate %zu pieces", O.nchunks
+	);
+	for (cx = ix = 0; ix < next; ix++) {
+		for (expect = ext[ix][0]; expect < ext[ix][1]; cx++) {
+			O.chunks[cx].begin = expect;
+			O.chunks[cx].first = (expect == ext[ix][0]);
+			expect = MIN(expect + CHUNK_SIZE, ext[ix][1]);
+			O.chunks[cx].end = expect;
+			O.chunks[cx].limit = ext[ix][1];
+		}
+	}
+
+	/* with no threads of its own the main thread does every piece */
+	O.nw = (nw > 1) ? MIN((size_t)nw, O.nchunks) : 0;
+	threads = calloc(MAX(O.nw, 1), sizeof(*threads));
+	if (threads == NULL) err(
+		ERRALT(EX_OSERR), "unable to allocate %d threads", O.nw
+	);
+	for (ix = 0; ix < O.nw; ix++) {
+		rc = pthread_create(&threads[ix], NULL, worker_main, NULL);
+		if (rc != 0) {
+			errno = rc;
+			err(ERRALT(EX_OSERR), "unable to start thread %d", ix);
+		}
+	}
+
+	for (expect = 0; O.emit < O.nchunks;) {
+		struct chunk *c = &O.chunks[O.emit];
+
+		if (c->first) {
+			expect = c->begin;
+			O.hist = 0; /* history doesn't go across extents */
+		}
+		if (O.nw == 0) {
+			c->start = c->end; /* finish() walks it */
+		} else {
+			pthread_mutex_lock(&O.lock);
+			while (!c->done)
+				pthread_cond_wait(&O.cv, &O.lock);
+			pthread_mutex_unlock(&O.lock);
+		}
+
+		finish(c, expect);
+		expect = c->next;
+		if (c->end == c->limit && expect != c->limit)
+			warnx("%s: the last record is cut short", path);
+
+		pthread_mutex_lock(&O.lock);
+		O.emit++;
+		pthread_cond_broadcast(&O.cv);
+		pthread_mutex_unlock(&O.lock);
+	}
+	for (ix = 0; ix < O.nw; ix++)
+		(void) pthread_join(threads[ix], NULL);
+	free(threads);
+	free(O.chunks);
+}
+
+/* ngp_history() while offline, the records are all in the file */
+int
+ngp_offline_history(FILE *fp)
+{
+	if (O.hist == 0)
+		return (0); /* nothing yet */
+	if (fwrite(O.filehdr, PCAP_FILEHDR_LEN, 1, fp) != 1 ||
+	    fwrite(O.map + O.hist, O.hist_end - O.hist, 1, fp) != 1)
+		return (-1);
+	return (0);
+}
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <string.h>
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+
+#include "parse.h"
+
+/*
+ * Just enough of ethernet, IPv4 and IPv6 for the analysis modes to find the
+ * transport header. ng_pcap(4) puts a fake ethernet header in front of inet
+ * and inet6 sources, so everything starts the same way.
+ *
+ * Overlays are looked through: stacked VLAN tags, IP in IP (IPv4 or IPv6 in
+ * either), GRE carrying IP or ethernet, and VXLAN. A flow is then keyed by
+ * what is inside, not by the two tunnel endpoints every flow shares. At most
+ * `depth' encapsulations are taken off, what is inside of those is left as is.
+ *
+ * Only what was captured is looked at, never past `caplen'. Fields are read
+ * a byte at a time as nothing in a packet is aligned for us. Nothing is
+ * copied but the addresses, the rest points into the record.
+ */
+
+static int	parse_ether(const uint8_t *, uint32_t, struct ngp_pkt *, int);
+static int	parse_ip4(const uint8_t *, uint32_t, struct ngp_pkt *, int);
+static int	parse_ip6(const uint8_t *, uint32_t, struct ngp_pkt *, int);
+
+/*
+ * What is inside a tunnel replaces what `pkt' says about the outside, unless
+ * it doesn't parse. Then the outside is all there is.
+ */
+static int
+decap(int (*inner)(const uint8_t *, uint32_t, struct ngp_pkt *, int),
+    const uint8_t *p, uint32_t caplen, struct ngp_pkt *pkt, int depth,
+    uint32_t vni)
+{
+	struct ngp_pkt outer = *pkt;
+
+	pkt->tunnels++;
+	pkt->vni = vni;
+	pkt->vlan = 0;
+	pkt->frag = false;
+	pkt->l4 = NULL;
+	pkt->l4len = pkt->l4cap = 0;
+	if (inner(p, caplen, pkt, depth - 1) != 0)
+		*pkt = outer;
+	return (0);
+}
+
+static int
+parse_gre(struct ngp_pkt *pkt, int depth)
+{
+	const uint8_t *p = pkt->l4;
+	uint32_t caplen = MIN(pkt->l4cap, pkt->l4len), off = 4, key = 0;
+	uint16_t flags;
+
+	if (caplen < 4)
+		return (0);
+	flags = be16(p);
+	/* version 1 is PPTP, which isn't carrying anything we know */
+	if ((flags & GRE_VERSION) != 0)
+		return (0);
+	if (flags & GRE_CSUM)
+		off += 4;
+	if (flags & GRE_KEY) {
+		if (caplen < off + 4)
+			return (0);
+		key = (uint32_t)be16(p + off) << 16 | be16(p + off + 2);
+		off += 4;
+	}
+	if (flags & GRE_SEQ)
+		off += 4;
+	if (caplen < off)
+		return (0);
+
+	switch (be16(p + 2)) {
+	case ETHERTYPE_IP:
+		return decap(parse_ip4, p + off, caplen - off, pkt, depth, key);
+	case ETHERTYPE_IPV6:
+		return decap(parse_ip6, p + off, caplen - off, pkt, depth, key);
+	case ETHERTYPE_TEB:
+		return decap(parse_ether, p + off, caplen - off, pkt, depth,
+		    key);
+	}
+	return (0);
+}
+
+/* the transport header was found, see if it is a tunnel to look into */
+static int
+parse_l4(struct ngp_pkt *pkt, int depth)
+{
+	const uint8_t *p = pkt->l4;
+	uint32_t caplen = MIN(pkt->l4cap, pkt->l4len), vni;
+
+	if (depth == 0 || pkt->frag)
+		return (0);
+
+	switch (pkt->proto) {
+	case IPPROTO_IPIP:
+		return decap(parse_ip4, p, caplen, pkt, depth, pkt->vni);
+	case IPPROTO_IPV6:
+		return decap(parse_ip6, p, caplen, pkt, depth, pkt->vni);
+	case IPPROTO_GRE:
+		return parse_gre(pkt, depth);
+	case IPPROTO_UDP:
+		if (caplen < 8 + VXLAN_HDR_LEN || be16(p + 2) != VXLAN_PORT)
+			return (0);
+		/* the I flag says the VNI is valid, RFC 7348 */
+		p += 8;
+		if ((p[0] & 0x08) == 0)
+			return (0);
+		vni = (uint32_t)p[4] << 16 | (uint32_t)p[5] << 8 | p[6];
+		return decap(parse_ether, p + VXLAN_HDR_LEN,
+		    caplen - 8 - VXLAN_HDR_LEN, pkt, depth, vni);
+	}
+	return (0);
+}
+
+static int
+parse_ip4(const uint8_t *p, uint32_t caplen, struct ngp_pkt *pkt, int depth)
+{
+	uint32_t hlen, tlen;
+
+	if (caplen < 20 || (p[0] >> 4) != 4)
+		return (-1);
+	hlen = (p[0] & 0x0f) * 4;
+	tlen = be16(p + 2);
+	if (hlen < 20 || tlen < hlen || caplen < hlen)
+		return (-1);
+
+	pkt->af = AF_INET;
+	pkt->l3 = p;
+	pkt->proto = p[9];
+	memset(pkt->src, 0, sizeof(pkt->src));
+	memset(pkt->dst, 0, sizeof(pkt->dst));
+	memcpy(pkt->src, p + 12, 4);
+	memcpy(pkt->dst, p + 16, 4);
+
+	/* only the first fragment has a transport header */
+	pkt->frag = (be16(p + 6) & 0x3fff) != 0;
+	if ((be16(p + 6) & 0x1fff) != 0)
+		return (0);
+
+	pkt->l4 = p + hlen;
+	pkt->l4len = tlen - hlen;
+	pkt->l4cap = caplen - hlen;
+	return parse_l4(pkt, depth);
+}
+
+static int
+parse_ip6(const uint8_t *p, uint32_t caplen, struct ngp_pkt *pkt, int depth)
+{
+	uint32_t off = 40, len;
+	uint8_t nxt;
+
+	if (caplen < 40 || (p[0] >> 4) != 6)
+		return (-1);
+
+	pkt->af = AF_INET6;
+	pkt->l3 = p;
+	memcpy(pkt->src, p + 8, 16);
+	memcpy(pkt->dst, p + 24, 16);
+	len = be16(p + 4) + 40;
+	nxt = p[6];
+
+	for (;;) {
+		switch (nxt) {
+		case IPPROTO_HOPOPTS:
+		case IPPROTO_ROUTING:
+		case IPPROTO_DSTOPTS:
+			if (caplen < off + 8)
+				return (0);
+			nxt = p[off];
+			off += (p[off + 1] + 1) * 8;
+			continue;
+		case IPPROTO_AH:
+			if (caplen < off + 8)
+				return (0);
+			nxt = p[off];
+			off += (p[off + 1] + 2) * 4;
+			continue;
+		case IPPROTO_FRAGMENT:
+			if (caplen < off + 8)
+				return (0);
+			pkt->proto = p[off];
+			pkt->frag = true;
+			if ((be16(p + off + 2) & 0xfff8) != 0)
+				return (0); /* not the first fragment */
+			nxt = p[off];
+			off += 8;
+			continue;
+		}
+		break;
+	}
+
+	pkt->proto = nxt;
+	if (off > caplen || off > len)
+		return (0);
+	pkt->l4 = p + off;
+	pkt->l4len = len - off;
+	pkt->l4cap = caplen - off;
+	return parse_l4(pkt, depth);
+}
+
+static int
+parse_ether(const uint8_t *p, uint32_t caplen, struct ngp_pkt *pkt, int depth)
+{
+	uint32_t off = ETHER_HDR_LEN;
+	uint16_t type;
+
+	if (caplen < ETHER_HDR_LEN)
+		return (-1);
+	type = be16(p + 12);
+
+	/* vlan tags, stacked too, the one closest to the payload is kept */
+	while ((type == ETHERTYPE_VLAN || type == ETHERTYPE_QINQ) &&
+	    caplen >= off + 4) {
+		pkt->vlan = be16(p + off) & 0x0fff;
+		type = be16(p + off + 2);
+		off += 4;
+	}
+
+	switch (type) {
+	case ETHERTYPE_IP:
+		return parse_ip4(p + off, caplen - off, pkt, depth);
+	case ETHERTYPE_IPV6:
+		return parse_ip6(p + off, caplen - off, pkt, depth);
+	}
+	return (-1);
+}
+
+/*
+ * Returns -1 when the record isn't IPv4 or IPv6. Otherwise `pkt' has the
+ * addresses and protocol, and `l4' is set when the transport header is in the
+ * record (it may still be cut short, check `l4cap'). With a `depth' all of
+ * that is about the innermost packet of up to that many tunnels.
+ */
+int
+ngp_parse(const struct ngp_record *rec, struct ngp_pkt *pkt, int depth)
+{
+	memset(pkt, 0, sizeof(*pkt));
+	return parse_ether(rec->data, rec->caplen, pkt, depth);
+}
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef __FREEDAVE_NET_PARSE_H__
+#define __FREEDAVE_NET_PARSE_H__
+
+/*
+ * Records and what parse.c makes of them. Nothing here needs netgraph(3), so
+ * parse.c builds on its own, for parse_bench.c.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* one pcap(3) record, as an analysis mode gets it */
+struct ngp_record {
+	int		src;		/* index of its ngp_source */
+	uint64_t	nsec;		/* capture time */
+	uint32_t	caplen;
+	uint32_t	len;		/* on the wire */
+	const uint8_t	*data;		/* `caplen' bytes, ethernet first */
+};
+
+/*
+ * What parse.c makes of a record. Tunnels it looked through leave the inner
+ * packet here, `vni' tells apart overlays that reuse the same addresses.
+ */
+#define	NGP_PARSE_DEPTH	4		/* tunnels in tunnels */
+
+struct ngp_pkt {
+	int		af;		/* AF_INET or AF_INET6 */
+	uint8_t		tunnels;	/* how many were taken off */
+	uint16_t	vlan;		/* innermost tag, 0 if none */
+	uint32_t	vni;		/* VXLAN VNI or GRE key, 0 if none */
+	uint8_t		proto;		/* IPPROTO_ of the transport */
+	uint8_t		src[16];	/* IPv4 uses the first 4 */
+	uint8_t		dst[16];
+	const uint8_t	*l3;		/* the IP header */
+	bool		frag;		/* l4 is only part of the datagram */
+	const uint8_t	*l4;		/* transport header, NULL if not here */
+	uint32_t	l4len;		/* as the IP header has it */
+	uint32_t	l4cap;		/* how much of that was captured */
+};
+
+/* the overlays looked through, that net/ doesn't have */
+#define	ETHERTYPE_TEB	0x6558		/* ethernet in GRE */
+#define	VXLAN_PORT	4789		/* IANA */
+#define	VXLAN_HDR_LEN	8
+
+#define	GRE_CSUM	0x8000
+#define	GRE_KEY		0x2000
+#define	GRE_SEQ		0x1000
+#define	GRE_VERSION	0x0007
+
+int	ngp_parse(const struct ngp_record *, struct ngp_pkt *, int);
+
+/* packets are big endian and not aligned for us, a byte at a time */
+static __inline uint16_t
+be16(const uint8_t *p)
+{
+	return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static __inline uint32_t
+be32(const uint8_t *p)
+{
+	return ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | p[3]);
+}
+
+#endif /* __FREEDAVE_NET_PARSE_H__ */
@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * How fast ngp_parse() is on each kind of frame the modes look through, and
+ * on all of them mixed, in million records per second on one core. Not part
+ * of ngpcap and needing nothing but parse.c:
+ *
+ *	make parse-bench && ./parse-bench
+ *
+ * or without the Makefile
+ *
+ *	cc -O2 -o parse-bench parse_bench.c parse.c && ./parse-bench
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <time.h>
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+
+#include "parse.h"
+
+#define	BENCH_ROUNDS	(1 << 24)
+#define	BENCH_PAYLOAD	64
+
+struct frame {
+	const char	*name;
+	uint8_t		tunnels;	/* what ngp_parse() has to take off */
+	uint8_t		proto;		/* and find inside */
+	uint32_t	len;
+	uint8_t		data[256];
+	int		nfix;
+	struct {
+		uint32_t	off;
+		int		what;	/* 4, 6 or IPPROTO_UDP */
+	}		fix[8];		/* lengths known once it is done */
+};
+
+static void
+put(struct frame *f, const void *p, uint32_t len)
+{
+	memcpy(f->data + f->len, p, len);
+	f->len += len;
+}
+
+static void
+put16(struct frame *f, uint16_t v)
+{
+	uint8_t b[2] = { v >> 8, v & 0xff };
+
+	put(f, b, sizeof(b));
+}
+
+static void
+later(struct frame *f, int what)
+{
+	f->fix[f->nfix].off = f->len;
+	f->fix[f->nfix++].what = what;
+}
+
+static void
+ether(struct frame *f, uint16_t type)
+{
+	static const uint8_t macs[12] = {
+		0x02, 0, 0, 0, 0, 0x02, 0x02, 0, 0, 0, 0, 0x01
+	};
+
+	put(f, macs, sizeof(macs));
+	put16(f, type);
+}
+
+static void
+tag(struct frame *f, uint16_t vid, uint16_t type)
+{
+	put16(f, vid);
+	put16(f, type);
+}
+
+static void
+ip4(struct frame *f, uint8_t proto)
+{
+	uint8_t h[20] = { 0x45, [8] = 64, [9] = proto, [12] = 10, [15] = 1,
+	    [16] = 10, [19] = 2 };
+
+	later(f, 4);
+	put(f, h, sizeof(h));
+}
+
+static void
+ip6(struct frame *f, uint8_t nxt)
+{
+	uint8_t h[40] = { 0x60, [6] = nxt, [7] = 64, [8] = 0xfd, [23] = 1,
+	    [24] = 0xfd, [39] = 2 };
+
+	later(f, 6);
+	put(f, h, sizeof(h));
+}
+
+static void
+udp(struct frame *f, uint16_t dport)
+{
+	later(f, IPPROTO_UDP);
+	put16(f, 49152);
+	put16(f, dport);
+	put16(f, 0);
+	put16(f, 0);
+}
+
+static void
+tcp(struct frame *f)
+{
+	uint8_t h[20] = { 0xc0, 0, 0, 80, [12] = 0x50, [13] = 0x10,
+	    [14] = 0xff, [15] = 0xff };
+
+	put(f, h, sizeof(h));
+}
+
+static void
+vxlan(struct frame *f, uint32_t vni)
+{
+	uint8_t h[VXLAN_HDR_LEN] = { 0x08, [4] = vni >> 16, [5] = vni >> 8,
+	    [6] = vni };
+
+	put(f, h, sizeof(h));
+}
+
+static void
+gre(struct frame *f, uint16_t type, uint32_t key)
+{
+	put16(f, GRE_KEY);
+	put16(f, type);
+	put16(f, key >> 16);
+	put16(f, key & 0xffff);
+}
+
+/* a payload, then every length field that covers it */
+static void
+done(struct frame *f)
+{
+	uint8_t payload[BENCH_PAYLOAD] = { 0 };
+	uint32_t off, len;
+	int ix;
+
+	put(f, payload, sizeof(payload));
+	for (ix = 0; ix < f->nfix; ix++) {
+		off = f->fix[ix].off;
+		len = f->len - off;
+		if (f->fix[ix].what == 4)
+			off += 2;
+		else if (f->fix[ix].what == 6) {
+			off += 4;
+			len -= 40;
+		} else
+			off += 4;
+		f->data[off] = len >> 8;
+		f->data[off + 1] = len & 0xff;
+	}
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+int
+main(void)
+{
+	static struct frame frames[6];
+	struct frame *f;
+	struct ngp_record recs[nitems(frames)];
+	struct ngp_pkt pkt;
+	uint64_t sum = 0;
+	size_t ix;
+	double start;
+	int n;
+
+	f = &frames[0];
+	*f = (struct frame){ .name = "plain", .proto = IPPROTO_TCP };
+	ether(f, ETHERTYPE_IP);
+	ip4(f, IPPROTO_TCP);
+	tcp(f);
+	done(f);
+
+	f = &frames[1];
+	*f = (struct frame){ .name = "qinq ipv6", .proto = IPPROTO_UDP };
+	ether(f, ETHERTYPE_QINQ);
+	tag(f, 100, ETHERTYPE_VLAN);
+	tag(f, 200, ETHERTYPE_IPV6);
+	ip6(f, IPPROTO_UDP);
+	udp(f, 53);
+	done(f);
+
+	f = &frames[2];
+	*f = (struct frame){ .name = "vxlan", .tunnels = 1,
+	    .proto = IPPROTO_TCP };
+	ether(f, ETHERTYPE_IP);
+	ip4(f, IPPROTO_UDP);
+	udp(f, VXLAN_PORT);
+	vxlan(f, 5000);
+	ether(f, ETHERTYPE_IP);
+	ip4(f, IPPROTO_TCP);
+	tcp(f);
+	done(f);
+
+	f = &frames[3];
+	*f = (struct frame){ .name = "gre teb", .tunnels = 1,
+	    .proto = IPPROTO_TCP };
+	ether(f, ETHERTYPE_IP);
+	ip4(f, IPPROTO_GRE);
+	gre(f, ETHERTYPE_TEB, 7);
+	ether(f, ETHERTYPE_IP);
+	ip4(f, IPPROTO_TCP);
+	tcp(f);
+	done(f);
+
+	f = &frames[4];
+	*f = (struct frame){ .name = "6in4", .tunnels = 1,
+	    .proto = IPPROTO_TCP };
+	ether(f, ETHERTYPE_IP);
+	ip4(f, IPPROTO_IPV6);
+	ip6(f, IPPROTO_TCP);
+	tcp(f);
+	done(f);
+
+	f = &frames[5];
+	*f = (struct frame){ .name = "4in6", .tunnels = 1,
+	    .proto = IPPROTO_TCP };
+	ether(f, ETHERTYPE_IPV6);
+	ip6(f, IPPROTO_IPIP);
+	ip4(f, IPPROTO_TCP);
+	tcp(f);
+	done(f);
+
+	/* a frame that doesn't parse the way it should times nothing useful */
+	for (ix = 0; ix < nitems(frames); ix++) {
+		recs[ix] = (struct ngp_record){ .caplen = frames[ix].len,
+		    .len = frames[ix].len, .data = frames[ix].data };
+		if (ngp_parse(&recs[ix], &pkt, NGP_PARSE_DEPTH) != 0 ||
+		    pkt.l4 == NULL || pkt.tunnels != frames[ix].tunnels ||
+		    pkt.proto != frames[ix].proto) errx(
+			EX_SOFTWARE, "`%s' doesn't parse", frames[ix].name
+		);
+	}
+
+	for (ix = 0; ix <= nitems(frames); ix++) {
+		start = now();
+		for (n = 0; n < BENCH_ROUNDS; n++) {
+			(void) ngp_parse(&recs[(ix < nitems(frames)) ? ix :
+			    n % nitems(frames)], &pkt, NGP_PARSE_DEPTH);
+			sum += pkt.proto;
+		}
+		(void) printf("%-10s %6.1f Mpps\n", (ix < nitems(frames)) ?
+		    frames[ix].name : "mixed", BENCH_ROUNDS / (now() - start) /
+		    1e6);
+	}
+	return (sum == 0);
+}
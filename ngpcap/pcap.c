@@ -20,7 +20,11 @@ static ng_ID_t
 ngp_create(ngctx ctrl, const char *peer, const char *peerhook, const char *hook)
 {
 	int rc;
-	struct ng_mesg *resp;
+	union {
+		struct ng_mesg	msg;
+		char		buf[NG_REPLYSIZ(sizeof(struct nodeinfo))];
+	} u;
+	struct ng_reply resp = NG_REPLY_INIT(&u, sizeof(u));
 	struct ngm_mkpeer msg = {
 		.type = NG_PCAP_NODE_TYPE,
 	};
@@ -45,7 +49,7 @@ ngp_create(ngctx ctrl, const char *peer, const char *peerhook, const char *hook)
 		ERREXIT, "unable to request %s info, presumed dead", msg.type
 	);
 
-	rc = NgAllocRecvMsg(ctrl, &resp, NULL);
+	rc = ng_recv_msg(ctrl, &resp, NULL);
 	if (rc == -1) err(
 		ERREXIT, "unable to retrieve %s info, presumed dead", msg.type
 	);
@@ -53,8 +57,8 @@ ngp_create(ngctx ctrl, const char *peer, const char *peerhook, const char *hook)
 	/*
 	 * This warns about structure alignment but is also done in ngctl(8).
 	 */
-	nd = ((struct nodeinfo *) resp->data)->id;
-	free(resp);
+	nd = ((struct nodeinfo *) resp.msg->data)->id;
+	ng_reply_fini(&resp);
 	
 	return (nd);
 }
@@ -186,3 +190,49 @@ ngp_set_type(ngctx ctrl, ng_ID_t pcap, uint8_t snum, enum pkt_type pkt)
 		pth, msg.hook, msg.type
 	);
 }
+
+/*
+ * Connect `nsrcs' sources, every `stride'th one of `srcs', to as few ng_pcap(4)
+ * as it takes. At most `per' go on one and only sources of the same snaplen
+ * share one, as it is configured for the node. `pcaps' has room for `nsrcs'
+ * and gets the nodes in the order they were created, returns how many.
+ */
+int
+ngp_connect_srcs(ngctx ctrl, const struct ngp_source *srcs, int nsrcs,
+    int stride, int per, ng_ID_t *pcaps)
+{
+	int ix, jx, npcap = 0;
+	uint8_t *used;
+	int32_t *snaplen;
+
+	assert(per > 0 && per <= NG_PCAP_MAX_LINKS);
+
+	used = calloc(nsrcs, sizeof(*used));
+	snaplen = calloc(nsrcs, sizeof(*snaplen));
+	if (used == NULL || snaplen == NULL) err(
+		ERRALT(EX_OSERR), "unable to allocate %d ng_pcap", nsrcs
+	);
+
+	for (ix = 0; ix < nsrcs; ix++) {
+		const struct ngp_source *src = &srcs[ix * stride];
+
+		for (jx = 0; jx < npcap; jx++)
+			if (snaplen[jx] == src->snaplen && used[jx] < per)
+				break;
+		if (jx == npcap) {
+			pcaps[npcap] = 0;
+			snaplen[npcap++] = src->snaplen;
+		}
+
+		pcaps[jx] = ngp_connect_src(ctrl, pcaps[jx], used[jx],
+		    src->node, src->hook);
+		ngp_set_type(ctrl, pcaps[jx], used[jx], src->pkt);
+		/* has to be before snoop is connected */
+		if (used[jx]++ == 0)
+			ngp_set_snaplen(ctrl, pcaps[jx], src->snaplen);
+	}
+
+	free(used);
+	free(snaplen);
+	return (npcap);
+}
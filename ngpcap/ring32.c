@@ -5,9 +5,11 @@
  */
 
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 
 #include "ring32.h"
@@ -24,15 +26,77 @@
  * 4k pages which is 2^12. So your size will typically be 2^(12 + lgpages).
  * The more important value to know is the page size.
  */
+static void
+ring32_set(struct ring32 *rb, uint8_t *data, uint32_t capacity,
+    uint32_t start, uint32_t end, int shm)
+{
+	/*
+	 * kind of annoying way to initialize rb by memcpy, all part of the
+	 * `const compromise` for structure members.
+	 */
+	struct ring32 initializer = {
+		.capacity = capacity,
+		.mask = capacity - 1,
+		.index = { .start = start, .end = end },
+		.maps = { .data = data, .copy = data + capacity },
+		.shm = shm,
+	};
+	memcpy(rb, &initializer, sizeof(*rb));
+}
+
+/*
+ * Map `capacity' bytes of `shm' twice, back to back, and fill out `rb'. On
+ * success `rb' owns `shm', on failure it is left for the caller to close.
+ */
+static int
+ring32_map(struct ring32 *rb, int shm, uint32_t capacity, uint32_t start,
+    uint32_t end)
+{
+	int lgpagesz = ffsl(getpagesize()) - 1; /* for MAP_ALIGNED */
+	uint8_t	*data, *copy;
+
+	data = mmap(
+		0, capacity,
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ALIGNED(lgpagesz),
+		shm, (off_t)0
+	);
+	if (data == MAP_FAILED)
+		return (-1);	/* mmap set errno */
+
+	/*
+	 * NOTE: it doesn't appear, even though we use shm_open(2), that we are
+	 *       required to go touch all the pages to force allocations. But if
+	 *       we did, this is where we would. (By writing a '0' to one byte
+	 *       of each page of `data`).
+	 */
+
+	/* force the next address but map same data */
+	copy = mmap(
+		data + capacity, capacity,
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_FIXED,
+		shm, (off_t)0
+	);
+	if (copy == MAP_FAILED) {
+		int save_err = errno;
+		(void) munmap(data, capacity);
+		errno = save_err;
+		return (-1);
+	}
+
+	ring32_set(rb, data, capacity, start, end, shm);
+	return (0);
+}
+
 int
 ring32_init(struct ring32 *rb, uint8_t lgpages)
 {
-	int shm;
+	int shm, save_err;
 	uint32_t pagesz = (uint32_t) getpagesize();
-	int lgpagesz = ffsl(pagesz) - 1; /* for MAP_ALIGNED */
+	int lgpagesz = ffsl(pagesz) - 1;
 
 	uint32_t capacity;
-	uint8_t	*data, *copy;
 
 
 	if (rb == NULL) {
@@ -54,60 +118,43 @@ ring32_init(struct ring32 *rb, uint8_t lgpages)
 		return (-1);	/* shm_open set errno */
 
 	/* we only need ring->capacity as we map that same region twice */
-	if (ftruncate(shm, (off_t)capacity) == -1) {
-		/* shouldn't happen per man page but in case that changes */
-		return (-1);
-	}
-
-	data = mmap(
-		0, capacity,
-		PROT_READ | PROT_WRITE,
-		MAP_SHARED | MAP_ALIGNED(lgpagesz),
-		shm, (off_t)0
-	);
-	if (data == MAP_FAILED) {
-		int save_err = errno; /* mmap set */
+	if (ftruncate(shm, (off_t)capacity) == -1 ||
+	    ring32_map(rb, shm, capacity, 0, 0) == -1) {
+		save_err = errno;
 		(void) close(shm);
 		errno = save_err;
 		return (-1);
 	}
 
-	/*
-	 * NOTE: it doesn't appear, even though we use shm_open(2), that we are
-	 *       required to go touch all the pages to force allocations. But if
-	 *       we did, this is where we would. (By writing a '0' to one byte
-	 *       of each page of `data`).
-	 */
+	return (0);
+}
 
-	/* force the next address but map same data */
-	copy = mmap(
-		data + capacity, capacity,
-		PROT_READ | PROT_WRITE,
-		MAP_SHARED | MAP_FIXED,
-		shm, (off_t)0
-	);
-	if (copy == MAP_FAILED) {
-		int save_err = errno;
-		(void) munmap(data, capacity);
-		(void) close(shm);
-		errno = save_err;
+/*
+ * Take over the ring another process has in `shm', as it passed it with
+ * SCM_RIGHTS along with its indices. The records between them are kept.
+ */
+int
+ring32_attach(struct ring32 *rb, int shm, uint32_t start, uint32_t end)
+{
+	struct stat sb;
+	uint32_t pagesz = (uint32_t) getpagesize();
+
+	if (rb == NULL) {
+		errno = EINVAL;
 		return (-1);
 	}
-	close(shm); /* no longer needed */
+	if (fstat(shm, &sb) == -1)
+		return (-1);	/* fstat set errno */
 
-	/*
-	 * kind of annoying way to initialize rb by memcpy, all part of the
-	 * `const compromise` for structure members.
-	 */
-	struct ring32 initializer = {
-		.capacity = capacity,
-		.mask = capacity - 1,
-		.index = { .start = 0, .end = 0 },
-		.maps = { .data = data, .copy = copy },
-	};
-	memcpy(rb, &initializer, sizeof(*rb));
+	/* the same rules ring32_init made it by */
+	if (sb.st_size < pagesz || sb.st_size > (1U << 31) ||
+	    (sb.st_size & (sb.st_size - 1)) != 0 ||
+	    end - start > (uint32_t)sb.st_size) {
+		errno = EDOM;
+		return (-1);
+	}
 
-	return (0);
+	return ring32_map(rb, shm, (uint32_t)sb.st_size, start, end);
 }
 
 
@@ -125,7 +172,167 @@ ring32_fini(struct ring32 *rb)
 	}
 	(void) munmap(rb->maps.copy, rb->capacity);
 	(void) munmap(rb->maps.data, rb->capacity);
+	(void) close(rb->shm);
 	bzero(rb, sizeof(*rb));
 
 	return (0);
 }
+
+
+/*
+ * A pool carves rings of one size out of a single shm object and a single
+ * reservation of address space, two slots of it per ring. A slot is mapped
+ * the first time it is handed out and stays mapped, so a ring that comes back
+ * is handed out again without another mmap. Never more than `budget' bytes
+ * of rings exist, and the shm object is only ever that big.
+ */
+int
+ring32_pool_init(struct ring32_pool *rp, uint8_t lgpages, size_t budget)
+{
+	int save_err;
+	uint32_t pagesz = (uint32_t) getpagesize();
+	int lgpagesz = ffsl(pagesz) - 1;
+	size_t nrings;
+
+	if (rp == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	memset(rp, 0, sizeof(*rp));
+	rp->shm = -1;
+	rp->base = MAP_FAILED;
+
+	/* the same limit as ring32_init, and room for one at least */
+	if ((lgpagesz + lgpages) > (8 * sizeof(rp->capacity) - 1)) {
+		errno = EDOM;
+		return (-1);
+	}
+	rp->capacity = 1 << (lgpages + lgpagesz);
+	nrings = budget / rp->capacity;
+	if (nrings == 0 || nrings > UINT32_MAX ||
+	    nrings > SIZE_MAX / 2 / rp->capacity) {
+		errno = EDOM;
+		return (-1);
+	}
+	rp->nrings = nrings;
+
+	rp->free = calloc(rp->nrings, sizeof(*rp->free));
+	if (rp->free == NULL)
+		return (-1);	/* calloc set errno */
+
+	rp->shm = shm_open(SHM_ANON, O_RDWR | O_EXCL | O_CREAT, 0600);
+	if (rp->shm == -1 ||
+	    ftruncate(rp->shm, (off_t)rp->nrings * rp->capacity) == -1)
+		goto fail;
+
+	/* nothing is mapped here until ring32_pool_get wants a slot */
+	rp->base = mmap(
+		0, 2 * rp->nrings * rp->capacity,
+		PROT_NONE,
+		MAP_GUARD | MAP_ALIGNED(lgpagesz),
+		-1, (off_t)0
+	);
+	if (rp->base == MAP_FAILED)
+		goto fail;
+
+	return (0);
+
+fail:
+	save_err = errno;
+	(void) ring32_pool_fini(rp);
+	errno = save_err;
+	return (-1);
+}
+
+/* an empty ring from `rp', ENOBUFS when the budget is all in use */
+int
+ring32_pool_get(struct ring32_pool *rp, struct ring32 *rb)
+{
+	uint32_t slot;
+	uint8_t *data, *copy;
+	off_t off;
+
+	if (rp == NULL || rb == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	if (rp->nfree > 0) {
+		slot = rp->free[--rp->nfree];
+		data = rp->base + 2 * (size_t)slot * rp->capacity;
+	} else if (rp->nmapped < rp->nrings) {
+		slot = rp->nmapped;
+		off = (off_t)slot * rp->capacity;
+		data = mmap(
+			rp->base + 2 * (size_t)slot * rp->capacity,
+			rp->capacity,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_FIXED,
+			rp->shm, off
+		);
+		if (data == MAP_FAILED)
+			return (-1);	/* mmap set errno */
+		copy = mmap(
+			data + rp->capacity, rp->capacity,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_FIXED,
+			rp->shm, off
+		);
+		if (copy == MAP_FAILED)
+			return (-1);	/* mmap set errno, `data' is retried */
+		rp->nmapped++;
+	} else {
+		errno = ENOBUFS;
+		return (-1);
+	}
+
+	/* the pool keeps `shm', ring32_fini is not for these */
+	ring32_set(rb, data, rp->capacity, 0, 0, -1);
+	return (0);
+}
+
+/* give `rb' back to `rp', whatever was still in it is gone */
+int
+ring32_pool_put(struct ring32_pool *rp, struct ring32 *rb)
+{
+	size_t off;
+
+	if (rp == NULL || rb == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	off = rb->maps.data - rp->base;
+	if (rb->capacity != rp->capacity || rb->maps.data < rp->base ||
+	    off % (2 * (size_t)rp->capacity) != 0 ||
+	    off / (2 * (size_t)rp->capacity) >= rp->nmapped) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	assert(rp->nfree < rp->nmapped);
+	rp->free[rp->nfree++] = off / (2 * (size_t)rp->capacity);
+	bzero(rb, sizeof(*rb));
+
+	return (0);
+}
+
+/* every ring of `rp' goes with it */
+int
+ring32_pool_fini(struct ring32_pool *rp)
+{
+
+	if (rp == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (rp->base != MAP_FAILED)
+		(void) munmap(rp->base, 2 * (size_t)rp->nrings * rp->capacity);
+	if (rp->shm != -1)
+		(void) close(rp->shm);
+	free(rp->free);
+	memset(rp, 0, sizeof(*rp));
+	rp->shm = -1;
+	rp->base = MAP_FAILED;
+
+	return (0);
+}
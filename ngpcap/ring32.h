@@ -24,6 +24,18 @@ struct ring32 {
 		uint8_t	* const	data;
 		uint8_t	* const	copy;	/* mapped right after data */
 	}			maps;
+	int			shm;	/* what both are mapped from */
+};
+
+/* many rings of one size, see ring32_pool_init */
+struct ring32_pool {
+	int			shm;	/* every ring's data */
+	uint8_t			*base;	/* 2 * capacity for each ring */
+	uint32_t		capacity;
+	uint32_t		nrings;	/* the budget */
+	uint32_t		nmapped; /* slots [0, nmapped) are mapped */
+	uint32_t		*free;	/* mapped slots not in use */
+	uint32_t		nfree;
 };
 
 /*
@@ -139,7 +151,7 @@ ring32_write_advance(struct ring32 *rb, ssize_t nwrit)
 
 
 /*
- * The only 2 functions that aren't inline.
+ * The only functions that aren't inline.
  *
  * For ring[16|32]_init you have to pass a `struct ring[16|32]` that will be
  * filled out and have memory mapped in for you. Much like MAP_ALIGNED for mmap,
@@ -147,11 +159,27 @@ ring32_write_advance(struct ring32 *rb, ssize_t nwrit)
  * pages you want mapped. For a 4k page and R_SZ=32, valid values are [0,19].
  * For 4k page and R_SZ=16, valid values are [0,3].
  *
+ * ring32_attach maps a ring another process made, from its `shm` and
+ * indices, for handing a ring over with SCM_RIGHTS.
+ *
+ * ring32_pool_init makes room for `budget` bytes of rings of 2^lgpages pages
+ * each, for when there are too many rings for each to be an shm object and a
+ * pair of mmap calls of its own. ring32_pool_get hands out one of them and
+ * fails with ENOBUFS once all are in use, ring32_pool_put takes it back.
+ * Rings from a pool are never given to ring32_fini, nor handed over, they go
+ * with ring32_pool_fini.
+ *
  * These will return -1 on failure and set `errno`, they don't assert.
  */
 int	ring32_init(struct ring32 *, uint8_t);
+int	ring32_attach(struct ring32 *, int, uint32_t, uint32_t);
 int	ring32_fini(struct ring32 *);
 
+int	ring32_pool_init(struct ring32_pool *, uint8_t, size_t);
+int	ring32_pool_get(struct ring32_pool *, struct ring32 *);
+int	ring32_pool_put(struct ring32_pool *, struct ring32 *);
+int	ring32_pool_fini(struct ring32_pool *);
+
 
 #ifdef TEST
 /*
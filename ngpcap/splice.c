@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <assert.h>
+#include <err.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <netgraph.h>
+#include <netgraph/ng_tee.h>
+
+#include "ngpcap.h"
+
+/*
+ * Splice an ng_tee(4) into a link that is already connected, so it can be
+ * captured without having put the tee there in advance.
+ *
+ *	node:hook <-> peer:peerhook
+ *
+ * becomes
+ *
+ *	node:hook <-> left:tee:right <-> peer:peerhook
+ *
+ * leaving `left2right' and `right2left' for ng_pcap(4). Taking it out again is
+ * just shutting the tee down, ng_tee(4) reconnects `left' and `right' to each
+ * other when it goes.
+ */
+
+/*
+ * These don't shut down when they lose their last hook. Anything else might,
+ * and taking the link apart for a moment would then take the node with it.
+ */
+static const char *survivors[] = {
+	"ether", "eiface", "iface", "socket",
+};
+
+static bool
+survives(const struct nodeinfo *ninfo)
+{
+	size_t ix;
+
+	if (ninfo->hooks > 1)
+		return (true);
+	for (ix = 0; ix < nitems(survivors); ix++)
+		if (strcmp(ninfo->type, survivors[ix]) == 0)
+			return (true);
+	return (false);
+}
+
+static int
+ngp_id_connect(ngctx ctrl, ng_ID_t nd, const char *ourhook, ng_ID_t peer,
+    const char *peerhook)
+{
+	int rc;
+	char pth[NG_NODESIZ + 1]; /* extra for ':' */
+	struct ngm_connect msg;
+
+	snprintf(pth, sizeof(pth), IDFMT, nd);
+	snprintf(msg.path, sizeof(msg.path), IDFMT, peer);
+	strlcpy(msg.ourhook, ourhook, sizeof(msg.ourhook));
+	strlcpy(msg.peerhook, peerhook, sizeof(msg.peerhook));
+
+	rc = NgSendMsg(ctrl, pth, NGM_GENERIC_COOKIE, NGM_CONNECT, &msg,
+	    sizeof(msg));
+	if (rc == -1) warn(
+		"unable to connect `%s%s' to `%s%s'",
+		pth, msg.ourhook, msg.path, msg.peerhook
+	);
+
+	return (rc);
+}
+
+/*
+ * One round trip for everything connected to `node', found through `c'. The
+ * hooklist is in `resp', good until it is used for another reply.
+ */
+struct hooklist *
+ngp_listhooks(ngctx ctrl, struct ng_cache *c, const char *node,
+    struct ng_reply *resp)
+{
+	int rc;
+	const struct ng_cache_node *cn;
+
+	assert(ctrl >= 0);
+	assert(c != NULL);
+	assert(node != NULL);		assert(strlen(node) < NG_NODESIZ);
+
+	cn = ng_cache_send(ctrl, c, node, NGM_GENERIC_COOKIE, NGM_LISTHOOKS,
+	    NULL, 0);
+	if (cn == NULL) err(
+		EX_DATAERR, "unable to list hooks of `%s:'", node
+	);
+	rc = ng_recv_msg(ctrl, resp, NULL);
+	if (rc == -1) err(
+		ERREXIT, "unable to get hooks of `%s:', presumed dead", node
+	);
+
+	return ((struct hooklist *) resp->msg->data);
+}
+
+/*
+ * Splice into `link' of the node described by `ninfo', both from the same
+ * ngp_listhooks(). Returns the ID of the tee, or 0 (after a warning) when
+ * either end would shut down while the link is taken apart. The caller owns
+ * the tee and must ng_shutdown_node() it to put the link back the way it was.
+ */
+ng_ID_t
+ngp_splice_link(ngctx ctrl, const struct nodeinfo *ninfo,
+    const struct linkinfo *link)
+{
+	static unsigned nsplice;
+	int rc;
+	ng_ID_t nd, peer, tee;
+	char pth[NG_PATHSIZE], hold[NG_HOOKSIZ];
+	const char *hook, *peerhook;
+	union {
+		struct ng_mesg	msg;
+		char		buf[NG_REPLYSIZ(sizeof(struct nodeinfo))];
+	} u;
+	struct ng_reply resp = NG_REPLY_INIT(&u, sizeof(u));
+	struct ngm_mkpeer mkp = {
+		.type = NG_TEE_NODE_TYPE,
+		.peerhook = NG_TEE_HOOK_LEFT2RIGHT,
+	};
+	struct ngm_rmhook rmh;
+
+	assert(ctrl >= 0);
+	assert(ninfo != NULL);
+	assert(link != NULL);
+
+	nd = ninfo->id;
+	hook = link->ourhook;
+	peer = link->nodeinfo.id;
+	peerhook = link->peerhook;
+
+	if (!survives(ninfo) || !survives(&link->nodeinfo)) {
+		warnx(IDFMT "%s is the last hook of a node that would shut down "
+		    "while splicing", nd, hook);
+		return (0);
+	}
+
+	/* the tee hangs off our socket until it has a link of its own */
+	snprintf(hold, sizeof(hold), "splice%u", nsplice++);
+	strlcpy(mkp.ourhook, hold, sizeof(mkp.ourhook));
+	rc = NgSendMsg(ctrl, ".:", NGM_GENERIC_COOKIE, NGM_MKPEER, &mkp,
+	    sizeof(mkp));
+	if (rc == -1) err(
+		ERREXIT, "unable to create %s", mkp.type
+	);
+
+	snprintf(pth, sizeof(pth), ".:%s", hold);
+	rc = NgSendMsg(ctrl, pth, NGM_GENERIC_COOKIE, NGM_NODEINFO, NULL, 0);
+	if (rc == -1) err(
+		ERREXIT, "unable to request %s info, presumed dead", mkp.type
+	);
+	rc = ng_recv_msg(ctrl, &resp, NULL);
+	if (rc == -1) err(
+		ERREXIT, "unable to retrieve %s info, presumed dead", mkp.type
+	);
+	tee = ((struct nodeinfo *) resp.msg->data)->id;
+	ng_reply_fini(&resp);
+
+	/*
+	 * netgraph(4) has no way of replacing a link in one go. These are
+	 * sent back to back and the link is down only for as long as the
+	 * kernel takes to process them.
+	 */
+	snprintf(pth, sizeof(pth), IDFMT, nd);
+	strlcpy(rmh.ourhook, hook, sizeof(rmh.ourhook));
+	rc = NgSendMsg(ctrl, pth, NGM_GENERIC_COOKIE, NGM_RMHOOK, &rmh,
+	    sizeof(rmh));
+	if (rc == -1) {
+		ng_shutdown_node(ctrl, tee);
+		err(ERREXIT, "unable to rmhook `%s' from `%s'", hook, pth);
+	}
+	if (ngp_id_connect(ctrl, tee, NG_TEE_HOOK_LEFT, nd, hook) == -1 ||
+	    ngp_id_connect(ctrl, tee, NG_TEE_HOOK_RIGHT, peer, peerhook) == -1) {
+		/* never leave a production link cut, put it back by hand */
+		ng_shutdown_node(ctrl, tee);
+		(void) ngp_id_connect(ctrl, nd, hook, peer, peerhook);
+		errx(ERREXIT, "unable to splice into `%s%s'", pth, hook);
+	}
+
+	/* both sides hold the tee now, let go of it */
+	strlcpy(rmh.ourhook, hold, sizeof(rmh.ourhook));
+	rc = NgSendMsg(ctrl, ".:", NGM_GENERIC_COOKIE, NGM_RMHOOK, &rmh,
+	    sizeof(rmh));
+	if (rc == -1) {
+		ng_shutdown_node(ctrl, tee);
+		err(ERREXIT, "unable to rmhook `%s' from our socket", hold);
+	}
+
+	return (tee);
+}
+
+/* ngp_splice_link() for a single `node:hook', which has to exist */
+ng_ID_t
+ngp_splice(ngctx ctrl, struct ng_cache *c, const char *node, const char *hook)
+{
+	uint32_t ix;
+	ng_ID_t tee;
+	struct hooklist *hlist;
+	struct ng_reply resp = NG_REPLY_INIT(NULL, 0);
+
+	assert(hook != NULL);		assert(strlen(hook) < NG_HOOKSIZ);
+
+	hlist = ngp_listhooks(ctrl, c, node, &resp);
+	for (ix = 0; ix < hlist->nodeinfo.hooks; ix++)
+		if (strcmp(hlist->link[ix].ourhook, hook) == 0)
+			break;
+	if (ix == hlist->nodeinfo.hooks) errx(
+		EX_DATAERR, "`%s:%s' is not connected, nothing to splice into",
+		node, hook
+	);
+
+	tee = ngp_splice_link(ctrl, &hlist->nodeinfo, &hlist->link[ix]);
+	ng_reply_fini(&resp);
+	if (tee == 0) errx(
+		EX_DATAERR, "not splicing into `%s:%s'", node, hook
+	);
+
+	return (tee);
+}
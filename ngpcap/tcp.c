@@ -0,0 +1,429 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ngpcap.h"
+
+/*
+ * TCP health, per flow, while capturing. Nothing is written out but a ranked
+ * summary every `interval' seconds.
+ *
+ * Flows live in an ngp_table. A flow is looked for in NGP_PROBE slots from
+ * where it hashes, and when none of them is free the one idle the longest is
+ * evicted, so memory is bounded no matter what the link carries.
+ *
+ * The tap sees both directions somewhere in the middle. Data sent one way and
+ * acknowledged the other measures the time from the tap to the receiver and
+ * back, adding both directions gives the RTT of the path. The handshake RTT is
+ * SYN to the ACK of the SYN/ACK, and its two halves are the first sample of
+ * each direction, so a flow with data going one way still gets an RTT.
+ * Retransmitted data is never used for a sample (Karn's algorithm).
+ */
+
+#define	TH_FIN		0x01
+#define	TH_SYN		0x02
+#define	TH_RST		0x04
+#define	TH_ACK		0x10
+
+/* sequence space comparisons, as in <netinet/tcp_seq.h> */
+#define	SEQ_LT(a, b)	((int32_t)((a) - (b)) < 0)
+#define	SEQ_LEQ(a, b)	((int32_t)((a) - (b)) <= 0)
+#define	SEQ_GT(a, b)	((int32_t)((a) - (b)) > 0)
+#define	SEQ_GEQ(a, b)	((int32_t)((a) - (b)) >= 0)
+
+/* one direction of a flow, by who sends */
+struct dir {
+	uint32_t	nxt;		/* highest sequence seen, plus 1 */
+	uint32_t	sample;		/* an ack of this ends the sample */
+	uint64_t	sample_ts;	/* 0 when no sample is running */
+	uint32_t	srtt;		/* usec, tap to receiver and back */
+	bool		seen;		/* `nxt' is valid */
+	bool		zero;		/* advertising a zero window */
+	uint64_t	pkts;
+	uint64_t	retx;
+	uint64_t	ooo;
+	uint64_t	zwin;
+};
+
+enum hs { HS_NONE = 0, HS_SYN, HS_SYNACK, HS_DONE };
+
+struct flow {
+	uint32_t	hash;		/* 0 is a free slot */
+	uint8_t		af;
+	uint8_t		hs;		/* enum hs */
+	uint8_t		client;		/* index of whoever sent the SYN */
+	uint16_t	port[2];
+	uint32_t	vni;		/* flows in different overlays differ */
+	uint8_t		addr[2][16];
+	uint64_t	last;		/* nsec */
+	uint64_t	syn_ts;		/* 0 once it can't be used */
+	uint64_t	synack_ts;	/* same */
+	uint32_t	hs_rtt;		/* usec */
+	struct dir	dir[2];		/* dir[0] is sent by addr[0] */
+};
+
+/* what a flow is looked up by, the lower address and port first */
+struct fkey {
+	const struct ngp_pkt	*pkt;
+	const uint8_t		*addr[2];
+	uint16_t		port[2];
+};
+
+static struct {
+	struct ngp_table table;		/* of struct flow */
+	unsigned	top;
+	uint64_t	idle;		/* nsec */
+	uint64_t	now;		/* time of the latest record */
+	uint64_t	evicted;
+	uint64_t	active;
+} T;
+
+static ssize_t
+tcp_init(char *subopts, const struct ngp_source *srcs, int nsrc)
+{
+	unsigned long flows = 65536, top = 10, interval = 10, idle = 120;
+	const struct ngp_mode_opt opts[] = {
+		{ "flows", NGP_PROBE, 1 << 24, &flows },
+		{ "top", 1, 1000, &top },
+		{ "interval", 1, 3600, &interval },
+		{ "idle", 1, 86400, &idle },
+	};
+
+	if (ngp_mode_opts("tcp", subopts, opts, nitems(opts)) != 0)
+		return (-1);
+
+	T.top = top;
+	T.idle = idle * NSEC_PER_SEC;
+	if (ngp_table_init(&T.table, flows, sizeof(struct flow)) != 0) err(
+		EX_OSERR, "tcp: unable to allocate %lu flows", flows
+	);
+	ngp_tick(interval * 1000);
+
+	return (0);
+}
+
+static bool
+same_flow(const void *slot, const void *key)
+{
+	const struct flow *f = slot;
+	const struct fkey *k = key;
+
+	return (f->port[0] == k->port[0] && f->port[1] == k->port[1] &&
+	    f->af == k->pkt->af && f->vni == k->pkt->vni &&
+	    memcmp(f->addr[0], k->addr[0], 16) == 0 &&
+	    memcmp(f->addr[1], k->addr[1], 16) == 0);
+}
+
+static bool
+idle_longer(const void *a, const void *b)
+{
+	return (((const struct flow *)a)->last < ((const struct flow *)b)->last);
+}
+
+/*
+ * The same flow has to be found from either direction, so the key always has
+ * the lower address and port first and `dir' says which way this packet went.
+ */
+static struct flow *
+lookup(const struct ngp_pkt *pkt, uint16_t sport, uint16_t dport, int *dir)
+{
+	struct fkey k = {
+		.pkt = pkt,
+		.addr = { pkt->src, pkt->dst },
+		.port = { sport, dport },
+	};
+	uint64_t h;
+	uint32_t hash;
+	int cmp;
+	void *slot;
+	struct flow *f;
+
+	cmp = memcmp(pkt->src, pkt->dst, sizeof(pkt->src));
+	*dir = (cmp > 0 || (cmp == 0 && sport > dport));
+	if (*dir) {
+		k.addr[0] = pkt->dst, k.addr[1] = pkt->src;
+		k.port[0] = dport, k.port[1] = sport;
+	}
+
+	h = ((uint64_t)pkt->vni << 32 | (uint64_t)k.port[0] << 16 |
+	    k.port[1]) ^ pkt->af;
+	h = ngp_hash_bytes(h, k.addr[0], 16);
+	hash = ngp_slot_hash(ngp_hash_bytes(h, k.addr[1], 16));
+
+	switch (ngp_table_find(&T.table, hash, same_flow, &k, idle_longer,
+	    &slot)) {
+	case NGP_FOUND:
+		return (slot);
+	case NGP_FREE:
+		T.active++;
+		break;
+	case NGP_FULL:
+		T.evicted++;
+		break;
+	}
+	f = slot;
+	memset(f, 0, sizeof(*f));
+	f->hash = hash;
+	f->af = pkt->af;
+	f->vni = pkt->vni;
+	f->port[0] = k.port[0];
+	f->port[1] = k.port[1];
+	memcpy(f->addr[0], k.addr[0], 16);
+	memcpy(f->addr[1], k.addr[1], 16);
+
+	return (f);
+}
+
+static void
+handshake(struct flow *f, int d, uint8_t flags, uint64_t now)
+{
+	struct dir *cl = &f->dir[f->client], *sv = &f->dir[f->client ^ 1];
+
+	switch (flags & (TH_SYN | TH_ACK)) {
+	case TH_SYN:
+		if (f->hs == HS_NONE) {
+			f->hs = HS_SYN;
+			f->client = d;
+			f->syn_ts = now;
+		}
+		break;
+	case TH_SYN | TH_ACK:
+		if (f->hs == HS_SYN && d != f->client) {
+			f->hs = HS_SYNACK;
+			f->synack_ts = now;
+			if (f->syn_ts != 0)
+				cl->srtt = (now - f->syn_ts) / NSEC_PER_USEC;
+		}
+		break;
+	case TH_ACK:
+		if (f->hs == HS_SYNACK && d == f->client) {
+			if (f->syn_ts != 0)
+				f->hs_rtt = (now - f->syn_ts) / NSEC_PER_USEC;
+			if (f->synack_ts != 0)
+				sv->srtt = (now - f->synack_ts) / NSEC_PER_USEC;
+			f->hs = HS_DONE;
+		}
+		break;
+	}
+}
+
+static void
+tcp_packet(const struct ngp_record *rec)
+{
+	struct ngp_pkt pkt;
+	const uint8_t *th;
+	uint32_t seq, ack, off, len, end;
+	uint16_t win;
+	uint8_t flags;
+	int d;
+	bool fresh = false;
+	struct flow *f;
+	struct dir *s, *o;
+
+	if (ngp_parse(rec, &pkt, NGP_PARSE_DEPTH) != 0 ||
+	    pkt.proto != IPPROTO_TCP ||
+	    pkt.l4 == NULL || pkt.l4cap < 20)
+		return;
+	th = pkt.l4;
+	off = (th[12] >> 4) * 4;
+	if (off < 20 || off > pkt.l4len)
+		return;
+	seq = be32(th + 4);
+	ack = be32(th + 8);
+	flags = th[13];
+	win = be16(th + 14);
+	len = pkt.l4len - off;	/* from IP, snaplen doesn't matter */
+
+	T.now = rec->nsec;
+	f = lookup(&pkt, be16(th), be16(th + 2), &d);
+	f->last = rec->nsec;
+	s = &f->dir[d];
+	o = &f->dir[d ^ 1];
+	s->pkts++;
+
+	handshake(f, d, flags, rec->nsec);
+
+	/* SYN and FIN take a sequence number too */
+	end = seq + len + !!(flags & TH_SYN) + !!(flags & TH_FIN);
+	if (end != seq) {
+		if (!s->seen) {
+			s->seen = true;
+			s->nxt = end;
+			fresh = true;
+		} else if (SEQ_LEQ(end, s->nxt) || SEQ_LT(seq, s->nxt)) {
+			/* some or all of it was sent before */
+			s->retx++;
+			if (s->sample_ts != 0 && SEQ_LT(seq, s->sample))
+				s->sample_ts = 0;
+			if ((flags & TH_SYN) && d == f->client)
+				f->syn_ts = 0;
+			else if (flags & TH_SYN)
+				f->synack_ts = 0;
+			if (SEQ_GT(end, s->nxt))
+				s->nxt = end;
+		} else {
+			/* a hole means the tap missed or the sender reordered */
+			if (SEQ_GT(seq, s->nxt))
+				s->ooo++;
+			s->nxt = end;
+			fresh = true;
+		}
+		if (fresh && len != 0 && s->sample_ts == 0) {
+			s->sample = end;
+			s->sample_ts = rec->nsec;
+		}
+	}
+
+	if ((flags & TH_ACK) && o->sample_ts != 0 && SEQ_GEQ(ack, o->sample)) {
+		uint32_t rtt = (rec->nsec - o->sample_ts) / NSEC_PER_USEC;
+
+		/* same smoothing as TCP itself, 1/8 */
+		o->srtt = (o->srtt == 0) ? rtt :
+		    (uint32_t)((int64_t)o->srtt + ((int64_t)rtt - o->srtt) / 8);
+		o->sample_ts = 0;
+	}
+
+	/* a zero window counts once, until it opens again */
+	if ((flags & (TH_SYN | TH_RST)) == 0) {
+		if (win == 0 && !s->zero)
+			s->zwin++;
+		s->zero = (win == 0);
+	}
+}
+
+static uint64_t
+trouble(const struct flow *f)
+{
+	return (f->dir[0].retx + f->dir[1].retx + f->dir[0].ooo +
+	    f->dir[1].ooo + f->dir[0].zwin + f->dir[1].zwin);
+}
+
+static uint32_t
+path_rtt(const struct flow *f)
+{
+	/* only when both halves are known */
+	if (f->dir[0].srtt == 0 || f->dir[1].srtt == 0)
+		return (0);
+	return (f->dir[0].srtt + f->dir[1].srtt);
+}
+
+/* worse first: more trouble, then slower */
+static bool
+worse(const struct flow *a, const struct flow *b)
+{
+	uint64_t ta = trouble(a), tb = trouble(b);
+
+	if (ta != tb)
+		return (ta > tb);
+	return (path_rtt(a) > path_rtt(b));
+}
+
+static void
+endpoint(char *buf, size_t size, const struct flow *f, int ix)
+{
+	char addr[INET6_ADDRSTRLEN];
+
+	(void) inet_ntop(f->af, f->addr[ix], addr, sizeof(addr));
+	snprintf(buf, size, (f->af == AF_INET6) ? "[%s]:%u" : "%s:%u", addr,
+	    f->port[ix]);
+}
+
+static void
+msec(char *buf, size_t size, uint32_t usec)
+{
+	if (usec == 0)
+		snprintf(buf, size, "-");
+	else
+		snprintf(buf, size, "%.2f", usec / 1000.0);
+}
+
+static void
+tcp_tick(void)
+{
+	uint32_t ix;
+	unsigned jx, nrank = 0;
+	struct flow *flows = T.table.slots, *f, **rank;
+	time_t sec = time(NULL);
+	struct tm tm;
+	char when[16];
+
+	rank = calloc(T.top, sizeof(*rank));
+	if (rank == NULL) err(
+		EX_OSERR, "tcp: unable to allocate %u ranks", T.top
+	);
+
+	for (ix = 0; ix <= T.table.mask; ix++) {
+		f = &flows[ix];
+		if (f->hash == 0)
+			continue;
+		if (T.now - f->last > T.idle) {
+			f->hash = 0;
+			T.active--;
+			continue;
+		}
+		/* insertion into a short sorted list */
+		if (nrank == T.top && !worse(f, rank[nrank - 1]))
+			continue;
+		jx = (nrank < T.top) ? nrank++ : nrank - 1;
+		for (; jx > 0 && worse(f, rank[jx - 1]); jx--)
+			rank[jx] = rank[jx - 1];
+		rank[jx] = f;
+	}
+
+	(void) localtime_r(&sec, &tm);
+	(void) strftime(when, sizeof(when), "%H:%M:%S", &tm);
+	(void) printf("%s %" PRIu64 " flows, %" PRIu64 " evicted\n",
+	    when, T.active, T.evicted);
+	(void) printf("%-47s %-47s %8s %6s %6s %5s %8s %8s\n", "client",
+	    "server", "packets", "retx", "ooo", "zwin", "hs ms", "rtt ms");
+
+	for (jx = 0; jx < nrank; jx++) {
+		char cl[64], sv[64], hs[16], rtt[16];
+		int c;
+
+		f = rank[jx];
+		/* without a handshake, who is who is a guess */
+		c = (f->hs != HS_NONE) ? f->client : 0;
+		endpoint(cl, sizeof(cl), f, c);
+		endpoint(sv, sizeof(sv), f, c ^ 1);
+		msec(hs, sizeof(hs), f->hs_rtt);
+		msec(rtt, sizeof(rtt), path_rtt(f));
+		(void) printf("%-47s %-47s %8" PRIu64 " %6" PRIu64 " %6" PRIu64
+		    " %5" PRIu64 " %8s %8s\n", cl, sv,
+		    f->dir[0].pkts + f->dir[1].pkts,
+		    f->dir[0].retx + f->dir[1].retx,
+		    f->dir[0].ooo + f->dir[1].ooo,
+		    f->dir[0].zwin + f->dir[1].zwin, hs, rtt);
+	}
+	(void) printf("\n");
+	free(rank);
+}
+
+static void
+tcp_fini(void)
+{
+	tcp_tick();
+	free(T.table.slots);
+}
+
+const struct ngp_mode ngp_tcp = {
+	.name = "tcp",
+	.usage = "[flows=n][,top=n][,interval=sec][,idle=sec]",
+	.init = tcp_init,
+	.packet = tcp_packet,
+	.tick = tcp_tick,
+	.fini = tcp_fini,
+};
@@ -0,0 +1,384 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <err.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/types.h>
+#include <net/ethernet.h>
+
+#include <netgraph.h>
+
+#include "ngpcap.h"
+
+/*
+ * Trace where a frame goes and how long it takes. A probe is put into the
+ * graph at `at', a free hook that our own ng_socket(4) connects to, every
+ * `interval' and the sources are the taps it is looked for at. Which taps saw
+ * it, in the order of their capture times, is the path it took, printed for
+ * the first probe and whenever it changes.
+ *
+ * Each probe carries a mark, `ngtrace', a token of this run and its
+ * sequence number, which is found wherever it is in the frame so a VLAN tag
+ * or a tunnel added on the way doesn't lose it. A probe's hops are timed from
+ * the first tap that saw it, capture times all come from the kernel, so
+ * nothing depends on when we sent it. Repeating probes gives each tap
+ * percentiles of both that and the time since the hop before it.
+ *
+ * A probe is over when the next one is sent, what is seen of it after that
+ * is counted as late. With `count' the last one is waited for, then we exit
+ * as if interrupted so spliced links are put back.
+ */
+
+#define	PROBE_HOOK	"probe"
+#define	PROBE_TYPE	0x88b5		/* IEEE 802 local experimental */
+#define	MARK_LEN	12		/* "ngtrace\0" and the token */
+
+struct hop {
+	int		src;
+	uint64_t	nsec;		/* capture time */
+};
+
+static struct {
+	ngctx		ctrl;		/* our own, not the capture's */
+	ngctx		data;
+	const struct ngp_source *srcs;
+	int		nsrc;
+	uint8_t		*frame;
+	size_t		size;
+	uint8_t		mark[MARK_LEN];
+	unsigned long	count;		/* 0 until interrupted */
+	uint32_t	seq;		/* of the probe out there */
+	bool		open;		/* it hasn't been finished */
+	struct hop	*hops;
+	int		nhops;
+	int		maxhops;
+	int		*path;		/* sources of the last path printed */
+	int		npath;
+	uint64_t	*seen;		/* of each source */
+	struct ngp_hist	*first;		/* since the first tap */
+	struct ngp_hist	*prev;		/* since the hop before */
+	uint64_t	unseen, late, dropped;
+} T = {
+	.ctrl = -1,
+	.data = -1,
+};
+
+/* our ng_socket(4), connected to `at', which has to be free */
+static void
+connect_at(const char *at)
+{
+	int rc;
+	char *hook;
+	struct ngm_connect msg = { .ourhook = PROBE_HOOK };
+
+	if ((hook = strchr(at, ':')) == NULL || hook == at ||
+	    hook - at > NG_NODELEN || strlen(hook + 1) == 0 ||
+	    strlen(hook + 1) > NG_HOOKLEN) errx(
+		EX_USAGE, "trace: `at' must be node:hook: \"%s\"", at
+	);
+	snprintf(msg.path, sizeof(msg.path), "%.*s:", (int)(hook - at), at);
+	strlcpy(msg.peerhook, hook + 1, sizeof(msg.peerhook));
+
+	if (NgMkSockNode(NULL, &T.ctrl, &T.data) == -1) err(
+		ERREXIT, "trace: unable to create a socket for probes"
+	);
+	rc = NgSendMsg(T.ctrl, ".:", NGM_GENERIC_COOKIE, NGM_CONNECT, &msg,
+	    sizeof(msg));
+	if (rc == -1) err(
+		ERRALT(EX_DATAERR), "trace: unable to connect to `%s', it has "
+		"to be a hook nothing is connected to", at
+	);
+}
+
+/*
+ * dst, ours, PROBE_TYPE and the mark, padded to `size'. Ours is locally
+ * administered and has some of the token in it, a bridge learns it on `at'.
+ */
+static void
+make_frame(const struct ether_addr *dst, size_t size)
+{
+	uint32_t token = arc4random();
+	uint8_t *p;
+
+	if ((T.frame = calloc(1, size)) == NULL) err(
+		EX_OSERR, "trace: unable to allocate a probe"
+	);
+	T.size = size;
+
+	memcpy(T.mark, "ngtrace", 8);
+	memcpy(T.mark + 8, &token, sizeof(token));
+
+	p = T.frame;
+	memcpy(p, dst->octet, ETHER_ADDR_LEN);
+	p += ETHER_ADDR_LEN;
+	p[0] = 0x02;
+	p[1] = 'n';
+	p[2] = 'g';
+	memcpy(p + 3, &token, 3);
+	p += ETHER_ADDR_LEN;
+	p[0] = PROBE_TYPE >> 8;
+	p[1] = PROBE_TYPE & 0xff;
+	memcpy(p + 2, T.mark, sizeof(T.mark));
+}
+
+static ssize_t
+trace_init(char *subopts, const struct ngp_source *srcs, int nsrc)
+{
+	int rc;
+	unsigned long interval = 1000, size = ETHER_MIN_LEN - ETHER_CRC_LEN;
+	const char *at = NULL, *dstopt = NULL;
+	struct ether_addr dst, *ea;
+	const struct ngp_mode_opt opts[] = {
+		{ "at", .string = &at },
+		{ "count", 0, UINT32_MAX, &T.count },
+		{ "interval", 10, 3600000, &interval },
+		{ "dst", .string = &dstopt },
+		{ "size", ETHER_MIN_LEN - ETHER_CRC_LEN,
+		    ETHER_MAX_LEN - ETHER_CRC_LEN, &size },
+	};
+
+	rc = ngp_mode_opts("trace", subopts, opts, nitems(opts));
+	memset(&dst, 0xff, sizeof(dst));
+	if (dstopt != NULL) {
+		if ((ea = ether_aton(dstopt)) == NULL)
+			warnx("trace: `dst' must be an ethernet address: "
+			    "\"%s\"", dstopt), rc--;
+		else
+			dst = *ea;
+	}
+	if (at == NULL)
+		warnx("trace: needs at=node:hook to send probes from"), rc--;
+	/* -r has one source, the file, and nothing to send probes into */
+	if (nsrc > 0 && srcs[0].node[0] == '\0')
+		warnx("trace: can't read a file, the probes are sent live"),
+		    rc--;
+	if (rc != 0)
+		return (-1);
+
+	T.srcs = srcs;
+	T.nsrc = nsrc;
+	/* through every tap there and back, then some */
+	T.maxhops = MAX(nsrc * 4, 64);
+	T.hops = calloc(T.maxhops, sizeof(*T.hops));
+	T.path = calloc(T.maxhops, sizeof(*T.path));
+	T.seen = calloc(nsrc, sizeof(*T.seen));
+	T.first = calloc(nsrc, sizeof(*T.first));
+	T.prev = calloc(nsrc, sizeof(*T.prev));
+	if (T.hops == NULL || T.path == NULL || T.seen == NULL ||
+	    T.first == NULL || T.prev == NULL) err(
+		EX_OSERR, "trace: unable to allocate %d sources", nsrc
+	);
+
+	make_frame(&dst, size);
+	connect_at(at);
+	ngp_tick(interval);
+
+	return (0);
+}
+
+static void
+trace_packet(const struct ngp_record *rec)
+{
+	const uint8_t *p;
+
+	p = memmem(rec->data, rec->caplen, T.mark, sizeof(T.mark));
+	if (p == NULL)
+		return;
+	if (p + sizeof(T.mark) + 4 > rec->data + rec->caplen)
+		return; /* snaplen cut the sequence number off */
+
+	if (!T.open || be32(p + sizeof(T.mark)) != T.seq) {
+		T.late++;
+		return;
+	}
+	if (T.nhops == T.maxhops) {
+		T.dropped++;
+		return;
+	}
+	T.hops[T.nhops++] = (struct hop){ .src = rec->src, .nsec = rec->nsec };
+}
+
+/*
+ * The taps are separate ng_pcap(4) and their records arrive in whatever
+ * order, put them in capture order. There are only a few.
+ */
+static void
+sort_hops(void)
+{
+	int ix, jx;
+	struct hop h;
+
+	for (ix = 1; ix < T.nhops; ix++) {
+		h = T.hops[ix];
+		for (jx = ix; jx > 0 && T.hops[jx - 1].nsec > h.nsec; jx--)
+			T.hops[jx] = T.hops[jx - 1];
+		T.hops[jx] = h;
+	}
+}
+
+static bool
+same_path(void)
+{
+	int ix;
+
+	if (T.npath != T.nhops)
+		return (false);
+	for (ix = 0; ix < T.nhops; ix++)
+		if (T.path[ix] != T.hops[ix].src)
+			return (false);
+	return (true);
+}
+
+static void
+finish(void)
+{
+	int ix;
+	uint64_t since, delta;
+	bool print;
+
+	T.open = false;
+	if (T.nhops == 0) {
+		T.unseen++;
+		(void) printf("probe %" PRIu32 ": not seen\n", T.seq);
+		T.npath = 0;
+		return;
+	}
+
+	sort_hops();
+	if ((print = !same_path()))
+		(void) printf("probe %" PRIu32 ": %d hops\n", T.seq, T.nhops);
+	for (ix = 0; ix < T.nhops; ix++) {
+		const struct hop *h = &T.hops[ix];
+
+		since = h->nsec - T.hops[0].nsec;
+		delta = (ix == 0) ? 0 : h->nsec - T.hops[ix - 1].nsec;
+		T.seen[h->src]++;
+		ngp_hist_add(&T.first[h->src], since);
+		if (ix > 0)
+			ngp_hist_add(&T.prev[h->src], delta);
+		if (print)
+			(void) printf("  %2d %10.1f usec  +%-9.1f %s\n", ix,
+			    (double)since / NSEC_PER_USEC,
+			    (double)delta / NSEC_PER_USEC,
+			    T.srcs[h->src].label);
+		T.path[ix] = h->src;
+	}
+	T.npath = T.nhops;
+	T.nhops = 0;
+}
+
+static void
+trace_tick(void)
+{
+	int rc;
+
+	if (T.open)
+		finish();
+	if (T.count != 0 && T.seq == T.count) {
+		/* the signal path of main.c puts everything back */
+		(void) raise(SIGTERM);
+		return;
+	}
+
+	T.seq++;
+	T.frame[2 * ETHER_ADDR_LEN + 2 + sizeof(T.mark)] = T.seq >> 24;
+	T.frame[2 * ETHER_ADDR_LEN + 3 + sizeof(T.mark)] = T.seq >> 16;
+	T.frame[2 * ETHER_ADDR_LEN + 4 + sizeof(T.mark)] = T.seq >> 8;
+	T.frame[2 * ETHER_ADDR_LEN + 5 + sizeof(T.mark)] = T.seq;
+	T.open = true;
+
+	rc = NgSendData(T.data, PROBE_HOOK, T.frame, T.size);
+	if (rc == -1) err(
+		ERREXIT, "trace: unable to send probe %" PRIu32, T.seq
+	);
+}
+
+/* taps in the order probes usually get to them */
+static int
+cmp_taps(const void *a, const void *b)
+{
+	int l = *(const int *)a, r = *(const int *)b;
+	uint64_t lp = ngp_hist_percentile(&T.first[l], 50);
+	uint64_t rp = ngp_hist_percentile(&T.first[r], 50);
+
+	if (lp != rp)
+		return (lp < rp) ? -1 : 1;
+	if (T.seen[l] != T.seen[r])
+		return (T.seen[l] > T.seen[r]) ? -1 : 1;
+	return (l - r);
+}
+
+static void
+trace_fini(void)
+{
+	int ix, n, *order;
+	const struct ngp_hist *f, *p;
+
+	if (T.open)
+		finish();
+
+	(void) printf("%" PRIu32 " probes, %" PRIu64 " not seen, %" PRIu64
+	    " late, %" PRIu64 " hops dropped\n", T.seq, T.unseen, T.late,
+	    T.dropped);
+
+	if ((order = calloc(MAX(T.nsrc, 1), sizeof(*order))) != NULL) {
+		for (ix = n = 0; ix < T.nsrc; ix++)
+			if (T.seen[ix] != 0)
+				order[n++] = ix;
+		qsort(order, n, sizeof(*order), cmp_taps);
+
+		/* usec since the first tap, then since the hop before */
+		if (n != 0)
+			(void) printf("%-32s %8s  %6s %6s %6s %7s  %6s %6s\n",
+			    "TAP", "SEEN", "P50", "P90", "P99", "MAX", "HOP50",
+			    "HOP99");
+		for (ix = 0; ix < n; ix++) {
+			f = &T.first[order[ix]];
+			p = &T.prev[order[ix]];
+			(void) printf("%-32s %8" PRIu64 "  %6.1f %6.1f %6.1f "
+			    "%7.1f  ", T.srcs[order[ix]].label,
+			    T.seen[order[ix]],
+			    ngp_hist_percentile(f, 50) / 1e3,
+			    ngp_hist_percentile(f, 90) / 1e3,
+			    ngp_hist_percentile(f, 99) / 1e3, f->max / 1e3);
+			if (p->n == 0)
+				(void) printf("%6s %6s\n", "-", "-");
+			else
+				(void) printf("%6.1f %6.1f\n",
+				    ngp_hist_percentile(p, 50) / 1e3,
+				    ngp_hist_percentile(p, 99) / 1e3);
+		}
+		free(order);
+	}
+
+	/* closing both shuts the socket node down, `at' is free again */
+	if (T.ctrl != -1)
+		(void) close(T.ctrl);
+	if (T.data != -1)
+		(void) close(T.data);
+	free(T.frame);
+	free(T.hops);
+	free(T.path);
+	free(T.seen);
+	free(T.first);
+	free(T.prev);
+}
+
+const struct ngp_mode ngp_trace = {
+	.name = "trace",
+	.usage = "at=node:hook[,count=n][,interval=msec][,dst=mac]"
+	    "[,size=bytes]",
+	.init = trace_init,
+	.packet = trace_packet,
+	.tick = trace_tick,
+	.fini = trace_fini,
+};
@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <err.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <netgraph/ng_tee.h>
+
+#include "ngpcap.h"
+
+/*
+ * Transit through a node (a bridge, a wormhole pair, ng_ula4tag) between two
+ * taps: the first source is where packets go in, the second where they come
+ * out. With `link:' specs each tee already says which way, what the node gets
+ * goes in and what it sends comes out, so two links of a bridge are both
+ * directions at once. The same packet is recognized going in and coming out
+ * by a hash of what the node doesn't change, and the difference of its two
+ * capture times is how long it spent in there. A packet that went in and
+ * didn't come out within `window' was lost, and is printed so you know which.
+ *
+ * The hash covers the outermost IP header without what forwarding changes
+ * (TOS, TTL or hop limit, checksum) and up to HASH_PAYLOAD bytes after it, so
+ * the IP ID, ports and sequence numbers are part of it. Other packets are
+ * hashed from the ethertype on. MAC addresses never are.
+ *
+ * Packets wait in a fixed size table for their other half, whichever tap saw
+ * it first. Slots come in groups of NGP_PROBE whose hashes share a cache
+ * line, so a lookup costs that one line until it hits; capture times and what
+ * is printed about a lost packet are kept apart and only touched on a hit or
+ * an insert. A full group evicts its oldest, which was lost if it waited
+ * longer than `window' and is counted as evicted otherwise. Memory is bounded
+ * however fast packets come.
+ *
+ * Transit times go into an ngp_hist, so percentiles are good to 12.5%.
+ */
+
+#define	HASH_PAYLOAD	64
+
+#define	SIDE_IN		0		/* the low bit of a key */
+#define	SIDE_OUT	1
+
+/* enough to tell which packet was lost */
+struct tpkt {
+	uint8_t		af;		/* 0 when it isn't IP */
+	uint8_t		proto;
+	uint16_t	port[2];
+	uint32_t	len;
+	uint8_t		addr[2][16];
+};
+
+static struct {
+	uint8_t		*side;		/* of each source */
+	uint64_t	*keys;		/* hash | side, 0 is a free slot */
+	uint64_t	*ts;		/* capture time, nsec */
+	struct tpkt	*pkts;
+	uint32_t	mask;
+	uint64_t	window;		/* nsec */
+	unsigned	samples;
+	unsigned	shown;		/* lost packets printed this interval */
+	uint64_t	now;		/* time of the latest record */
+	uint64_t	waiting;
+	struct ngp_hist	tick;		/* this interval */
+	struct ngp_hist	all;
+	uint64_t	lost, only_out, evicted;	/* this interval */
+	uint64_t	tlost, tonly_out, tevicted;
+} X;
+
+static ssize_t
+transit_init(char *subopts, const struct ngp_source *srcs, int nsrc)
+{
+	int ix, nlink = 0, rc;
+	unsigned long pkts = 65536, window = 1000, interval = 10, samples = 5;
+	uint32_t lg;
+	const struct ngp_mode_opt opts[] = {
+		{ "pkts", NGP_PROBE, 1 << 24, &pkts },
+		{ "window", 1, 60000, &window },
+		{ "interval", 1, 3600, &interval },
+		{ "samples", 0, 1000000, &samples },
+	};
+
+	rc = ngp_mode_opts("transit", subopts, opts, nitems(opts));
+	for (ix = 0; ix < nsrc; ix++)
+		nlink += (strcmp(srcs[ix].hook, NG_TEE_HOOK_LEFT2RIGHT) == 0 ||
+		    strcmp(srcs[ix].hook, NG_TEE_HOOK_RIGHT2LEFT) == 0);
+	if (!(nlink == 0 && nsrc == 2) && !(nlink == nsrc && nsrc >= 4))
+		warnx("transit: needs 2 sources, in then out, or 2 links or "
+		    "more"), rc--;
+	if (rc != 0)
+		return (-1);
+
+	X.side = calloc(nsrc, sizeof(*X.side));
+	if (X.side == NULL) err(
+		EX_OSERR, "transit: unable to allocate %d sources", nsrc
+	);
+	for (ix = 0; ix < nsrc; ix++)
+		X.side[ix] = (nlink == 0) ? ix :
+		    (strcmp(srcs[ix].hook, NG_TEE_HOOK_RIGHT2LEFT) == 0) ?
+		    SIDE_IN : SIDE_OUT;
+
+	/* not an ngp_table, the hashes are kept apart from the rest */
+	lg = ngp_table_size(pkts);
+	X.mask = lg - 1;
+	X.window = window * NSEC_PER_MSEC;
+	X.samples = samples;
+	/* a group of hashes is a cache line */
+	X.keys = aligned_alloc(NGP_PROBE * sizeof(*X.keys),
+	    lg * sizeof(*X.keys));
+	X.ts = calloc(lg, sizeof(*X.ts));
+	X.pkts = calloc(lg, sizeof(*X.pkts));
+	if (X.keys == NULL || X.ts == NULL || X.pkts == NULL) err(
+		EX_OSERR, "transit: unable to allocate %u packets", lg
+	);
+	memset(X.keys, 0, lg * sizeof(*X.keys));
+	ngp_tick(interval * 1000);
+
+	return (0);
+}
+
+/* what both taps have to agree on, and what to say if it is lost */
+static uint64_t
+fingerprint(const struct ngp_record *rec, struct tpkt *tp)
+{
+	struct ngp_pkt pkt;
+	const uint8_t *l3;
+	uint8_t fixed[38];
+	uint32_t hlen, iplen, cap, nfixed;
+	uint64_t h;
+
+	memset(tp, 0, sizeof(*tp));
+	tp->len = rec->len;
+
+	if (ngp_parse(rec, &pkt, 0) != 0) {
+		if (rec->caplen <= 12)
+			return ngp_mix(0, rec->caplen);
+		return ngp_hash_bytes(0, rec->data + 12,
+		    MIN(rec->caplen - 12, 2 + HASH_PAYLOAD));
+	}
+
+	l3 = pkt.l3;
+	cap = rec->caplen - (uint32_t)(l3 - rec->data);
+	if (pkt.af == AF_INET) {
+		hlen = (l3[0] & 0x0f) * 4;
+		iplen = be16(l3 + 2);
+		memcpy(fixed, l3 + 2, 6);	/* length, ID, fragment */
+		fixed[6] = l3[9];		/* protocol */
+		memcpy(fixed + 7, l3 + 12, 8);	/* addresses */
+		nfixed = 15;
+	} else {
+		hlen = 40;
+		iplen = be16(l3 + 4) + hlen;
+		memcpy(fixed, l3 + 1, 6);	/* flow label, length, next */
+		fixed[0] &= 0x0f;		/* without traffic class */
+		memcpy(fixed + 6, l3 + 8, 32);	/* addresses */
+		nfixed = 38;
+	}
+	h = ngp_hash_bytes(pkt.af, fixed, nfixed);
+	/* ethernet pads short packets, that isn't the packet */
+	if (iplen > hlen && cap > hlen)
+		h = ngp_hash_bytes(h, l3 + hlen,
+		    MIN(MIN(iplen, cap) - hlen, HASH_PAYLOAD));
+
+	tp->af = pkt.af;
+	tp->proto = pkt.proto;
+	memcpy(tp->addr[0], pkt.src, sizeof(tp->addr[0]));
+	memcpy(tp->addr[1], pkt.dst, sizeof(tp->addr[1]));
+	if ((pkt.proto == IPPROTO_TCP || pkt.proto == IPPROTO_UDP) &&
+	    pkt.l4 != NULL && pkt.l4cap >= 4) {
+		tp->port[0] = be16(pkt.l4);
+		tp->port[1] = be16(pkt.l4 + 2);
+	}
+
+	return (h);
+}
+
+static void
+stamp(char *buf, size_t size, uint64_t nsec)
+{
+	time_t sec = nsec / NSEC_PER_SEC;
+	struct tm tm;
+	char hms[16];
+
+	(void) localtime_r(&sec, &tm);
+	(void) strftime(hms, sizeof(hms), "%H:%M:%S", &tm);
+	snprintf(buf, size, "%s.%06" PRIu64, hms,
+	    (nsec % NSEC_PER_SEC) / NSEC_PER_USEC);
+}
+
+static void
+endpoint(char *buf, size_t size, const struct tpkt *tp, int ix)
+{
+	char addr[INET6_ADDRSTRLEN];
+
+	(void) inet_ntop(tp->af, tp->addr[ix], addr, sizeof(addr));
+	if (tp->port[0] == 0 && tp->port[1] == 0)
+		snprintf(buf, size, "%s", addr);
+	else
+		snprintf(buf, size, (tp->af == AF_INET6) ? "[%s]:%u" : "%s:%u",
+		    addr, tp->port[ix]);
+}
+
+static void
+sample(uint32_t slot)
+{
+	const struct tpkt *tp = &X.pkts[slot];
+	char when[32], src[64], dst[64];
+
+	if (X.shown >= X.samples)
+		return;
+	X.shown++;
+
+	stamp(when, sizeof(when), X.ts[slot]);
+	if (tp->af == 0) {
+		(void) printf("lost: %s not IP, length %u\n", when, tp->len);
+		return;
+	}
+	endpoint(src, sizeof(src), tp, 0);
+	endpoint(dst, sizeof(dst), tp, 1);
+	(void) printf("lost: %s proto %u %s > %s length %u\n", when, tp->proto,
+	    src, dst, tp->len);
+}
+
+/* `slot' is done waiting, lost if it went in and never came out */
+static void
+expire(uint32_t slot, bool evict)
+{
+	bool late = X.now > X.ts[slot] && X.now - X.ts[slot] > X.window;
+
+	if (evict && !late)
+		X.evicted++;
+	else if ((X.keys[slot] & 1) == SIDE_OUT)
+		X.only_out++;
+	else {
+		X.lost++;
+		sample(slot);
+	}
+	X.keys[slot] = 0;
+	X.waiting--;
+}
+
+static void
+transit_packet(const struct ngp_record *rec)
+{
+	struct tpkt tp;
+	uint64_t key, other, in, out, *grp;
+	uint32_t base, ix, slot, empty = NGP_PROBE;
+	uint8_t side = X.side[rec->src];
+
+	X.now = rec->nsec;
+	key = (fingerprint(rec, &tp) & ~(uint64_t)3) | 2 | side;
+	other = key ^ 1;
+	base = (uint32_t)(key >> 32) & X.mask & ~(uint32_t)(NGP_PROBE - 1);
+	grp = &X.keys[base];
+
+	for (ix = 0; ix < NGP_PROBE; ix++) {
+		/* too late to be this one, a packet the same as one lost */
+		if (grp[ix] == other && rec->nsec > X.ts[base + ix] &&
+		    rec->nsec - X.ts[base + ix] > X.window)
+			expire(base + ix, false);
+		if (grp[ix] == other) {
+			slot = base + ix;
+			in = (side == SIDE_IN) ? rec->nsec : X.ts[slot];
+			out = (side == SIDE_OUT) ? rec->nsec : X.ts[slot];
+			/* the two taps are different sockets, don't trust order */
+			ngp_hist_add(&X.tick, (out > in) ? out - in : 0);
+			grp[ix] = 0;
+			X.waiting--;
+			return;
+		}
+		if (grp[ix] == 0 && empty == NGP_PROBE)
+			empty = ix;
+	}
+
+	if (empty == NGP_PROBE) {
+		for (ix = empty = 0; ix < NGP_PROBE; ix++)
+			if (X.ts[base + ix] < X.ts[base + empty])
+				empty = ix;
+		expire(base + empty, true);
+	}
+	slot = base + empty;
+	X.keys[slot] = key;
+	X.ts[slot] = rec->nsec;
+	X.pkts[slot] = tp;
+	X.waiting++;
+}
+
+static void
+report(const char *what, const struct ngp_hist *h, uint64_t lost,
+    uint64_t only_out, uint64_t evicted)
+{
+	(void) printf("%s %" PRIu64 " matched", what, h->n);
+	if (h->n != 0)
+		(void) printf(", usec p50 %.1f p90 %.1f p99 %.1f max %.1f",
+		    ngp_hist_percentile(h, 50) / 1e3,
+		    ngp_hist_percentile(h, 90) / 1e3,
+		    ngp_hist_percentile(h, 99) / 1e3, h->max / 1e3);
+	(void) printf(", %" PRIu64 " lost, %" PRIu64 " only out, %" PRIu64
+	    " evicted, %" PRIu64 " waiting\n", lost, only_out, evicted,
+	    X.waiting);
+}
+
+static void
+transit_tick(void)
+{
+	uint32_t ix;
+	time_t sec = time(NULL);
+	struct tm tm;
+	char when[16];
+
+	for (ix = 0; ix <= X.mask; ix++)
+		if (X.keys[ix] != 0 && X.now > X.ts[ix] &&
+		    X.now - X.ts[ix] > X.window)
+			expire(ix, false);
+
+	(void) localtime_r(&sec, &tm);
+	(void) strftime(when, sizeof(when), "%H:%M:%S", &tm);
+	report(when, &X.tick, X.lost, X.only_out, X.evicted);
+
+	ngp_hist_merge(&X.all, &X.tick);
+	memset(&X.tick, 0, sizeof(X.tick));
+	X.tlost += X.lost;
+	X.tonly_out += X.only_out;
+	X.tevicted += X.evicted;
+	X.lost = X.only_out = X.evicted = 0;
+	X.shown = 0;
+}
+
+static void
+transit_fini(void)
+{
+	transit_tick();
+	report("total", &X.all, X.tlost, X.tonly_out, X.tevicted);
+	free(X.side);
+	free(X.keys);
+	free(X.ts);
+	free(X.pkts);
+}
+
+const struct ngp_mode ngp_transit = {
+	.name = "transit",
+	.usage = "[pkts=n][,window=msec][,interval=sec][,samples=n]",
+	.init = transit_init,
+	.packet = transit_packet,
+	.tick = transit_tick,
+	.fini = transit_fini,
+};
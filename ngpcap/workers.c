@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <assert.h>
+#include <err.h>
+#include <pthread.h>
+#include <pthread_np.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/cpuset.h>
+#include <sys/event.h>
+#include <sys/param.h>
+
+#include <netgraph/ng_pcap.h>
+
+#include "ring32.h"
+#include "ngpcap.h"
+
+/*
+ * Capture threads (-T). One data socket is read by one core no matter how
+ * many sources it has, so every thread gets sources of its own: its own
+ * netgraph(4) socket, its own ng_pcap(4) for them, and its own ring32. Threads
+ * are pinned to a CPU each and do nothing but read(2) into their ring. The
+ * rings all come out of one ring32_pool.
+ *
+ * Records come together only at the writer, the main thread. A ring is only
+ * ever appended to by its thread and only consumed by the writer, the lock
+ * just makes the indices safe to look at from the other side. It is never
+ * held over a system call. A thread wakes the writer through EVFILT_USER when
+ * its ring goes from empty to not, and waits for the writer when its ring is
+ * too full to take another record.
+ *
+ * Each thread reads whole datagrams, so whatever is in a ring is whole
+ * records and the writer can take all of it in one write(2). Records of
+ * different threads are interleaved as they arrive, not sorted by time.
+ */
+
+struct worker {
+	pthread_t	thread;
+	int		cpu;
+	ngctx		ctrl;
+	ngctx		data;
+	ng_ID_t		*pcaps;		/* NG_PCAP_MAX_LINKS sources each */
+	int		npcap;
+	struct ring32	ring;
+	pthread_mutex_t	lock;		/* `ring' indices, `filehdr' */
+	pthread_cond_t	room;		/* the writer made some */
+	bool		hdr;		/* `filehdr' was read */
+	uint8_t		filehdr[PCAP_FILEHDR_LEN];
+};
+
+static struct {
+	struct worker	*w;
+	int		nw;
+	int		kq;
+	struct ring32_pool pool;
+	int32_t		snaplen;
+	bool		hdr;		/* one file header went out */
+} W = {
+	.kq = -1,
+};
+
+static void
+wake_writer(void)
+{
+	struct kevent evt;
+
+	EV_SET(&evt, NGP_WORKER_EVENT, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+	if (kevent(W.kq, &evt, 1, NULL, 0, NULL) == -1) err(
+		ERRALT(EX_OSERR), "kevent: unable to wake writer"
+	);
+}
+
+static void *
+worker_main(void *arg)
+{
+	struct worker *w = arg;
+	cpuset_t set;
+	size_t count;
+	ssize_t rc;
+	void *buf;
+	bool was_empty;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+		warnx("unable to pin a capture thread to cpu %d", w->cpu);
+
+	for (;;) {
+		pthread_mutex_lock(&w->lock);
+		while (ring32_free(&w->ring) < W.snaplen + PCAP_RECHDR_LEN)
+			pthread_cond_wait(&w->room, &w->lock);
+		buf = ring32_read_buffer(&w->ring, &count);
+		pthread_mutex_unlock(&w->lock);
+
+		/* the writer doesn't touch free space, no lock needed */
+		rc = read(w->data, buf, count);
+		if (rc == -1 && errno == EINTR)
+			continue;
+		if (rc == -1) err(
+			ERRALT(EX_OSERR), "unable to read from ng_pcap(4)"
+		);
+
+		pthread_mutex_lock(&w->lock);
+		if (ngp_file_header(buf, rc)) {
+			if (!w->hdr) {
+				ngp_fix_file_header(buf, W.snaplen);
+				memcpy(w->filehdr, buf, sizeof(w->filehdr));
+			}
+			w->hdr = true;
+			rc = 0;
+		}
+		was_empty = ring32_empty(&w->ring);
+		(void) ring32_read_advance(&w->ring, rc);
+		pthread_mutex_unlock(&w->lock);
+
+		if (was_empty && rc > 0)
+			wake_writer();
+	}
+
+	return (NULL);
+}
+
+/* a write that isn't done until all of it went out, or it failed */
+int
+ngp_write_all(int fd, const uint8_t *buf, size_t count)
+{
+	ssize_t rc;
+
+	while (count > 0) {
+		rc = write(fd, buf, count);
+		if (rc == -1 && errno == EINTR)
+			continue;
+		if (rc == -1)
+			return (-1);
+		buf += rc;
+		count -= rc;
+	}
+	return (0);
+}
+
+/*
+ * Give `nsrcs' sources to `nw' threads, round robin, connect every thread's
+ * ng_pcap(4) to its own socket and start them. NGP_WORKER_EVENT has to be on
+ * `kq' already.
+ */
+void
+ngp_workers_init(int nw, const struct ngp_source *srcs, int nsrcs,
+    int32_t snaplen, uint8_t lgpages, int kq)
+{
+	int ix, jx, ncpu, rc;
+	struct worker *w;
+
+	assert(nw > 0 && nw <= nsrcs);
+
+	W.kq = kq;
+	W.snaplen = snaplen;
+	W.w = calloc(nw, sizeof(*W.w));
+	if (W.w == NULL) err(
+		ERRALT(EX_OSERR), "unable to allocate %d threads", nw
+	);
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu < 1)
+		ncpu = 1;
+	if (ring32_pool_init(&W.pool, lgpages,
+	    ((size_t)getpagesize() << lgpages) * nw) == -1) err(
+		ERRALT(EX_OSERR), "unable to initialize buffers"
+	);
+
+	for (ix = 0; ix < nw; ix++) {
+		int nmine = (nsrcs - ix + nw - 1) / nw;
+
+		w = &W.w[ix];
+		w->ctrl = w->data = -1;
+		w->cpu = ix % ncpu;
+		pthread_mutex_init(&w->lock, NULL);
+		pthread_cond_init(&w->room, NULL);
+
+		/* unnamed, ng_create_context() names after our pid */
+		if (NgMkSockNode(NULL, &w->ctrl, &w->data) == -1) err(
+			ERREXIT, "unable to create socket for thread %d", ix
+		);
+		if (ring32_pool_get(&W.pool, &w->ring) == -1) err(
+			ERRALT(EX_OSERR), "unable to initialize buffer"
+		);
+
+		w->pcaps = calloc(nmine, sizeof(*w->pcaps));
+		if (w->pcaps == NULL) err(
+			ERRALT(EX_OSERR), "unable to allocate %d ng_pcap", nmine
+		);
+		W.nw++; /* ngp_workers_fini() looks at this one from now on */
+
+		/*
+		 * Sources ix, ix + nw, ix + 2 * nw, ... `npcap' is set twice on
+		 * purpose: ngp_workers_fini() reads it from inside
+		 * ngp_connect_srcs() when that fails and exits, and then every
+		 * slot is one to shut down, 0 if it wasn't made yet.
+		 */
+		w->npcap = nmine;
+		w->npcap = ngp_connect_srcs(w->ctrl, &srcs[ix], nmine, nw,
+		    NG_PCAP_MAX_LINKS, w->pcaps);
+		for (jx = 0; jx < w->npcap; jx++) {
+			char hook[NG_HOOKSIZ];
+
+			snprintf(hook, sizeof(hook), "pcap%d", jx);
+			ngp_connect_snp(w->ctrl, w->pcaps[jx], ".", hook);
+		}
+	}
+
+	for (ix = 0; ix < nw; ix++) {
+		rc = pthread_create(&W.w[ix].thread, NULL, worker_main,
+		    &W.w[ix]);
+		if (rc != 0) {
+			errno = rc;
+			err(ERRALT(EX_OSERR), "unable to start thread %d", ix);
+		}
+	}
+}
+
+/*
+ * The writer, called on NGP_WORKER_EVENT. One pass over the threads, then
+ * back to kevent(2) so signals aren't starved. A thread that added to a ring
+ * that wasn't empty didn't wake us, so while there was something to write we
+ * wake ourselves for another pass. Returns -1 with `errno' when `fd' can't be
+ * written.
+ */
+int
+ngp_workers_output(int fd)
+{
+	int ix;
+	bool wrote = false;
+	size_t count;
+	uint8_t *buf;
+	struct worker *w;
+
+	for (ix = 0; ix < W.nw; ix++) {
+		w = &W.w[ix];
+
+		pthread_mutex_lock(&w->lock);
+		buf = ring32_write_buffer(&w->ring, &count);
+		pthread_mutex_unlock(&w->lock);
+		if (count == 0)
+			continue;
+
+		/* a record in a ring means its file header came first */
+		if (!W.hdr) {
+			if (ngp_write_all(fd, w->filehdr,
+			    sizeof(w->filehdr)) == -1)
+				return (-1);
+			W.hdr = true;
+		}
+		if (ngp_write_all(fd, buf, count) == -1)
+			return (-1);
+		wrote = true;
+
+		pthread_mutex_lock(&w->lock);
+		(void) ring32_write_advance(&w->ring, count);
+		pthread_cond_signal(&w->room);
+		pthread_mutex_unlock(&w->lock);
+	}
+	if (wrote)
+		wake_writer();
+
+	return (0);
+}
+
+/*
+ * From err_cleanup. Threads are left running, blocked in read(2), and die with
+ * the process. Their sockets and rings stay for the same reason.
+ */
+void
+ngp_workers_fini(ngctx ctrl)
+{
+	struct worker *w;
+
+	while (W.nw > 0) {
+		w = &W.w[--W.nw];
+		/* while connecting `npcap' is every slot, 0 if not made yet */
+		while (w->npcap > 0)
+			if (w->pcaps[--w->npcap] != 0)
+				ng_shutdown_node(ctrl, w->pcaps[w->npcap]);
+	}
+}
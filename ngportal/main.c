@@ -48,9 +48,11 @@ Usage(const char *format, ...)
 	 * mysterious than they will ever know.
 	 */
 	(void) fprintf(stderr,
-	    "USAGE: " ME " [-n] [-j jail] spec1 [spec2]\n"
+	    "USAGE: " ME " [-nr] [-j jail] spec1 [spec2]\n"
 	    "-n\tDisable automatic loading of netgraph(4) kernel modules.\n"
-	    "-j jail\tSwitch to jail for all references.\n\n"
+	    "-j jail\tSwitch to jail for all references.\n"
+	    "-r\tReopen the wormhole named by the spec without a jail if it\n"
+	    "\tis still here, after the jail of its other side restarted.\n\n"
 	    "You provide 2 wormhole specifications (components of which are\n"
 	    "separated by colons). The wormhole spec componentes are:\n"
 	    "\t[jail][:name][:node:hook]\n"
@@ -210,7 +212,7 @@ int
 main(int argc, char **argv)
 {
 	int  ix, ch, rc = 0;
-	bool load_kmod = true, attached = false;
+	bool load_kmod = true, attached = false, reuse = false, connected;
 
 	int		jids[2] = {0};
 	struct wh_spec	spec_storage[2]; // don't access, use whs
@@ -218,10 +220,12 @@ main(int argc, char **argv)
 	struct wh_spec	*ws;
 	
 	ng_ID_t farside; /* for side(s) we open */
+	ng_ID_t nearside; /* for -r, not ours to clean up */
+	struct ng_cache nodes = { 0 }; /* for -r, finding our side */
 
 	setvbuf(stdout, NULL, _IONBF, BUFSIZ);
 
-	while ((ch = getopt_long(argc, argv, ":nj:", NULL, NULL)) != -1) {
+	while ((ch = getopt_long(argc, argv, ":nj:r", NULL, NULL)) != -1) {
 		switch (ch) {
 		case 'j': {
 			int jid;
@@ -243,6 +247,9 @@ main(int argc, char **argv)
 		case 'n':
 			load_kmod = 0; /* user asked not to */
 			break;
+		case 'r':
+			reuse = true;
+			break;
 		default:
 			Usage(ME ": unrecognized option `%s'\n\n",
 			    argv[optind - 1]);
@@ -297,6 +304,10 @@ main(int argc, char **argv)
 	if (jids[0] == jids[1])
 		Usage( ME ": duplicate jail reference detected\n\n");
 
+	/* only the side here outlives a jail restart */
+	if (reuse && (jids[1] != 0 || whs[1]->name == NULL))
+		Usage(ME ": -r needs a named spec without a jail\n\n");
+
 	/*
 	 * Unless told not to (or we definitely are in a jail) try to make sure
 	 * we have modules loaded.
@@ -309,6 +320,25 @@ main(int argc, char **argv)
 	ng_create_context(&G.fd, NULL);	/* open netgraph socket */
 	err_set_exit(err_cleanup);	/* and now set up error cleanup */
 
+	/*
+	 * A jail restart leaves our side as it was, connected to whatever it
+	 * was. Only the other side has to be made again, in the new vnet.
+	 * Without a wormhole to reopen this is like any other first time.
+	 */
+	ws = whs[1];
+	nearside = reuse ? wh_find(G.fd, &nodes, ws->name, &connected) : 0;
+	ng_cache_fini(&nodes);
+	if (nearside != 0) {
+		farside = wh_reopen(G.fd, nearside, whs[0]->jail);
+		jail_name_connect(
+			jids[0], farside, whs[0]->name, whs[0]->node,
+			whs[0]->hook
+		);
+		if (!connected)
+			wh_connect(G.fd, nearside, ws->node, ws->hook);
+		return (0);
+	}
+
 	/* this one is always created and opened etc. */
 	G.wh[0] = wh_create(G.fd);
 	ws = whs[0];
@@ -24,3 +24,5 @@ ng_ID_t	 wh_create(ngctx);
 ng_ID_t	 wh_open(ngctx, ng_ID_t, const char *);
 void	 wh_name(ngctx, ng_ID_t, const char *);
 void	 wh_connect(ngctx, ng_ID_t, const char *, const char *);
+ng_ID_t	 wh_find(ngctx, struct ng_cache *, const char *, bool *);
+ng_ID_t	 wh_reopen(ngctx, ng_ID_t, const char *);
@@ -23,7 +23,11 @@ wh_create(ngctx ctrl)
 {
 #	define	OURHK	"tmp"
 	int rc;
-	struct ng_mesg *resp;
+	union {
+		struct ng_mesg	msg;
+		char		buf[NG_REPLYSIZ(sizeof(struct nodeinfo))];
+	} u;
+	struct ng_reply resp = NG_REPLY_INIT(&u, sizeof(u));
 	struct ngm_mkpeer msg = {
 		.type = NG_WORMHOLE_NODE_TYPE,
 		.ourhook = OURHK,
@@ -47,7 +51,7 @@ wh_create(ngctx ctrl)
 		ERREXIT, "unable to request %s info, presumed dead", msg.type
 	);
 
-	rc = NgAllocRecvMsg(ctrl, &resp, NULL);
+	rc = ng_recv_msg(ctrl, &resp, NULL);
 	if (rc == -1) err(
 		ERREXIT, "unable to retrieve %s info, presumed dead", msg.type
 	);
@@ -55,8 +59,8 @@ wh_create(ngctx ctrl)
 	/*
 	 * This warns about structure alignment but is also done in ngctl(8).
 	 */
-	nd = ((struct nodeinfo *) resp->data)->id;
-	free(resp);
+	nd = ((struct nodeinfo *) resp.msg->data)->id;
+	ng_reply_fini(&resp);
 
 	/* valid netgraph IDs start at 1 */
 	if (nd == 0) err(
@@ -146,16 +150,26 @@ generic_err:
 	}
 }
 
+/*
+ * Open `wh' in `jail', returning the ID of the wormhole that made there, the
+ * other side. Whatever `wh' has connected to its event horizon stays, which is
+ * all there is to it for a `wh' from wh_find.
+ */
 ng_ID_t
-wh_open(ngctx ctrl, ng_ID_t wh, const char *jail)
+wh_reopen(ngctx ctrl, ng_ID_t wh, const char *jail)
 {
 	int rc;
-	ng_ID_t nd;
+	uint32_t ix;
+	ng_ID_t nd = 0;
 	char pth[NG_NODESIZ];
 	struct hooklist *hlist;
-	struct nodeinfo *ninfo;
-	struct ng_mesg *resp;
-	struct ngm_rmhook msg = { .ourhook = NG_WORMHOLE_HOOK };
+	/* the reply is never more than our event horizon and the other side */
+	union {
+		struct ng_mesg	msg;
+		char		buf[NG_REPLYSIZ(sizeof(struct hooklist) +
+				    2 * sizeof(struct linkinfo))];
+	} u;
+	struct ng_reply resp = NG_REPLY_INIT(&u, sizeof(u));
 
 	assert(ctrl >= 0);
 	assert(wh > 0);
@@ -184,23 +198,38 @@ wh_open(ngctx ctrl, ng_ID_t wh, const char *jail)
 		errx(ERREXIT,
 		    "unable to request wormhole node list, presumed dead");
 
-	rc = NgAllocRecvMsg(ctrl, &resp, NULL);
+	rc = ng_recv_msg(ctrl, &resp, NULL);
 	if (rc == -1)
 		errx(ERREXIT, "unable to get response for wormhole node list, "
 		    "presumed dead");
 
-	hlist = (struct hooklist *) resp->data;
-	ninfo = &hlist->nodeinfo;
-	assert(ninfo->hooks == 2); /* socket and our other wormhole */
-	if (strcmp(hlist->link[0].nodeinfo.type, NG_WORMHOLE_NODE_TYPE) == 0) {
-		nd = hlist->link[0].nodeinfo.id;
-	} else {
-		assert(strcmp(hlist->link[1].nodeinfo.type,
-		    NG_WORMHOLE_NODE_TYPE) == 0);
-		nd = hlist->link[1].nodeinfo.id;
-	}
-	free(resp);
+	hlist = (struct hooklist *) resp.msg->data;
+	assert(hlist->nodeinfo.hooks <= 2); /* event horizon and other side */
+	for (ix = 0; ix < hlist->nodeinfo.hooks; ix++)
+		if (strcmp(hlist->link[ix].nodeinfo.type,
+		    NG_WORMHOLE_NODE_TYPE) == 0)
+			nd = hlist->link[ix].nodeinfo.id;
+	ng_reply_fini(&resp);
+
+	if (nd == 0) errx(
+		ERREXIT, "wormhole `%s' opened to nothing, presumed dead", pth
+	);
+
+	return (nd);
+}
 
+/* a `wh' from wh_create, which lets go of our socket once open */
+ng_ID_t
+wh_open(ngctx ctrl, ng_ID_t wh, const char *jail)
+{
+	int rc;
+	ng_ID_t nd;
+	char pth[NG_NODESIZ];
+	struct ngm_rmhook msg = { .ourhook = NG_WORMHOLE_HOOK };
+
+	nd = wh_reopen(ctrl, wh, jail);
+
+	snprintf(pth, sizeof(pth), IDFMT, wh);
 	rc = NgSendMsg(ctrl, pth, NGM_GENERIC_COOKIE, NGM_RMHOOK, &msg,
 	    sizeof(msg));
 	if (rc == -1)
@@ -209,3 +238,69 @@ wh_open(ngctx ctrl, ng_ID_t wh, const char *jail)
 
 	return (nd);
 }
+
+/*
+ * The wormhole `name', left behind when the jail its other side was in went
+ * away. Its event horizon is still connected to whatever it was, which is
+ * what keeps it around. Returns 0 when there is no such node, exits when it
+ * isn't a wormhole or isn't closed. `c' tells what `name' is without asking.
+ */
+ng_ID_t
+wh_find(ngctx ctrl, struct ng_cache *c, const char *name, bool *connected)
+{
+	int rc;
+	uint32_t ix;
+	ng_ID_t nd;
+	const struct ng_cache_node *cn;
+	struct hooklist *hlist;
+	union {
+		struct ng_mesg	msg;
+		char		buf[NG_REPLYSIZ(sizeof(struct hooklist) +
+				    2 * sizeof(struct linkinfo))];
+	} u;
+	struct ng_reply resp = NG_REPLY_INIT(&u, sizeof(u));
+
+	assert(ctrl >= 0);
+	assert(c != NULL);
+	assert(name != NULL);
+	assert(connected != NULL);
+
+	if ((cn = ng_cache_name(ctrl, c, name)) == NULL)
+		return (0);
+	if (strcmp(cn->type, NG_WORMHOLE_NODE_TYPE) != 0) errx(
+		EX_DATAERR, "`%s:' is a %s, not a wormhole", name, cn->type
+	);
+
+	cn = ng_cache_send(ctrl, c, name, NGM_GENERIC_COOKIE, NGM_LISTHOOKS,
+	    NULL, 0);
+	if (cn == NULL && errno == ENOENT)
+		return (0);
+	if (cn == NULL) err(
+		ERREXIT, "unable to request hooks of `%s:'", name
+	);
+	rc = ng_recv_msg(ctrl, &resp, NULL);
+	if (rc == -1) err(
+		ERREXIT, "unable to retrieve hooks of `%s:'", name
+	);
+
+	/* it may have been replaced since the cache was loaded */
+	hlist = (struct hooklist *) resp.msg->data;
+	if (strcmp(hlist->nodeinfo.type, NG_WORMHOLE_NODE_TYPE) != 0) errx(
+		EX_DATAERR, "`%s:' is a %s, not a wormhole", name,
+		hlist->nodeinfo.type
+	);
+
+	*connected = false;
+	for (ix = 0; ix < hlist->nodeinfo.hooks; ix++) {
+		if (strcmp(hlist->link[ix].nodeinfo.type,
+		    NG_WORMHOLE_NODE_TYPE) == 0) errx(
+			EX_DATAERR, "`%s:' is still open", name
+		);
+		if (strcmp(hlist->link[ix].ourhook, NG_WORMHOLE_HOOK) == 0)
+			*connected = true;
+	}
+	nd = hlist->nodeinfo.id;
+	ng_reply_fini(&resp);
+
+	return (nd);
+}
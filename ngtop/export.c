@@ -0,0 +1,467 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <assert.h>
+#include <err.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/event.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+#include "ngtop.h"
+
+/*
+ * Exporter (-e). The counters ngt_poll() collects every interval are turned
+ * into OpenMetrics text right then, and a scrape only ever gets a copy of the
+ * last of those. Nothing asks the kernel on behalf of a scraper, so a scrape
+ * costs the same however big the graph is, and any number of them don't add
+ * to what netgraph(4) sees.
+ *
+ * Polling and rendering happen on the poller thread, everything else on the
+ * one in kevent(2). A new rendering is left in `pending' and EVFILT_USER says
+ * so. References to one that was served are only counted by that thread.
+ *
+ * HTTP is just enough for Prometheus: one GET per connection, the response
+ * is written as the socket takes it and the connection closed. Connections
+ * that don't finish within EXPORT_TIMEOUT are dropped, and there are never
+ * more than EXPORT_MAXCONN of them.
+ */
+
+#define	EXPORT_MAXCONN	64
+#define	EXPORT_TIMEOUT	5000		/* msec per connection */
+#define	EXPORT_REQSIZ	2048		/* request line and headers */
+#define	CONTENT_TYPE	"application/openmetrics-text; version=1.0.0; " \
+			"charset=utf-8"
+
+/* one rendering, shared by every connection still writing it out */
+struct snapshot {
+	unsigned	refs;
+	size_t		len;
+	char		*body;
+};
+
+struct conn {
+	int		fd;
+	struct snapshot	*snap;
+	size_t		got;		/* of `req' */
+	size_t		off;		/* of the response, header first */
+	size_t		hdrlen;
+	char		hdr[256];
+	char		req[EXPORT_REQSIZ];
+};
+
+static struct {
+	int		kq;
+	int		ls;
+	int		nconn;
+	struct snapshot	*snap;		/* the latest */
+	pthread_mutex_t	lock;		/* `pending' */
+	struct snapshot	*pending;	/* rendered, not yet served */
+} E = {
+	.kq = -1,
+	.ls = -1,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static const char *kinds[] = {
+	[NGT_BRIDGE] = "bridge",
+	[NGT_ETHER] = "ether",
+	[NGT_EIFACE] = "eiface",
+	[NGT_IFACE] = "iface",
+	[NGT_WORMHOLE] = "wormhole",
+};
+
+static void
+snap_release(struct snapshot *snap)
+{
+	if (snap != NULL && --snap->refs == 0) {
+		free(snap->body);
+		free(snap);
+	}
+}
+
+/* `[addr:]port', addr may be `[v6]', and is the loopback when left out */
+void
+ngt_export_init(const char *where, int kq)
+{
+	int rc, on = 1;
+	char *host, *port, *copy;
+	struct addrinfo hints = {
+		.ai_flags = AI_PASSIVE,
+		.ai_socktype = SOCK_STREAM,
+	}, *res, *ai;
+	struct kevent evt;
+
+	if ((copy = strdup(where)) == NULL) err(
+		EX_OSERR, "unable to allocate"
+	);
+	if ((port = strrchr(copy, ':')) == NULL) {
+		host = "localhost";
+		port = copy;
+	} else {
+		*port++ = '\0';
+		host = copy;
+		if (host[0] == '[' && host[strlen(host) - 1] == ']') {
+			host[strlen(host) - 1] = '\0';
+			host++;
+		}
+		if (*host == '\0')
+			host = NULL; /* `:port', every address */
+	}
+
+	rc = getaddrinfo(host, port, &hints, &res);
+	if (rc != 0) errx(
+		EX_NOHOST, "`%s': %s", where, gai_strerror(rc)
+	);
+	for (ai = res; ai != NULL; ai = ai->ai_next) {
+		E.ls = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (E.ls == -1)
+			continue;
+		(void) setsockopt(E.ls, SOL_SOCKET, SO_REUSEADDR, &on,
+		    sizeof(on));
+		if (bind(E.ls, ai->ai_addr, ai->ai_addrlen) == 0 &&
+		    listen(E.ls, EXPORT_MAXCONN) == 0)
+			break;
+		(void) close(E.ls);
+		E.ls = -1;
+	}
+	freeaddrinfo(res);
+	if (E.ls == -1) err(
+		ERRALT(EX_UNAVAILABLE), "unable to listen on `%s'", where
+	);
+	free(copy);
+
+	if (fcntl(E.ls, F_SETFL, O_NONBLOCK) == -1) err(
+		ERRALT(EX_OSERR), "fcntl: can't set flags"
+	);
+
+	/* a scraper that hangs up early is no reason to die */
+	(void) signal(SIGPIPE, SIG_IGN);
+
+	E.kq = kq;
+	EV_SET(&evt, E.ls, EVFILT_READ, EV_ADD, 0, 0, NULL);
+	if (kevent(E.kq, &evt, 1, NULL, 0, NULL) == -1) err(
+		ERRALT(EX_OSERR), "kevent: unable to register listener"
+	);
+	EV_SET(&evt, 0, EVFILT_USER, EV_ADD | EV_CLEAR, 0, 0, NULL);
+	if (kevent(E.kq, &evt, 1, NULL, 0, NULL) == -1) err(
+		ERRALT(EX_OSERR), "kevent: unable to register poller"
+	);
+}
+
+/* OpenMetrics label values escape backslash, double quote and newline */
+static void
+label(FILE *fp, const char *name, const char *value)
+{
+	(void) fprintf(fp, "%s=\"", name);
+	for (; *value != '\0'; value++) {
+		if (*value == '\\' || *value == '"')
+			(void) fputc('\\', fp);
+		if (*value == '\n')
+			(void) fputs("\\n", fp);
+		else
+			(void) fputc(*value, fp);
+	}
+	(void) fputc('"', fp);
+}
+
+static void
+labels(FILE *fp, const struct ngt_row *row)
+{
+	(void) fputc('{', fp);
+	label(fp, "node", row->node);
+	if (row->kind != NGT_WORMHOLE) {
+		(void) fputc(',', fp);
+		label(fp, "hook", row->hook);
+	}
+	(void) fputc(',', fp);
+	label(fp, "type", kinds[row->kind]);
+	(void) fputc('}', fp);
+}
+
+static void
+counter(FILE *fp, const struct ngt_graph *g, const char *name,
+    const char *help, size_t field)
+{
+	size_t ix;
+	const struct ngt_row *row;
+	uint64_t v;
+
+	(void) fprintf(fp, "# TYPE %s counter\n# HELP %s %s\n", name, name,
+	    help);
+	for (ix = 0; ix < g->nrows; ix++) {
+		row = &g->rows[ix];
+		if (row->dead || row->kind == NGT_WORMHOLE)
+			continue;
+		memcpy(&v, (const char *)&row->cur + field, sizeof(v));
+		(void) fprintf(fp, "%s_total", name);
+		labels(fp, row);
+		(void) fprintf(fp, " %ju\n", (uintmax_t)v);
+	}
+}
+
+/*
+ * Called by the poller after every ngt_poll(). A rendering the kevent(2)
+ * thread didn't pick up yet was never served, so it is simply replaced.
+ */
+void
+ngt_export_update(const struct ngt_graph *g, double took)
+{
+	size_t ix;
+	FILE *fp;
+	struct snapshot *snap, *stale;
+	const struct ngt_row *row;
+	struct kevent evt;
+
+	if ((snap = calloc(1, sizeof(*snap))) == NULL ||
+	    (fp = open_memstream(&snap->body, &snap->len)) == NULL) err(
+		EX_OSERR, "unable to allocate metrics"
+	);
+
+	counter(fp, g, "netgraph_receive_packets",
+	    "Packets received on a bridge link or interface.",
+	    offsetof(struct ngt_counters, ipkts));
+	counter(fp, g, "netgraph_receive_bytes",
+	    "Bytes received on a bridge link or interface.",
+	    offsetof(struct ngt_counters, ibytes));
+	counter(fp, g, "netgraph_transmit_packets",
+	    "Packets sent on a bridge link or interface.",
+	    offsetof(struct ngt_counters, opkts));
+	counter(fp, g, "netgraph_transmit_bytes",
+	    "Bytes sent on a bridge link or interface.",
+	    offsetof(struct ngt_counters, obytes));
+
+	(void) fprintf(fp, "# TYPE netgraph_up gauge\n# HELP netgraph_up "
+	    "Whether the last collection could read it.\n");
+	for (ix = 0; ix < g->nrows; ix++) {
+		row = &g->rows[ix];
+		(void) fputs("netgraph_up", fp);
+		labels(fp, row);
+		(void) fprintf(fp, " %d\n", !row->dead);
+	}
+
+	(void) fprintf(fp, "# TYPE netgraph_wormhole_hooks gauge\n"
+	    "# HELP netgraph_wormhole_hooks Hooks an ng_wormhole has "
+	    "connected.\n");
+	for (ix = 0; ix < g->nrows; ix++) {
+		row = &g->rows[ix];
+		if (row->kind != NGT_WORMHOLE || row->dead)
+			continue;
+		(void) fputs("netgraph_wormhole_hooks", fp);
+		labels(fp, row);
+		(void) fprintf(fp, " %u\n", row->hooks);
+	}
+
+	(void) fprintf(fp, "# TYPE netgraph_collect_seconds gauge\n"
+	    "# HELP netgraph_collect_seconds How long the last collection "
+	    "took.\nnetgraph_collect_seconds %.6f\n# EOF\n", took);
+
+	if (fclose(fp) != 0) err(
+		EX_OSERR, "unable to render metrics"
+	);
+
+	snap->refs = 1;
+	pthread_mutex_lock(&E.lock);
+	stale = E.pending;
+	E.pending = snap;
+	pthread_mutex_unlock(&E.lock);
+	snap_release(stale);
+
+	EV_SET(&evt, 0, EVFILT_USER, 0, NOTE_TRIGGER, 0, NULL);
+	if (kevent(E.kq, &evt, 1, NULL, 0, NULL) == -1) err(
+		ERRALT(EX_OSERR), "kevent: unable to hand over metrics"
+	);
+}
+
+/*
+ * The latest rendering replaces the one served so far. Connections still
+ * writing the previous one keep it until they are done.
+ */
+static void
+publish(void)
+{
+	struct snapshot *snap;
+
+	pthread_mutex_lock(&E.lock);
+	snap = E.pending;
+	E.pending = NULL;
+	pthread_mutex_unlock(&E.lock);
+	if (snap == NULL)
+		return;
+
+	snap_release(E.snap);
+	E.snap = snap;
+}
+
+static void
+conn_close(struct conn *c)
+{
+	struct kevent evt;
+
+	/* closing takes the read and write filters, not the timer */
+	EV_SET(&evt, c->fd, EVFILT_TIMER, EV_DELETE, 0, 0, NULL);
+	(void) kevent(E.kq, &evt, 1, NULL, 0, NULL);
+	(void) close(c->fd);
+	snap_release(c->snap);
+	free(c);
+	E.nconn--;
+}
+
+static void
+conn_accept(void)
+{
+	int fd;
+	struct conn *c;
+	struct kevent evt[2];
+
+	while ((fd = accept(E.ls, NULL, NULL)) != -1) {
+		if (E.nconn >= EXPORT_MAXCONN || (c = calloc(1, sizeof(*c)))
+		    == NULL) {
+			(void) close(fd);
+			continue;
+		}
+		/* FreeBSD hands our O_NONBLOCK on, say so anyway */
+		(void) fcntl(fd, F_SETFL, O_NONBLOCK);
+		c->fd = fd;
+		E.nconn++;
+
+		EV_SET(&evt[0], fd, EVFILT_READ, EV_ADD, 0, 0, c);
+		EV_SET(&evt[1], fd, EVFILT_TIMER, EV_ADD | EV_ONESHOT, 0,
+		    EXPORT_TIMEOUT, c);
+		if (kevent(E.kq, evt, nitems(evt), NULL, 0, NULL) == -1)
+			conn_close(c);
+	}
+}
+
+static void
+respond(struct conn *c, const char *status, struct snapshot *snap)
+{
+	struct kevent evt[2];
+
+	c->snap = snap;
+	if (snap != NULL)
+		snap->refs++;
+	c->hdrlen = snprintf(c->hdr, sizeof(c->hdr),
+	    "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n"
+	    "Connection: close\r\n\r\n", status,
+	    (snap != NULL) ? CONTENT_TYPE : "text/plain",
+	    (snap != NULL) ? snap->len : 0);
+
+	EV_SET(&evt[0], c->fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+	EV_SET(&evt[1], c->fd, EVFILT_WRITE, EV_ADD, 0, 0, c);
+	if (kevent(E.kq, evt, nitems(evt), NULL, 0, NULL) == -1)
+		conn_close(c);
+}
+
+static void
+conn_read(struct conn *c)
+{
+	ssize_t rc;
+
+	rc = read(c->fd, c->req + c->got, sizeof(c->req) - 1 - c->got);
+	if (rc == -1 && errno == EAGAIN)
+		return;
+	if (rc <= 0) {
+		conn_close(c);
+		return;
+	}
+	c->got += rc;
+	c->req[c->got] = '\0';
+
+	/* the whole request has to be here before we answer it */
+	if (strstr(c->req, "\r\n\r\n") == NULL &&
+	    strstr(c->req, "\n\n") == NULL) {
+		if (c->got == sizeof(c->req) - 1)
+			respond(c, "431 Request Header Fields Too Large", NULL);
+		return;
+	}
+
+	if (strncmp(c->req, "GET ", 4) != 0)
+		respond(c, "405 Method Not Allowed", NULL);
+	else if (strncmp(c->req + 4, "/metrics ", 9) != 0 &&
+	    strncmp(c->req + 4, "/ ", 2) != 0)
+		respond(c, "404 Not Found", NULL);
+	else if (E.snap == NULL)
+		respond(c, "503 Service Unavailable", NULL);
+	else
+		respond(c, "200 OK", E.snap);
+}
+
+static void
+conn_write(struct conn *c)
+{
+	ssize_t rc;
+	size_t blen = (c->snap != NULL) ? c->snap->len : 0;
+	struct iovec iov[2];
+	int n = 0;
+
+	if (c->off < c->hdrlen) {
+		iov[n].iov_base = c->hdr + c->off;
+		iov[n++].iov_len = c->hdrlen - c->off;
+	}
+	if (blen > 0) {
+		size_t boff = (c->off > c->hdrlen) ? c->off - c->hdrlen : 0;
+
+		iov[n].iov_base = c->snap->body + boff;
+		iov[n++].iov_len = blen - boff;
+	}
+
+	rc = writev(c->fd, iov, n);
+	if (rc == -1 && errno == EAGAIN)
+		return;
+	if (rc == -1) {
+		conn_close(c);
+		return;
+	}
+	c->off += rc;
+	if (c->off == c->hdrlen + blen)
+		conn_close(c);
+}
+
+/*
+ * Everything on `kq' that ngt_export_init() or a connection put there. Take
+ * them one kevent(2) at a time, an event can free a connection another
+ * event of the same batch would still point at.
+ */
+void
+ngt_export_event(const struct kevent *ev)
+{
+	struct conn *c = ev->udata;
+
+	if (ev->filter == EVFILT_USER) {
+		publish();
+		return;
+	}
+	if (c == NULL) {
+		conn_accept();
+		return;
+	}
+
+	switch (ev->filter) {
+	case EVFILT_READ:
+		conn_read(c);
+		break;
+	case EVFILT_WRITE:
+		conn_write(c);
+		break;
+	case EVFILT_TIMER:
+		/* ONESHOT, it is gone already */
+		(void) close(c->fd);
+		snap_release(c->snap);
+		free(c);
+		E.nconn--;
+		break;
+	}
+}
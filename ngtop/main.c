@@ -0,0 +1,426 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <assert.h>
+#include <err.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/event.h>
+#include <sys/param.h>
+#include <sys/jail.h>
+#include <sys/socket.h>
+#include <jail.h>
+
+#include "ngtop.h"
+
+/* name of our utility */
+#define	ME	"ngtop"
+
+#define	DEF_BATCH	64
+#define	DEF_LINES	20
+
+/*
+ * The single purpose of this utility is to show which netgraph(4) links are
+ * busy right now, the way top(1) does for processes.
+ */
+
+static void
+Usage(const char *format, ...)
+{
+	if (format != NULL) {
+		va_list ap;
+		va_start(ap, format);
+		(void) vfprintf(stderr, format, ap);
+		va_end(ap);
+	}
+
+	(void) fprintf(
+	    stderr,
+	    "USAGE: " ME " [-bn] [-c count] [-i interval] [-j jail] [-l lines]\n"
+	    "             [-o pps|bps] [-p depth]\n"
+	    "       " ME " -e [addr:]port [-n] [-i interval] [-j jail] "
+	    "[-p depth]\n"
+	    "-b\t\tBatch mode, don't clear the screen between updates.\n"
+	    "-c count\tExit after `count' updates.\n"
+	    "-e [addr:]port\tServe OpenMetrics over HTTP instead of showing "
+	    "rows,\n\t\ton localhost unless addr is given.\n"
+	    "-i interval\tSeconds between updates (default 1).\n"
+	    "-j jail\t\tSwitch to jail for all references.\n"
+	    "-l lines\tShow at most `lines' rows (default "
+	    STRFY(DEF_LINES) ").\n"
+	    "-n\t\tDisable automatic loading of netgraph(4) kernel modules.\n"
+	    "-o pps|bps\tOrder rows by packets or bits per second.\n"
+	    "-p depth\tMessages in flight before reading replies (default "
+	    STRFY(DEF_BATCH) ").\n"
+	);
+
+	exit(EX_USAGE);
+}
+
+static bool by_bits = true;
+
+static int
+cmp_rate(const void *a, const void *b)
+{
+	const struct ngt_row *l = *(struct ngt_row * const *)a;
+	const struct ngt_row *r = *(struct ngt_row * const *)b;
+	double lv, rv;
+
+	if (by_bits) {
+		lv = l->ibps + l->obps;
+		rv = r->ibps + r->obps;
+	} else {
+		lv = l->ipps + l->opps;
+		rv = r->ipps + r->opps;
+	}
+
+	return (lv < rv) - (lv > rv); /* descending */
+}
+
+static const char *
+human(char *buf, size_t size, double v)
+{
+	const char *sfx = " kMGT";
+
+	while (v >= 1000.0 && sfx[1] != '\0') {
+		v /= 1000.0;
+		sfx++;
+	}
+	if (*sfx == ' ')
+		snprintf(buf, size, "%.0f", v);
+	else
+		snprintf(buf, size, "%.1f%c", v, *sfx);
+
+	return (buf);
+}
+
+/* counters can be reset under us (ng_bridge `clrstats'), that is not a rate */
+static __inline double
+rate(uint64_t cur, uint64_t prev, double dt)
+{
+	return (cur < prev) ? 0.0 : (double)(cur - prev) / dt;
+}
+
+static void
+update_rates(struct ngt_graph *g, double dt)
+{
+	size_t ix;
+	struct ngt_row *row;
+
+	for (ix = 0; ix < g->nrows; ix++) {
+		row = &g->rows[ix];
+		if (row->primed && !row->dead) {
+			row->ipps = rate(row->cur.ipkts, row->prev.ipkts, dt);
+			row->opps = rate(row->cur.opkts, row->prev.opkts, dt);
+			row->ibps = rate(row->cur.ibytes, row->prev.ibytes, dt) * 8;
+			row->obps = rate(row->cur.obytes, row->prev.obytes, dt) * 8;
+		} else {
+			row->ipps = row->opps = row->ibps = row->obps = 0.0;
+		}
+		row->prev = row->cur;
+		row->primed = !row->dead;
+	}
+}
+
+static void
+render(struct ngt_graph *g, struct ngt_row **order, int lines, bool batch)
+{
+	size_t ix, n = 0, ndead = 0;
+	char b[4][16];
+	char when[32];
+	time_t now = time(NULL);
+
+	/* only rows with rates are ranked, so `lines' of them are shown */
+	for (ix = 0; ix < g->nrows; ix++) {
+		if (g->rows[ix].dead)
+			ndead++;
+		else if (g->rows[ix].kind != NGT_WORMHOLE)
+			order[n++] = &g->rows[ix];
+	}
+	qsort(order, n, sizeof(*order), cmp_rate);
+
+	strftime(when, sizeof(when), "%T", localtime(&now));
+	if (!batch)
+		(void) printf("\033[H\033[J");
+	(void) printf(
+		ME ": %s  %zu rows, %zu gone\n\n"
+		"%-16s %-16s %8s %8s %8s %8s\n",
+		when, g->nrows, ndead,
+		"NODE", "HOOK", "RX pps", "TX pps", "RX bps", "TX bps"
+	);
+
+	for (ix = 0; ix < n && ix < (size_t)lines; ix++) {
+		struct ngt_row *row = order[ix];
+
+		(void) printf(
+			"%-16s %-16s %8s %8s %8s %8s\n",
+			row->node,
+			row->hook,
+			human(b[0], sizeof(b[0]), row->ipps),
+			human(b[1], sizeof(b[1]), row->opps),
+			human(b[2], sizeof(b[2]), row->ibps),
+			human(b[3], sizeof(b[3]), row->obps)
+		);
+	}
+	if (batch)
+		(void) printf("\n");
+	(void) fflush(stdout);
+}
+
+/*
+ * Replies for a whole batch sit in the socket until we get around to them and
+ * a lost reply must not hang us.
+ */
+static void
+prepare_socket(int fd)
+{
+	int sbsz = 256 * 1024;
+	struct timeval tv = { .tv_sec = 1 };
+
+	(void) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &sbsz, sizeof(sbsz));
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1)
+		err(ERRALT(EX_OSERR), "can't set receive timeout");
+}
+
+static double
+elapsed(const struct timespec *from, const struct timespec *to)
+{
+	return (to->tv_sec - from->tv_sec) +
+	    (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/* the next absolute deadline, so polling time doesn't make us drift */
+static void
+advance(struct timespec *next, double interval)
+{
+	next->tv_sec += (time_t)interval;
+	next->tv_nsec += (long)((interval - (time_t)interval) * 1e9);
+	if (next->tv_nsec >= 1000000000L) {
+		next->tv_sec++;
+		next->tv_nsec -= 1000000000L;
+	}
+}
+
+/* what the -e poller owns once it is started, `ctrl' and the graph too */
+static struct {
+	ngctx			ctrl;
+	struct ngt_graph	*g;
+	int			batch;
+	double			interval;
+} P;
+
+static void *
+poll_main(void *arg __unused)
+{
+	struct timespec start, done, next;
+
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		ngt_poll(P.ctrl, P.g, P.batch);
+		clock_gettime(CLOCK_MONOTONIC, &done);
+		ngt_export_update(P.g, elapsed(&start, &done));
+
+		advance(&next, P.interval);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+		    NULL) == EINTR)
+			;
+	}
+	return (NULL);
+}
+
+/*
+ * -e, resident. The graph is polled on a thread of its own and each rendering
+ * handed over when it is done, so however long a poll takes this thread is
+ * never stuck in it and answers scrapers right away.
+ */
+static void
+run_export(ngctx ctrl, struct ngt_graph *g, int batch, double interval,
+    const char *where)
+{
+	int kq, rc;
+	pthread_t poller;
+	struct kevent evt;
+
+	if ((kq = kqueue()) == -1) err(
+		ERRALT(EX_OSERR), "kqueue: unable to create"
+	);
+	ngt_export_init(where, kq);
+
+	P.ctrl = ctrl;
+	P.g = g;
+	P.batch = batch;
+	P.interval = interval;
+	rc = pthread_create(&poller, NULL, poll_main, NULL);
+	if (rc != 0) {
+		errno = rc;
+		err(ERRALT(EX_OSERR), "unable to start poller thread");
+	}
+
+	for (;;) {
+		rc = kevent(kq, NULL, 0, &evt, 1, NULL);
+		if (rc == -1 && errno == EINTR)
+			continue;
+		if (rc == -1) err(
+			ERRALT(EX_OSERR), "kevent loop failed"
+		);
+		ngt_export_event(&evt);
+	}
+}
+
+static long
+numarg(char ch, const char *arg, long min, long max)
+{
+	char *ep;
+	long val;
+
+	val = strtol(arg, &ep, 10);
+	if (*arg == '\0' || *ep != '\0') Usage(
+		ME ": -%c must be integer: \"%s\"\n\n", ch, arg
+	);
+	if (val < min || val > max) Usage(
+		ME ": -%c must be in [%ld,%ld]\n\n", ch, min, max
+	);
+
+	return (val);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ch, lines = DEF_LINES, batch = DEF_BATCH, load_kmod = 1;
+	long count = -1;
+	bool batchmode = false;
+	double interval = 1.0, dt;
+	const char *export = NULL;
+	ngctx ctrl;
+	struct ngt_graph graph = { 0 };
+	struct ngt_row **order;
+	struct timespec next, last, now;
+
+	while ((ch = getopt_long(argc, argv, ":bc:e:i:j:l:no:p:", NULL, NULL))
+	    != -1) {
+		switch (ch) {
+		case 'b':
+			batchmode = true;
+			break;
+		case 'c':
+			count = numarg(ch, optarg, 1, LONG_MAX);
+			break;
+		case 'e':
+			export = optarg;
+			break;
+		case 'i':
+		    {
+			char *ep;
+
+			interval = strtod(optarg, &ep);
+			if (*ep != '\0' || interval < 0.1) Usage(
+				ME ": interval must be at least 0.1: \"%s\"\n\n",
+				optarg
+			);
+			break;
+		    }
+		case 'j':
+		    {
+			int jid;
+
+			if (strlen(optarg) > MAXHOSTNAMELEN) Usage(
+				ME ": `%s' exceeds %d characters\n\n",
+				optarg, MAXHOSTNAMELEN
+			);
+			jid = jail_getid(optarg);
+			if (jid == -1) errx(
+				ERRALT(EX_NOHOST), "%s", jail_errmsg
+			);
+			if (jail_attach(jid) != 0) errx(
+				ERRALT(EX_OSERR), "cannot attach to jail"
+			);
+			load_kmod = 0; /* can't from a jail anyway */
+			break;
+		    }
+		case 'l':
+			lines = (int)numarg(ch, optarg, 1, INT_MAX);
+			break;
+		case 'n':
+			load_kmod = 0; /* user asked not to */
+			break;
+		case 'o':
+			if (strcmp(optarg, "pps") == 0)
+				by_bits = false;
+			else if (strcmp(optarg, "bps") == 0)
+				by_bits = true;
+			else Usage(
+				ME ": order must be `pps' or `bps'\n\n"
+			);
+			break;
+		case 'p':
+			batch = (int)numarg(ch, optarg, 1, 4096);
+			break;
+		default:
+			Usage(
+				ME ": unrecognized option `%s'\n\n",
+				argv[optind - 1]
+			);
+		}
+	}
+	if (optind != argc) Usage(
+		ME ": unexpected argument `%s'\n\n", argv[optind]
+	);
+
+	if (!isatty(STDOUT_FILENO))
+		batchmode = true;
+
+	if (load_kmod != 0)
+		kld_ensure_load("ng_socket");
+
+	ng_create_context(&ctrl, NULL);
+	prepare_socket(ctrl);
+
+	ngt_discover(ctrl, &graph, batch);
+	if (graph.nrows == 0) errx(
+		EX_UNAVAILABLE, "no ng_bridge(4) links or netif nodes found"
+	);
+	if (export != NULL)
+		run_export(ctrl, &graph, batch, interval, export);
+	order = calloc(graph.nrows, sizeof(*order));
+	if (order == NULL) err(
+		EX_OSERR, "unable to allocate %zu rows", graph.nrows
+	);
+
+	/* prime so the first screen already has rates */
+	ngt_poll(ctrl, &graph, batch);
+	clock_gettime(CLOCK_MONOTONIC, &last);
+	update_rates(&graph, 1.0);
+	next = last;
+
+	while (count == -1 || count-- > 0) {
+		advance(&next, interval);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next,
+		    NULL) == EINTR)
+			;
+
+		ngt_poll(ctrl, &graph, batch);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		dt = elapsed(&last, &now);
+		last = now;
+
+		update_rates(&graph, dt);
+		render(&graph, order, lines, batchmode);
+	}
+
+	free(order);
+	close(ctrl);
+
+	return (0);
+}
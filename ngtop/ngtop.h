@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <errno.h>
+#include <net/if.h>
+#include <stdbool.h>
+#include <sys/param.h>
+#include <netgraph.h>
+
+#include "common.h"
+
+/*
+ * Only node types we know how to ask for counters are tracked. ng_bridge(4)
+ * keeps them per link, netif nodes have their ifnet. An ng_wormhole has no
+ * counters, just the number of hooks it has connected.
+ */
+enum ngt_kind {
+	NGT_BRIDGE = 0,
+	NGT_ETHER,
+	NGT_EIFACE,
+	NGT_IFACE,
+	NGT_WORMHOLE
+};
+#define	NGT_NETIF(k)	((k) == NGT_ETHER || (k) == NGT_EIFACE || \
+			    (k) == NGT_IFACE)
+
+struct ngt_counters {
+	uint64_t	ipkts;
+	uint64_t	ibytes;
+	uint64_t	opkts;
+	uint64_t	obytes;
+};
+
+/*
+ * One row of output. For ng_bridge(4) that is a link, for netif nodes it is
+ * the interface (and `hook' is the interface name).
+ */
+struct ngt_row {
+	ng_ID_t			id;
+	enum ngt_kind		kind;
+	int32_t			link;	/* bridge link number, uplinks < 0 */
+	bool			dead;	/* stopped answering */
+	bool			primed;	/* have a previous sample */
+	uint32_t		hooks;	/* connected, for a wormhole */
+	char			node[NG_NODESIZ];
+	char			path[NG_NODESIZ];	/* IDFMT of `id' */
+	char			hook[MAX(NG_HOOKSIZ, IFNAMSIZ)];
+	struct ngt_counters	cur;
+	struct ngt_counters	prev;
+	double			ipps, opps;
+	double			ibps, obps;
+};
+
+struct ngt_graph {
+	struct ngt_row	*rows;
+	size_t		nrows;
+	size_t		nalloc;
+	struct ngt_row	**ifidx;	/* netif rows sorted by interface */
+	size_t		nif;
+};
+
+/* stats.c */
+void	ngt_discover(ngctx, struct ngt_graph *, int);
+void	ngt_poll(ngctx, struct ngt_graph *, int);
+
+/* export.c */
+struct kevent;
+
+void	ngt_export_init(const char *, int);
+void	ngt_export_update(const struct ngt_graph *, double);
+void	ngt_export_event(const struct kevent *);
@@ -0,0 +1,413 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <assert.h>
+#include <err.h>
+#include <ifaddrs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <net/if.h>
+
+#include <netgraph/ng_bridge.h>
+#include <netgraph/ng_eiface.h>
+#include <netgraph/ng_ether.h>
+#include <netgraph/ng_iface.h>
+#include <netgraph/ng_wormhole.h>
+
+#include "ngtop.h"
+
+/* biggest reply we expect while polling, a struct ng_bridge_link_stats */
+#define	NGT_REPLYSIZ	(sizeof(struct ng_mesg) + 512)
+
+static const struct {
+	const char	*type;
+	enum ngt_kind	kind;
+	int		cookie;	/* getifname for netif nodes, */
+	int		cmd;	/* nodeinfo for what has neither */
+} known[] = {
+	{ NG_BRIDGE_NODE_TYPE,	NGT_BRIDGE,	0, 0 },
+	{ NG_ETHER_NODE_TYPE,	NGT_ETHER,
+	    NGM_ETHER_COOKIE,	NGM_ETHER_GET_IFNAME },
+	{ NG_EIFACE_NODE_TYPE,	NGT_EIFACE,
+	    NGM_EIFACE_COOKIE,	NGM_EIFACE_GET_IFNAME },
+	{ NG_IFACE_NODE_TYPE,	NGT_IFACE,
+	    NGM_IFACE_COOKIE,	NGM_IFACE_GET_IFNAME },
+	{ NG_WORMHOLE_NODE_TYPE, NGT_WORMHOLE,
+	    NGM_GENERIC_COOKIE,	NGM_NODEINFO },
+};
+
+/*
+ * `ask' returns the token NgSendMsg(3) used or -1 if nothing was sent.
+ * `answer' is handed the reply for that same row.
+ */
+typedef int	ask_fn(ngctx, struct ngt_row *);
+typedef void	answer_fn(struct ngt_graph *, struct ngt_row *, struct ng_mesg *);
+
+/*
+ * Everything we ask the kernel for goes through here. Up to `batch' messages
+ * are written before any reply is read, so a thousand links cost a thousand
+ * sendto(2) and recvfrom(2) but only a handful of trips through this loop
+ * rather than a thousand synchronous round trips.
+ *
+ * Replies carry the token NgSendMsg(3) handed out and come back in the order
+ * they were sent, so the expected slot is checked first.
+ *
+ * With `alloc' replies go to a buffer sized to SO_RCVBUF, which discovery
+ * needs as a hooklist for a big ng_bridge(4) is large. It is allocated once
+ * for all of them. Polling replies are small and are read into the stack;
+ * should one not fit, that row alone is asked again once it does.
+ */
+static void
+pipeline(
+	ngctx ctrl, struct ngt_graph *g,
+	struct ngt_row *rows, size_t n, int batch,
+	ask_fn *ask, answer_fn *answer, bool alloc
+) {
+	union {
+		struct ng_mesg	msg;
+		char		buf[NGT_REPLYSIZ];
+	} u;
+	struct ng_reply reply = alloc ? (struct ng_reply)NG_REPLY_INIT(NULL, 0) :
+	    (struct ng_reply)NG_REPLY_INIT(&u, sizeof(u));
+	struct ng_mesg *resp;
+	int *tokens, token, rc, sent, got, ix;
+	size_t *which, next, cur, size;
+
+	assert(ctrl >= 0);
+	assert(batch > 0);
+
+	tokens = calloc(batch, sizeof(*tokens));
+	which = calloc(batch, sizeof(*which));
+	if (tokens == NULL || which == NULL) err(
+		EX_OSERR, "%s: unable to allocate %d slots", __func__, batch
+	);
+
+	for (next = 0; next < n;) {
+		for (sent = 0; next < n && sent < batch; next++) {
+			token = ask(ctrl, &rows[next]);
+			if (token == -1)
+				continue;
+			tokens[sent] = token;
+			which[sent++] = next;
+		}
+
+		/*
+		 * Only a reply to this batch counts: one that was late for an
+		 * earlier batch is still queued and is read and dropped here.
+		 */
+		for (got = 0; got < sent;) {
+			size = reply.size;
+			rc = ng_recv_msg(ctrl, &reply, NULL);
+			if (rc == -1 && errno == EAGAIN) {
+				/* SO_RCVTIMEO, the rest were dropped */
+				warnx("timed out waiting for %d replies",
+				    sent - got);
+				break;
+			}
+			if (rc == -1 && errno != EMSGSIZE)
+				err(ERREXIT, "%s: unable to receive reply",
+				    __func__);
+			resp = reply.msg;
+
+			/* normally in order, only search when it isn't */
+			cur = got;
+			if (tokens[cur] != (int)resp->header.token) {
+				for (ix = 0; ix < sent; ix++)
+					if (tokens[ix] == (int)resp->header.token)
+						break;
+				cur = ix;
+			}
+			if (cur == (size_t)sent)
+				continue; /* not ours, still waiting for one */
+
+			/*
+			 * Truncated, only the header is left. If `reply' grew
+			 * ask again, the answer fits now, else it never will.
+			 */
+			if (rc == -1 && reply.size > size) {
+				tokens[cur] = ask(ctrl, &rows[which[cur]]);
+				if (tokens[cur] != -1)
+					continue;
+			} else if (rc == -1)
+				warnx("reply bigger than %zu bytes", size);
+			got++;
+			if (rc != -1)
+				answer(g, &rows[which[cur]], resp);
+		}
+	}
+
+	ng_reply_fini(&reply);
+	free(which);
+	free(tokens);
+}
+
+static struct ngt_row *
+append_row(struct ngt_graph *g, const struct ngt_row *from)
+{
+	struct ngt_row *row;
+
+	if (g->nrows == g->nalloc) {
+		g->nalloc = (g->nalloc == 0) ? 64 : g->nalloc * 2;
+		g->rows = reallocf(g->rows, g->nalloc * sizeof(*g->rows));
+		if (g->rows == NULL) err(
+			EX_OSERR, "%s: unable to grow to %zu rows",
+			__func__, g->nalloc
+		);
+	}
+	row = &g->rows[g->nrows++];
+	*row = *from;
+
+	return (row);
+}
+
+static int
+ask_describe(ngctx ctrl, struct ngt_row *node)
+{
+	int rc;
+
+	if (node->kind == NGT_BRIDGE) {
+		rc = NgSendMsg(
+			ctrl, node->path, NGM_GENERIC_COOKIE, NGM_LISTHOOKS,
+			NULL, 0
+		);
+	} else {
+		rc = NgSendMsg(
+			ctrl, node->path,
+			known[node->kind].cookie, known[node->kind].cmd,
+			NULL, 0
+		);
+	}
+	if (rc == -1)
+		warn("%s (%s): ignored", node->node, node->path);
+
+	return (rc);
+}
+
+/*
+ * ng_bridge(4) wants the link number for `getstats' with uplinks given as
+ * negative numbers.
+ */
+static void
+answer_describe(struct ngt_graph *g, struct ngt_row *node, struct ng_mesg *resp)
+{
+	struct hooklist *hlist;
+	struct ngt_row *row;
+	const char *num;
+	char *ep;
+	long link;
+	int ix;
+
+	if (node->kind == NGT_WORMHOLE) {
+		row = append_row(g, node);
+		row->hooks = ((struct nodeinfo *) resp->data)->hooks;
+		return;
+	}
+	if (node->kind != NGT_BRIDGE) {
+		row = append_row(g, node);
+		strlcpy(row->hook, resp->data, sizeof(row->hook));
+		return;
+	}
+
+	hlist = (struct hooklist *) resp->data;
+	for (ix = 0; ix < hlist->nodeinfo.hooks; ix++) {
+		const char *hook = hlist->link[ix].ourhook;
+
+		if (strncmp(hook, NG_BRIDGE_HOOK_UPLINK_PREFIX,
+		    strlen(NG_BRIDGE_HOOK_UPLINK_PREFIX)) == 0) {
+			num = hook + strlen(NG_BRIDGE_HOOK_UPLINK_PREFIX);
+			link = -strtol(num, &ep, 10);
+		} else if (strncmp(hook, NG_BRIDGE_HOOK_LINK_PREFIX,
+		    strlen(NG_BRIDGE_HOOK_LINK_PREFIX)) == 0) {
+			num = hook + strlen(NG_BRIDGE_HOOK_LINK_PREFIX);
+			link = strtol(num, &ep, 10);
+		} else
+			continue; /* not a link we can ask about */
+
+		if (*num == '\0' || *ep != '\0')
+			continue;
+
+		row = append_row(g, node);
+		row->link = (int32_t)link;
+		strlcpy(row->hook, hook, sizeof(row->hook));
+	}
+}
+
+static int
+cmp_ifname(const void *a, const void *b)
+{
+	const struct ngt_row *l = *(struct ngt_row * const *)a;
+	const struct ngt_row *r = *(struct ngt_row * const *)b;
+
+	return strcmp(l->hook, r->hook);
+}
+
+/*
+ * Walk the graph exactly once. Anything created afterwards is not shown,
+ * restart us for that.
+ */
+void
+ngt_discover(ngctx ctrl, struct ngt_graph *g, int batch)
+{
+	size_t ix, kx, n = 0;
+	struct ng_cache cache = { 0 };
+	struct ngt_row *nodes;
+
+	assert(ctrl >= 0);
+	assert(g != NULL);
+
+	ng_cache_load(ctrl, &cache);
+	nodes = calloc(cache.n, sizeof(*nodes));
+	if (nodes == NULL && cache.n != 0) err(
+		EX_OSERR, "%s: unable to allocate %zu nodes",
+		__func__, cache.n
+	);
+
+	for (ix = 0; ix < cache.n; ix++) {
+		const struct ng_cache_node *cn = &cache.nodes[ix];
+
+		for (kx = 0; kx < nitems(known); kx++)
+			if (strcmp(cn->type, known[kx].type) == 0)
+				break;
+		if (kx == nitems(known))
+			continue;
+
+		nodes[n].id = cn->id;
+		nodes[n].kind = known[kx].kind;
+		strlcpy(nodes[n].path, cn->path, sizeof(nodes[n].path));
+		if (cn->name[0] == '\0')
+			snprintf(nodes[n].node, sizeof(nodes[n].node),
+			    "[%08x]", cn->id);
+		else
+			strlcpy(nodes[n].node, cn->name, sizeof(nodes[n].node));
+		n++;
+	}
+	ng_cache_fini(&cache);
+
+	pipeline(ctrl, g, nodes, n, batch, ask_describe, answer_describe, true);
+	free(nodes);
+
+	/* index netif rows so each poll is one getifaddrs(3) plus lookups */
+	for (ix = 0; ix < g->nrows; ix++)
+		if (NGT_NETIF(g->rows[ix].kind))
+			g->nif++;
+	g->ifidx = calloc(g->nif, sizeof(*g->ifidx));
+	if (g->ifidx == NULL && g->nif != 0) err(
+		EX_OSERR, "%s: unable to index %zu interfaces",
+		__func__, g->nif
+	);
+	for (ix = 0, kx = 0; ix < g->nrows; ix++)
+		if (NGT_NETIF(g->rows[ix].kind))
+			g->ifidx[kx++] = &g->rows[ix];
+	qsort(g->ifidx, g->nif, sizeof(*g->ifidx), cmp_ifname);
+}
+
+static int
+ask_stats(ngctx ctrl, struct ngt_row *row)
+{
+	int rc;
+
+	if (NGT_NETIF(row->kind) || row->dead)
+		return (-1);
+
+	/* the path was made once, at discovery, not every poll */
+	if (row->kind == NGT_WORMHOLE)
+		rc = NgSendMsg(
+			ctrl, row->path, NGM_GENERIC_COOKIE, NGM_NODEINFO,
+			NULL, 0
+		);
+	else
+		rc = NgSendMsg(
+			ctrl, row->path,
+			NGM_BRIDGE_COOKIE, NGM_BRIDGE_GET_STATS,
+			&row->link, sizeof(row->link)
+		);
+	if (rc == -1)
+		row->dead = true; /* link or bridge went away */
+
+	return (rc);
+}
+
+static void
+answer_stats(struct ngt_graph *_, struct ngt_row *row, struct ng_mesg *resp)
+{
+	struct ng_bridge_link_stats *st;
+
+	/* how many of its hooks are connected is all a wormhole has */
+	if (row->kind == NGT_WORMHOLE) {
+		if (resp->header.arglen >= sizeof(struct nodeinfo))
+			row->hooks = ((struct nodeinfo *) resp->data)->hooks;
+		return;
+	}
+	if (resp->header.arglen < sizeof(*st))
+		return;
+
+	st = (struct ng_bridge_link_stats *) resp->data;
+	row->cur.ipkts = st->recvPackets;
+	row->cur.ibytes = st->recvOctets;
+	row->cur.opkts = st->xmitPackets;
+	row->cur.obytes = st->xmitOctets;
+}
+
+/* the kernel hands every interface's counters over in one go */
+static void
+poll_ifnet(struct ngt_graph *g)
+{
+	size_t ix;
+	struct ifaddrs *ifap, *ifa;
+	struct ngt_row key, *pkey = &key, **found;
+	struct if_data *ifd;
+
+	if (g->nif == 0)
+		return;
+
+	if (getifaddrs(&ifap) == -1) err(
+		EX_OSERR, "getifaddrs"
+	);
+
+	for (ix = 0; ix < g->nif; ix++)
+		g->ifidx[ix]->dead = true;
+
+	for (ifa = ifap; ifa != NULL; ifa = ifa->ifa_next) {
+		if (ifa->ifa_addr == NULL ||
+		    ifa->ifa_addr->sa_family != AF_LINK ||
+		    ifa->ifa_data == NULL)
+			continue;
+
+		strlcpy(key.hook, ifa->ifa_name, sizeof(key.hook));
+		found = bsearch(
+			&pkey, g->ifidx, g->nif, sizeof(*g->ifidx), cmp_ifname
+		);
+		if (found == NULL)
+			continue;
+
+		ifd = ifa->ifa_data;
+		(*found)->dead = false;
+		(*found)->cur.ipkts = ifd->ifi_ipackets;
+		(*found)->cur.ibytes = ifd->ifi_ibytes;
+		(*found)->cur.opkts = ifd->ifi_opackets;
+		(*found)->cur.obytes = ifd->ifi_obytes;
+	}
+
+	freeifaddrs(ifap);
+}
+
+/* only fills in `cur', rates are up to the caller */
+void
+ngt_poll(ngctx ctrl, struct ngt_graph *g, int batch)
+{
+
+	assert(ctrl >= 0);
+	assert(g != NULL);
+
+	pipeline(
+		ctrl, g, g->rows, g->nrows, batch,
+		ask_stats, answer_stats, false
+	);
+	poll_ifnet(g);
+}
@@ -0,0 +1,258 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <err.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/jail.h>
+#include <jail.h>
+
+#include <netgraph/ng_vlan.h>
+
+#include "ngvlan.h"
+
+/* name of our utility */
+#define	ME	"ngvlan"
+
+/* replies asked for at once when renaming interfaces */
+#define	NGV_BATCH	64
+
+/*
+ * The single purpose of this utility is to make an ng_vlan(4) have the
+ * filters and ng_eiface(4) nodes of a table, however many there are.
+ */
+
+static void
+Usage(const char *format, ...)
+{
+	if (format != NULL) {
+		va_list ap;
+		va_start(ap, format);
+		(void) vfprintf(stderr, format, ap);
+		va_end(ap);
+	}
+
+	(void) fprintf(
+	    stderr,
+	    "USAGE: " ME " [-cnp] [-j jail] vlan [file]\n"
+	    "-c\t\tCheck only, show the ngctl(8) commands that would be run.\n"
+	    "-j jail\t\tSwitch to jail for all references.\n"
+	    "-n\t\tDisable automatic loading of netgraph(4) kernel modules.\n"
+	    "-p\t\tPrune filters and ng_eiface(4) nodes not in the table.\n\n"
+	    "vlan is the name or `[id]' of an ng_vlan(4). The table is read "
+	    "from file,\nor standard input when it is missing or `-', a line "
+	    "per VLAN:\n\ttag hook [eiface]\n"
+	);
+
+	exit(EX_USAGE);
+}
+
+/* `tag hook [eiface]', with `#' to the end of the line ignored */
+static void
+read_table(FILE *fp, const char *what, struct ngv_table *t)
+{
+	char *line = NULL, *word[4], *p, *end;
+	size_t cap = 0, ix, nw;
+	unsigned long vid;
+	int lineno = 0;
+	struct ngv_entry *e;
+
+	memset(t, 0, sizeof(*t));
+	while (getline(&line, &cap, fp) != -1) {
+		lineno++;
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		for (nw = 0, p = line; nw < nitems(word) &&
+		    (word[nw] = strsep(&p, " \t\r\n")) != NULL;)
+			if (*word[nw] != '\0')
+				nw++;
+		if (nw == 0)
+			continue;
+		if (nw < 2 || nw > 3) errx(
+			EX_DATAERR, "%s: line %d: need `tag hook [eiface]'",
+			what, lineno
+		);
+
+		vid = strtoul(word[0], &end, 10);
+		if (*end != '\0' || vid == 0 || vid > NGV_MAX_VID) errx(
+			EX_DATAERR, "%s: line %d: tag `%s' isn't 1 to %d", what,
+			lineno, word[0], NGV_MAX_VID
+		);
+		if (nw == 2)
+			word[2] = word[1];
+
+		if (t->n == t->nalloc) {
+			t->nalloc = MAX(t->nalloc * 2, 64);
+			t->e = reallocf(t->e, t->nalloc * sizeof(*t->e));
+			if (t->e == NULL) err(
+				EX_OSERR, "unable to allocate %zu VLANs",
+				t->nalloc
+			);
+		}
+		e = &t->e[t->n];
+		memset(e, 0, sizeof(*e));
+		e->vid = vid;
+		e->line = lineno;
+		if (strlcpy(e->hook, word[1], sizeof(e->hook)) >=
+		    sizeof(e->hook) || strpbrk(e->hook, ".:") != NULL) errx(
+			EX_DATAERR, "%s: line %d: `%s' isn't a hook name", what,
+			lineno, word[1]
+		);
+		if (strcmp(e->hook, NG_VLAN_HOOK_DOWNSTREAM) == 0 ||
+		    strcmp(e->hook, NG_VLAN_HOOK_NOMATCH) == 0) errx(
+			EX_DATAERR, "%s: line %d: `%s' is the trunk, not a VLAN",
+			what, lineno, e->hook
+		);
+		if (strlcpy(e->name, word[2], sizeof(e->name)) >=
+		    sizeof(e->name) || strpbrk(e->name, ".:[]") != NULL) errx(
+			EX_DATAERR, "%s: line %d: `%s' isn't an interface name",
+			what, lineno, word[2]
+		);
+
+		/* a few hundred lines, comparing to each one before is fine */
+		for (ix = 0; ix < t->n; ix++) {
+			const struct ngv_entry *o = &t->e[ix];
+
+			if (o->vid == e->vid || strcmp(o->hook, e->hook) == 0 ||
+			    strcmp(o->name, e->name) == 0) errx(
+				EX_DATAERR, "%s: line %d: tag, hook or name of "
+				"line %d again", what, lineno, o->line
+			);
+		}
+		t->n++;
+	}
+	if (ferror(fp)) err(
+		ERRALT(EX_IOERR), "unable to read %s", what
+	);
+	free(line);
+}
+
+int
+main(int argc, char **argv)
+{
+	int ch, load_kmod = 1, renamed;
+	bool check = false, prune = false;
+	size_t ix, made = 0, added = 0, removed = 0, gone = 0;
+	const char *what = "stdin";
+	FILE *fp = stdin;
+	ngctx ctrl;
+	struct ngv_table t;
+	struct ngv_state st;
+	struct ngv_plan p;
+
+	while ((ch = getopt_long(argc, argv, ":cj:np", NULL, NULL)) != -1) {
+		switch (ch) {
+		case 'c':
+			check = true;
+			break;
+		case 'j':
+		    {
+			int jid;
+
+			if (strlen(optarg) > MAXHOSTNAMELEN) Usage(
+				ME ": `%s' exceeds %d characters\n\n",
+				optarg, MAXHOSTNAMELEN
+			);
+			jid = jail_getid(optarg);
+			if (jid == -1) errx(
+				ERRALT(EX_NOHOST), "%s", jail_errmsg
+			);
+			if (jail_attach(jid) != 0) errx(
+				ERRALT(EX_OSERR), "cannot attach to jail"
+			);
+			load_kmod = 0; /* can't from a jail anyway */
+			break;
+		    }
+		case 'n':
+			load_kmod = 0; /* user asked not to */
+			break;
+		case 'p':
+			prune = true;
+			break;
+		default:
+			Usage(
+				ME ": unrecognized option `%s'\n\n",
+				argv[optind - 1]
+			);
+		}
+	}
+	argv += optind;
+	argc -= optind;
+
+	if (argc < 1 || argc > 2) Usage(
+		ME ": need an ng_vlan and at most one table\n\n"
+	);
+	if (strlen(argv[0]) > NG_NODELEN) Usage(
+		ME ": `%s' exceeds %d characters\n\n", argv[0], NG_NODELEN
+	);
+	if (argc == 2 && strcmp(argv[1], "-") != 0) {
+		what = argv[1];
+		if ((fp = fopen(what, "r")) == NULL) err(
+			ERRALT(EX_NOINPUT), "unable to open `%s'", what
+		);
+	}
+	read_table(fp, what, &t);
+	if (fp != stdin)
+		(void) fclose(fp);
+
+	if (load_kmod != 0) {
+		kld_ensure_load("ng_socket");
+		kld_ensure_load("ng_vlan");
+		kld_ensure_load("ng_eiface");
+	}
+	ng_create_context(&ctrl, NULL);
+
+	ngv_load(ctrl, argv[0], &st);
+	ngv_plan(&st, &t, prune, &p);
+
+	if (check) {
+		ngv_print(stdout, argv[0], &p);
+	} else {
+		ngv_apply(ctrl, argv[0], &p);
+		renamed = ngv_rename(ctrl, argv[0], &p, NGV_BATCH);
+
+		for (ix = 0; ix < p.n; ix++) {
+			switch (p.a[ix].op) {
+			case NGV_DELFILTER:
+				removed++;
+				break;
+			case NGV_MKPEER:
+				made++;
+				break;
+			case NGV_ADDFILTER:
+				added++;
+				break;
+			case NGV_SHUTDOWN:
+				gone++;
+				break;
+			default:
+				break;
+			}
+		}
+		printf("%s: %zu filters added, %zu removed, %zu interfaces "
+		    "created, %zu shut down, %d renamed\n", argv[0], added,
+		    removed, made, gone, renamed);
+	}
+	if (p.extra != 0)
+		warnx("%zu filters of `%s' aren't in the table, left as they "
+		    "are without -p", p.extra, argv[0]);
+	(void) close(ctrl);
+
+	free(p.a);
+	free(st.links);
+	free(st.filters);
+	free(t.e);
+
+	if (fflush(stdout) == EOF) err(
+		ERRALT(EX_IOERR), "unable to write to stdout"
+	);
+	return (EX_OK);
+}
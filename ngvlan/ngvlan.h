@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <errno.h>
+#include <net/if.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/param.h>
+#include <netgraph.h>
+
+#include "common.h"
+
+#define	NGV_MAX_VID	4094
+
+/* one line of the VLAN table: the tag, its hook and its ng_eiface(4) */
+struct ngv_entry {
+	uint16_t	vid;
+	bool		kept;		/* its filter is already there */
+	int		line;
+	char		hook[NG_HOOKSIZ];
+	char		name[MIN(NG_NODESIZ, IFNAMSIZ)];
+};
+
+struct ngv_table {
+	struct ngv_entry	*e;
+	size_t			n;
+	size_t			nalloc;
+};
+
+/* what the ng_vlan(4) has now, each sorted by hook */
+struct ngv_link {
+	char		hook[NG_HOOKSIZ];
+	char		name[NG_NODESIZ];	/* of the peer */
+	char		type[NG_TYPESIZ];
+};
+
+struct ngv_filter {
+	char		hook[NG_HOOKSIZ];
+	uint16_t	vid;
+};
+
+struct ngv_state {
+	struct ngv_link		*links;
+	size_t			nlinks;
+	struct ngv_filter	*filters;
+	size_t			nfilters;
+};
+
+/*
+ * The messages that take the node from what it has to the table, in the
+ * order they are sent. None of them has a reply.
+ */
+enum ngv_op {
+	NGV_DELFILTER = 0,
+	NGV_MKPEER,
+	NGV_NAME,
+	NGV_ADDFILTER,
+	NGV_SHUTDOWN
+};
+
+struct ngv_action {
+	enum ngv_op		op;
+	const struct ngv_entry	*e;	/* NULL for what isn't in the table */
+	const char		*hook;
+};
+
+struct ngv_plan {
+	struct ngv_action	*a;
+	size_t			n;
+	size_t			nalloc;
+	size_t			extra;	/* filters not in the table, left */
+};
+
+/* vlan.c */
+void	ngv_load(ngctx, const char *, struct ngv_state *);
+void	ngv_plan(const struct ngv_state *, struct ngv_table *, bool,
+	    struct ngv_plan *);
+void	ngv_apply(ngctx, const char *, const struct ngv_plan *);
+void	ngv_print(FILE *, const char *, const struct ngv_plan *);
+int	ngv_rename(ngctx, const char *, const struct ngv_plan *, int);
@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2025 David Marker <dave@freedave.net>
+ *
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <assert.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/sockio.h>
+
+#include <netgraph/ng_eiface.h>
+#include <netgraph/ng_vlan.h>
+
+#include "ngvlan.h"
+
+/*
+ * An ng_vlan(4) and its ng_eiface(4) per tag, from a table. What the node
+ * has is read with two messages, LISTHOOKS and `gettable', and only what
+ * differs is sent. Creating, naming and filtering don't reply, so all of it
+ * goes out back to back on one socket and the kernel does each as it is
+ * written: a VLAN costs three sendto(2) instead of three ngctl(8).
+ *
+ * Renaming the interfaces is the only part that waits, for `getifname'
+ * replies, and those are asked for `batch' at a time.
+ */
+
+#define	NGV_RCVBUF_MAX	(4 * 1024 * 1024)
+#define	NGV_RCVBUF_MIN	(64 * 1024)
+#define	NGV_WAIT	5		/* seconds for a reply */
+
+/*
+ * A hook list of every VLAN is about 250 bytes a hook, 1K VLANs needs more
+ * than the default socket buffer.
+ */
+static void
+prepare_socket(ngctx ctrl)
+{
+	int sz;
+	struct timeval tv = { .tv_sec = NGV_WAIT };
+
+	for (sz = NGV_RCVBUF_MAX; sz >= NGV_RCVBUF_MIN; sz /= 2)
+		if (setsockopt(ctrl, SOL_SOCKET, SO_RCVBUF, &sz,
+		    sizeof(sz)) == 0)
+			break;
+	if (setsockopt(ctrl, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1)
+		err(ERRALT(EX_OSERR), "can't set receive timeout");
+}
+
+static int
+cmp_link(const void *a, const void *b)
+{
+	return strcmp(((const struct ngv_link *)a)->hook,
+	    ((const struct ngv_link *)b)->hook);
+}
+
+static int
+cmp_filter(const void *a, const void *b)
+{
+	return strcmp(((const struct ngv_filter *)a)->hook,
+	    ((const struct ngv_filter *)b)->hook);
+}
+
+static int
+cmp_entry(const void *a, const void *b)
+{
+	const struct ngv_entry *l = *(struct ngv_entry * const *)a;
+	const struct ngv_entry *r = *(struct ngv_entry * const *)b;
+
+	return strcmp(l->hook, r->hook);
+}
+
+/* everything connected to `vlan' and every filter it has */
+void
+ngv_load(ngctx ctrl, const char *vlan, struct ngv_state *st)
+{
+	int rc;
+	uint32_t ix;
+	char path[NG_PATHSIZE];
+	struct ng_reply r = NG_REPLY_INIT(NULL, 0);
+	struct hooklist *hlist;
+	struct ng_vlan_table *tbl;
+
+	memset(st, 0, sizeof(*st));
+	prepare_socket(ctrl);
+	snprintf(path, sizeof(path), "%s:", vlan);
+
+	rc = NgSendMsg(ctrl, path, NGM_GENERIC_COOKIE, NGM_LISTHOOKS, NULL, 0);
+	if (rc == -1) err(
+		ERRALT(EX_UNAVAILABLE), "unable to ask `%s' for its hooks", vlan
+	);
+	if (ng_recv_msg(ctrl, &r, NULL) == -1) err(
+		ERRALT(EX_IOERR), "unable to retrieve the hooks of `%s'", vlan
+	);
+	hlist = (struct hooklist *) r.msg->data;
+	if (strcmp(hlist->nodeinfo.type, NG_VLAN_NODE_TYPE) != 0) errx(
+		EX_DATAERR, "`%s' is an ng_%s, not an ng_vlan", vlan,
+		hlist->nodeinfo.type
+	);
+
+	st->links = calloc(MAX(hlist->nodeinfo.hooks, 1), sizeof(*st->links));
+	if (st->links == NULL) err(
+		EX_OSERR, "unable to allocate %u hooks", hlist->nodeinfo.hooks
+	);
+	for (ix = 0; ix < hlist->nodeinfo.hooks; ix++) {
+		struct ngv_link *l = &st->links[st->nlinks++];
+
+		strlcpy(l->hook, hlist->link[ix].ourhook, sizeof(l->hook));
+		strlcpy(l->name, hlist->link[ix].nodeinfo.name,
+		    sizeof(l->name));
+		strlcpy(l->type, hlist->link[ix].nodeinfo.type,
+		    sizeof(l->type));
+	}
+	qsort(st->links, st->nlinks, sizeof(*st->links), cmp_link);
+
+	rc = NgSendMsg(ctrl, path, NGM_VLAN_COOKIE, NGM_VLAN_GET_TABLE, NULL, 0);
+	if (rc == -1) err(
+		ERRALT(EX_UNAVAILABLE), "unable to ask `%s' for its filters",
+		vlan
+	);
+	if (ng_recv_msg(ctrl, &r, NULL) == -1) err(
+		ERRALT(EX_IOERR), "unable to retrieve the filters of `%s'", vlan
+	);
+	tbl = (struct ng_vlan_table *) r.msg->data;
+
+	st->filters = calloc(MAX(tbl->n, 1), sizeof(*st->filters));
+	if (st->filters == NULL) err(
+		EX_OSERR, "unable to allocate %u filters", tbl->n
+	);
+	for (ix = 0; ix < tbl->n; ix++) {
+		struct ngv_filter *f = &st->filters[st->nfilters++];
+
+		strlcpy(f->hook, tbl->filter[ix].hook_name, sizeof(f->hook));
+		f->vid = tbl->filter[ix].vid;
+	}
+	qsort(st->filters, st->nfilters, sizeof(*st->filters), cmp_filter);
+
+	ng_reply_fini(&r);
+}
+
+static void
+add(struct ngv_plan *p, enum ngv_op op, const struct ngv_entry *e,
+    const char *hook)
+{
+	if (p->n == p->nalloc) {
+		p->nalloc = MAX(p->nalloc * 2, 64);
+		p->a = reallocf(p->a, p->nalloc * sizeof(*p->a));
+		if (p->a == NULL) err(
+			EX_OSERR, "unable to allocate %zu messages", p->nalloc
+		);
+	}
+	p->a[p->n++] = (struct ngv_action){ .op = op, .e = e, .hook = hook };
+}
+
+static struct ngv_entry *
+find_entry(struct ngv_entry **byhook, size_t n, const char *hook)
+{
+	struct ngv_entry key, *pkey = &key, **found;
+
+	strlcpy(key.hook, hook, sizeof(key.hook));
+	found = bsearch(&pkey, byhook, n, sizeof(*byhook), cmp_entry);
+	return (found != NULL) ? *found : NULL;
+}
+
+static const struct ngv_link *
+find_link(const struct ngv_state *st, const char *hook)
+{
+	struct ngv_link key;
+
+	strlcpy(key.hook, hook, sizeof(key.hook));
+	return bsearch(&key, st->links, st->nlinks, sizeof(*st->links),
+	    cmp_link);
+}
+
+/*
+ * What to send for `vlan' to have the table `t', and nothing else when
+ * `prune'. Filters in the way of the table go first: ng_vlan(4) has one per
+ * tag and one per hook, a tag moving to another hook has to be let go of
+ * before it is added back.
+ */
+void
+ngv_plan(const struct ngv_state *st, struct ngv_table *t, bool prune,
+    struct ngv_plan *p)
+{
+	size_t ix;
+	struct ngv_entry **byhook, **byvid, *e;
+	const struct ngv_filter *f;
+	const struct ngv_link *l;
+
+	memset(p, 0, sizeof(*p));
+	byhook = calloc(MAX(t->n, 1), sizeof(*byhook));
+	byvid = calloc(NGV_MAX_VID + 1, sizeof(*byvid));
+	if (byhook == NULL || byvid == NULL) err(
+		EX_OSERR, "unable to index %zu VLANs", t->n
+	);
+	for (ix = 0; ix < t->n; ix++) {
+		byhook[ix] = &t->e[ix];
+		byvid[t->e[ix].vid] = &t->e[ix];
+	}
+	qsort(byhook, t->n, sizeof(*byhook), cmp_entry);
+
+	for (ix = 0; ix < st->nfilters; ix++) {
+		f = &st->filters[ix];
+		e = find_entry(byhook, t->n, f->hook);
+		if (e != NULL && e->vid == f->vid) {
+			e->kept = true;
+			continue;
+		}
+		if (e != NULL || (f->vid <= NGV_MAX_VID && byvid[f->vid] != NULL)
+		    || prune)
+			add(p, NGV_DELFILTER, NULL, f->hook);
+		else
+			p->extra++;
+	}
+
+	for (ix = 0; ix < t->n; ix++) {
+		e = &t->e[ix];
+		if ((l = find_link(st, e->hook)) == NULL) {
+			add(p, NGV_MKPEER, e, e->hook);
+			add(p, NGV_NAME, e, e->hook);
+		} else if (strcmp(l->type, NG_EIFACE_NODE_TYPE) != 0) {
+			errx(EX_DATAERR, "line %d: `%s' is connected to an "
+			    "ng_%s", e->line, e->hook, l->type);
+		} else if (strcmp(l->name, e->name) != 0) {
+			add(p, NGV_NAME, e, e->hook);
+		}
+		if (!e->kept)
+			add(p, NGV_ADDFILTER, e, e->hook);
+	}
+
+	/* only interfaces we would have made, never the trunk */
+	for (ix = 0; prune && ix < st->nlinks; ix++) {
+		l = &st->links[ix];
+		if (strcmp(l->hook, NG_VLAN_HOOK_DOWNSTREAM) == 0 ||
+		    strcmp(l->hook, NG_VLAN_HOOK_NOMATCH) == 0)
+			continue;
+		if (strcmp(l->type, NG_EIFACE_NODE_TYPE) == 0 &&
+		    find_entry(byhook, t->n, l->hook) == NULL)
+			add(p, NGV_SHUTDOWN, NULL, l->hook);
+	}
+
+	free(byvid);
+	free(byhook);
+}
+
+/* every message of `p', without waiting for anything */
+void
+ngv_apply(ngctx ctrl, const char *vlan, const struct ngv_plan *p)
+{
+	int rc;
+	size_t ix;
+	char node[NG_PATHSIZE], hook[NG_PATHSIZE];
+	const struct ngv_action *a;
+
+	snprintf(node, sizeof(node), "%s:", vlan);
+	for (ix = 0; ix < p->n; ix++) {
+		a = &p->a[ix];
+		snprintf(hook, sizeof(hook), "%s:%s", vlan, a->hook);
+
+		switch (a->op) {
+		case NGV_DELFILTER:
+		    {
+			char arg[NG_HOOKSIZ];
+
+			strlcpy(arg, a->hook, sizeof(arg));
+			rc = NgSendMsg(ctrl, node, NGM_VLAN_COOKIE,
+			    NGM_VLAN_DEL_FILTER, arg, sizeof(arg));
+			break;
+		    }
+		case NGV_MKPEER:
+		    {
+			struct ngm_mkpeer arg = {
+				.type = NG_EIFACE_NODE_TYPE,
+				.peerhook = NG_EIFACE_HOOK_ETHER,
+			};
+
+			strlcpy(arg.ourhook, a->hook, sizeof(arg.ourhook));
+			rc = NgSendMsg(ctrl, node, NGM_GENERIC_COOKIE,
+			    NGM_MKPEER, &arg, sizeof(arg));
+			break;
+		    }
+		case NGV_NAME:
+		    {
+			struct ngm_name arg;
+
+			strlcpy(arg.name, a->e->name, sizeof(arg.name));
+			rc = NgSendMsg(ctrl, hook, NGM_GENERIC_COOKIE,
+			    NGM_NAME, &arg, sizeof(arg));
+			break;
+		    }
+		case NGV_ADDFILTER:
+		    {
+			struct ng_vlan_filter arg = { .vid = a->e->vid };
+
+			strlcpy(arg.hook_name, a->hook, sizeof(arg.hook_name));
+			rc = NgSendMsg(ctrl, node, NGM_VLAN_COOKIE,
+			    NGM_VLAN_ADD_FILTER, &arg, sizeof(arg));
+			break;
+		    }
+		case NGV_SHUTDOWN:
+			rc = NgSendMsg(ctrl, hook, NGM_GENERIC_COOKIE,
+			    NGM_SHUTDOWN, NULL, 0);
+			break;
+		}
+		if (rc == -1 && a->e != NULL) err(
+			ERREXIT, "line %d: unable to set up vlan %u on `%s'",
+			a->e->line, a->e->vid, hook
+		);
+		if (rc == -1) err(
+			ERREXIT, "unable to remove `%s'", hook
+		);
+	}
+}
+
+/* `p' as ngctl(8) would take it */
+void
+ngv_print(FILE *fp, const char *vlan, const struct ngv_plan *p)
+{
+	size_t ix;
+	const struct ngv_action *a;
+
+	for (ix = 0; ix < p->n; ix++) {
+		a = &p->a[ix];
+		switch (a->op) {
+		case NGV_DELFILTER:
+			fprintf(fp, "msg %s: delfilter \"%s\"\n", vlan, a->hook);
+			break;
+		case NGV_MKPEER:
+			fprintf(fp, "mkpeer %s: %s %s %s\n", vlan,
+			    NG_EIFACE_NODE_TYPE, a->hook, NG_EIFACE_HOOK_ETHER);
+			break;
+		case NGV_NAME:
+			fprintf(fp, "name %s:%s %s\n", vlan, a->hook,
+			    a->e->name);
+			break;
+		case NGV_ADDFILTER:
+			fprintf(fp, "msg %s: addfilter { vlan=%u hook=\"%s\" "
+			    "pcp=0 cfi=0 }\n", vlan, a->e->vid, a->hook);
+			break;
+		case NGV_SHUTDOWN:
+			fprintf(fp, "shutdown %s:%s\n", vlan, a->hook);
+			break;
+		}
+	}
+}
+
+/*
+ * Interfaces get the name of their node, the way jeiface does it. Only the
+ * ones that were named just now are asked about, `batch' at a time.
+ * Returns how many were renamed.
+ */
+int
+ngv_rename(ngctx ctrl, const char *vlan, const struct ngv_plan *p, int batch)
+{
+	union {
+		struct ng_mesg	msg;
+		char		buf[NG_REPLYSIZ(IFNAMSIZ)];
+	} u;
+	struct ng_reply reply = NG_REPLY_INIT(&u, sizeof(u));
+	struct ifreq ifr;
+	const struct ngv_entry **which, *e;
+	int *tokens, token, s, got, sent, ix, renamed = 0;
+	size_t next;
+	char path[NG_PATHSIZE];
+
+	assert(batch > 0);
+
+	tokens = calloc(batch, sizeof(*tokens));
+	which = calloc(batch, sizeof(*which));
+	if (tokens == NULL || which == NULL) err(
+		EX_OSERR, "unable to allocate %d slots", batch
+	);
+	if ((s = socket(AF_LOCAL, SOCK_DGRAM, 0)) == -1) err(
+		ERRALT(EX_OSERR), "unable to create socket for ioctl"
+	);
+
+	for (next = 0; next < p->n;) {
+		for (sent = 0; next < p->n && sent < batch; next++) {
+			if (p->a[next].op != NGV_NAME)
+				continue;
+			snprintf(path, sizeof(path), "%s:%s", vlan,
+			    p->a[next].hook);
+			token = NgSendMsg(ctrl, path, NGM_EIFACE_COOKIE,
+			    NGM_EIFACE_GET_IFNAME, NULL, 0);
+			if (token == -1) err(
+				ERREXIT, "unable to ask `%s' for its interface",
+				path
+			);
+			tokens[sent] = token;
+			which[sent++] = p->a[next].e;
+		}
+
+		for (got = 0; got < sent;) {
+			if (ng_recv_msg(ctrl, &reply, NULL) == -1) err(
+				ERRALT(EX_IOERR), "unable to retrieve interface "
+				"names"
+			);
+			for (ix = 0; ix < sent; ix++)
+				if (tokens[ix] == (int)reply.msg->header.token)
+					break;
+			if (ix == sent)
+				continue; /* not ours, still waiting for one */
+			got++;
+
+			e = which[ix];
+			memset(&ifr, 0, sizeof(ifr));
+			strlcpy(ifr.ifr_name, reply.msg->data,
+			    sizeof(ifr.ifr_name));
+			if (strcmp(ifr.ifr_name, e->name) == 0)
+				continue;
+			ifr.ifr_data = (caddr_t)(uintptr_t)e->name;
+			if (ioctl(s, SIOCSIFNAME, &ifr) == -1) {
+				warn("line %d: unable to rename %s to %s",
+				    e->line, ifr.ifr_name, e->name);
+				continue;
+			}
+			renamed++;
+		}
+	}
+
+	(void) close(s);
+	free(which);
+	free(tokens);
+	return (renamed);
+}